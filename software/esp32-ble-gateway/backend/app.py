@@ -12,17 +12,19 @@ Enhanced Features:
 """
 
 import asyncio
+import hashlib
 import json
 import logging
 import os
+import re
 import secrets
 from datetime import datetime, timedelta
 from typing import Dict, Any, Optional, List
 from contextlib import asynccontextmanager
 from pathlib import Path
 
-from fastapi import FastAPI, WebSocket, WebSocketDisconnect, HTTPException, Query, Depends, Header, UploadFile, File
-from fastapi.responses import JSONResponse, FileResponse, HTMLResponse
+from fastapi import FastAPI, WebSocket, WebSocketDisconnect, HTTPException, Query, Depends, Header, UploadFile, File, Request
+from fastapi.responses import JSONResponse, FileResponse, HTMLResponse, Response
 from fastapi.staticfiles import StaticFiles
 from fastapi.middleware.cors import CORSMiddleware
 from fastapi.middleware.gzip import GZipMiddleware
@@ -30,7 +32,7 @@ from fastapi.security import APIKeyHeader
 from pydantic import BaseModel
 from pydantic_settings import BaseSettings
 
-from mqtt_client import MQTTClient, get_mqtt_client
+from mqtt_client import MQTTClient, get_mqtt_client, decode_history_chunk
 from history_store import HistoryStore, get_history_store
 
 logging.basicConfig(
@@ -65,6 +67,14 @@ class Settings(BaseSettings):
     # OTA Configuration
     ota_upload_dir: str = "./ota_firmware"
     max_firmware_size: int = 4 * 1024 * 1024  # 4MB max
+    # Base URL gateways download firmware from (e.g. http://192.168.1.10:5225); empty = the request's host
+    public_url: str = ""
+    
+    # Charger debug logs reassembled from get_debug_log
+    debug_log_dir: str = "./debug_logs"
+    
+    # Gaps in port data longer than this are backfilled from the gateway's history rings
+    backfill_min_gap_seconds: int = 60
     
     # Frontend path
     frontend_path: str = "../frontend"
@@ -78,6 +88,7 @@ settings = Settings()
 
 # Ensure OTA directory exists
 Path(settings.ota_upload_dir).mkdir(parents=True, exist_ok=True)
+Path(settings.debug_log_dir).mkdir(parents=True, exist_ok=True)
 
 
 # ============ API Key Authentication ============
@@ -118,9 +129,19 @@ class BrightnessRequest(BaseModel):
 
 
 class OTAUpdateRequest(BaseModel):
-    """OTA update request model."""
+    """OTA update request model (uploaded firmware_id or a firmware_url)."""
     gateway_id: str
+    firmware_id: Optional[str] = None
+    firmware_url: Optional[str] = None
+    sha256: Optional[str] = None  # Expected digest, hex; required with firmware_url
+
+
+class ChargerOTARequest(BaseModel):
+    """Charger firmware update request model (uploaded firmware_id or a firmware_url)."""
+    firmware_id: Optional[str] = None
     firmware_url: Optional[str] = None
+    window: Optional[int] = None
+    confirm: bool = True
 
 
 # ============ Global State ============
@@ -130,6 +151,8 @@ timeout_check_task: Optional[asyncio.Task] = None
 websocket_clients: List[WebSocket] = []
 ota_firmware_files: Dict[str, Dict[str, Any]] = {}
 history_store: Optional[HistoryStore] = None
+last_ports_seen: Dict[str, datetime] = {}
+backfill_windows: Dict[str, tuple] = {}  # gateway_id -> (start, end) being backfilled
 
 
 # ============ Gateway Timeout Detection ============
@@ -235,7 +258,65 @@ app.add_middleware(
 )
 
 
+def debug_log_path(gateway_id: str, cmd_id: str) -> Path:
+    safe_name = "".join(c for c in f"{gateway_id}_{cmd_id}" if c.isalnum() or c in "-_")
+    return Path(settings.debug_log_dir) / f"{safe_name}.log"
+
+
+async def request_backfill(gateway_id: str, start: datetime, end: datetime) -> None:
+    """Ask the gateway for its history of a gap in port data."""
+    backfill_windows[gateway_id] = (start, end)
+    last_s = int((end - start).total_seconds()) + 1
+    logger.info(f"Backfilling {gateway_id}: {last_s}s of missing port data")
+    try:
+        response = await mqtt_client.send_command(gateway_id, "get_history", {"last_s": last_s})
+    except RuntimeError:
+        response = None
+    if not response or not response.get("success"):
+        backfill_windows.pop(gateway_id, None)
+
+
+def check_port_gap(gateway_id: str) -> None:
+    # UTC, like the port_history timestamps
+    now = datetime.utcnow()
+    last = last_ports_seen.get(gateway_id) or history_store.get_last_port_timestamp(gateway_id)
+    last_ports_seen[gateway_id] = now
+    if last is None or gateway_id in backfill_windows:
+        return
+    if (now - last).total_seconds() > settings.backfill_min_gap_seconds:
+        asyncio.create_task(request_backfill(gateway_id, last, now))
+
+
+def record_history_chunk(gateway_id: str, data: Dict[str, Any]) -> None:
+    window = backfill_windows.get(gateway_id)
+    if window is None:
+        return
+    if data.get("final"):
+        backfill_windows.pop(gateway_id, None)
+        logger.info(f"Backfill of {gateway_id} done: {data.get('samples', 0)} samples")
+        return
+    start, end = window
+    rows = [row for row in decode_history_chunk(data, datetime.utcnow())
+            if start < row["timestamp"] < end]
+    if rows:
+        history_store.record_port_samples(gateway_id, rows)
+
+
 def on_gateway_update(gateway_id: str, event_type: str, data: Any) -> None:
+    if event_type == "history":
+        # Backfill only; chunks are not forwarded to clients
+        if history_store:
+            record_history_chunk(gateway_id, data)
+        return
+    
+    if event_type == "debug_log":
+        # Write the log to disk; clients only get the metadata
+        data = dict(data)
+        filepath = debug_log_path(gateway_id, data["cmd_id"])
+        filepath.write_bytes(data.pop("content"))
+        data["file"] = filepath.name
+        logger.info(f"Debug log saved: {filepath} ({data['bytes']} bytes)")
+    
     asyncio.create_task(broadcast_update(gateway_id, event_type, data))
     
     if history_store and event_type == "ports":
@@ -244,9 +325,16 @@ def on_gateway_update(gateway_id: str, event_type: str, data: Any) -> None:
             port_list = list(ports.values())
         else:
             port_list = ports
+        check_port_gap(gateway_id)
         history_store.record_port_data(gateway_id, port_list)
     
-    if history_store and event_type in ("status", "timeout"):
+    if history_store and event_type == "aggregate":
+        history_store.record_aggregate(gateway_id, data)
+    
+    if history_store and event_type == "session" and data.get("event") in ("end", "history"):
+        history_store.record_session(gateway_id, data)
+    
+    if history_store and event_type in ("status", "timeout", "rule", "allocator"):
         history_store.record_event(gateway_id, event_type, data)
 
 
@@ -375,6 +463,71 @@ async def get_gateway_ports(gateway_id: str, _: bool = Depends(verify_api_key)):
     })
 
 
+@app.get("/api/gateway/{gateway_id}/port/{port_id}/power_curve")
+async def get_port_power_curve(gateway_id: str, port_id: int, _: bool = Depends(verify_api_key)):
+    """Get the last historical power curve fetched with get_power_curve."""
+    if not mqtt_client:
+        raise HTTPException(status_code=503, detail="MQTT client not initialized")
+
+    curve = mqtt_client.data_store.get_power_curve(gateway_id, port_id)
+    if not curve:
+        raise HTTPException(status_code=404, detail=f"No power curve for port {port_id}")
+
+    return JSONResponse(content=curve)
+
+
+@app.get("/api/gateway/{gateway_id}/shadow")
+async def get_gateway_shadow(gateway_id: str, _: bool = Depends(verify_api_key)):
+    """Get the charger configuration shadow (retained on the broker)."""
+    if not mqtt_client:
+        raise HTTPException(status_code=503, detail="MQTT client not initialized")
+
+    shadow = mqtt_client.data_store.get_shadow(gateway_id)
+    if not shadow:
+        raise HTTPException(status_code=404, detail="No configuration shadow received")
+
+    return JSONResponse(content=shadow)
+
+
+@app.get("/api/gateway/{gateway_id}/metrics")
+async def get_gateway_metrics(gateway_id: str, _: bool = Depends(verify_api_key)):
+    """Get the last BLE link metrics (latency histograms, errors, RSSI)."""
+    if not mqtt_client:
+        raise HTTPException(status_code=503, detail="MQTT client not initialized")
+
+    metrics = mqtt_client.data_store.get_metrics(gateway_id)
+    if not metrics:
+        raise HTTPException(status_code=404, detail="No link metrics received")
+
+    return JSONResponse(content=metrics)
+
+
+@app.get("/api/gateway/{gateway_id}/debug_log/{cmd_id}")
+async def download_debug_log(gateway_id: str, cmd_id: str, _: bool = Depends(verify_api_key)):
+    """Download a debug log reassembled from a get_debug_log command."""
+    filepath = debug_log_path(gateway_id, cmd_id)
+    if not filepath.exists():
+        raise HTTPException(status_code=404, detail="Debug log not available yet")
+
+    return FileResponse(str(filepath), media_type="text/plain", filename=filepath.name)
+
+
+@app.get("/api/gateway/{gateway_id}/burst/{cmd_id}")
+async def get_burst_capture(gateway_id: str, cmd_id: str, _: bool = Depends(verify_api_key)):
+    """Get the decoded samples and report of a burst_capture command."""
+    if not mqtt_client:
+        raise HTTPException(status_code=503, detail="MQTT client not initialized")
+
+    burst = mqtt_client.data_store.get_burst(gateway_id, cmd_id)
+    if not burst or "report" not in burst:
+        raise HTTPException(status_code=404, detail="Burst capture not available yet")
+
+    return JSONResponse(content={
+        "report": burst["report"],
+        "capture": burst.get("capture")
+    })
+
+
 @app.get("/api/port-status")
 async def get_port_status(
     gateway_id: Optional[str] = Query(None),
@@ -630,6 +783,7 @@ async def upload_firmware(
         "filename": safe_filename,
         "original_name": file.filename,
         "size": len(contents),
+        "sha256": hashlib.sha256(contents).hexdigest(),
         "uploaded_at": datetime.now().isoformat(),
         "path": str(filepath)
     }
@@ -654,8 +808,11 @@ async def list_firmware(_: bool = Depends(verify_api_key)):
 
 
 @app.get("/api/ota/firmware/{firmware_id}")
-async def download_firmware(firmware_id: str):
-    """Download firmware file (no auth for ESP32 access)."""
+async def download_firmware(firmware_id: str, range_header: Optional[str] = Header(None, alias="Range")):
+    """Download firmware file (no auth for ESP32 access).
+
+    Gateways resume interrupted downloads with "Range: bytes=N-".
+    """
     if firmware_id not in ota_firmware_files:
         raise HTTPException(status_code=404, detail="Firmware not found")
     
@@ -665,6 +822,23 @@ async def download_firmware(firmware_id: str):
     if not filepath.exists():
         raise HTTPException(status_code=404, detail="Firmware file not found on disk")
     
+    match = re.fullmatch(r"bytes=(\d+)-", range_header or "")
+    if match and int(match.group(1)) > 0:
+        start = int(match.group(1))
+        size = filepath.stat().st_size
+        if start >= size:
+            raise HTTPException(status_code=416, detail="Range not satisfiable",
+                                headers={"Content-Range": f"bytes */{size}"})
+        with open(filepath, "rb") as f:
+            f.seek(start)
+            data = f.read()
+        return Response(
+            content=data,
+            status_code=206,
+            media_type="application/octet-stream",
+            headers={"Content-Range": f"bytes {start}-{size - 1}/{size}", "Accept-Ranges": "bytes"}
+        )
+    
     return FileResponse(
         str(filepath),
         media_type="application/octet-stream",
@@ -672,22 +846,42 @@ async def download_firmware(firmware_id: str):
     )
 
 
+def firmware_download_params(firmware_id: str, http_request: Request) -> Dict[str, Any]:
+    """Download URL, size and digest of an uploaded firmware, as the gateway fetches it."""
+    firmware = ota_firmware_files.get(firmware_id)
+    if not firmware:
+        raise HTTPException(status_code=404, detail="Firmware not found")
+    base = settings.public_url.rstrip("/") or str(http_request.base_url).rstrip("/")
+    return {
+        "url": f"{base}/api/ota/firmware/{firmware_id}",
+        "size": firmware["size"],
+        "sha256": firmware["sha256"]
+    }
+
+
 @app.post("/api/gateway/{gateway_id}/ota")
 async def trigger_ota_update(
     gateway_id: str,
     request: OTAUpdateRequest,
+    http_request: Request,
     _: bool = Depends(verify_api_key)
 ):
-    """Trigger OTA update on a gateway."""
+    """Trigger a pull OTA update; progress arrives on the ota topic."""
     if not mqtt_client:
         raise HTTPException(status_code=503, detail="MQTT client not initialized")
     
+    if request.firmware_id:
+        params = firmware_download_params(request.firmware_id, http_request)
+    elif request.firmware_url:
+        # The gateway refuses images it cannot verify
+        if not request.sha256:
+            raise HTTPException(status_code=400, detail="sha256 required with firmware_url")
+        params = {"url": request.firmware_url, "sha256": request.sha256}
+    else:
+        raise HTTPException(status_code=400, detail="firmware_id or firmware_url required")
+    
     try:
         # Send OTA command via MQTT
-        params = {}
-        if request.firmware_url:
-            params["url"] = request.firmware_url
-        
         response = await mqtt_client.send_command(
             gateway_id,
             "ota_update",
@@ -702,6 +896,63 @@ async def trigger_ota_update(
         raise HTTPException(status_code=500, detail=str(e))
 
 
+@app.post("/api/gateway/{gateway_id}/charger_ota")
+async def trigger_charger_ota(
+    gateway_id: str,
+    request: ChargerOTARequest,
+    http_request: Request,
+    _: bool = Depends(verify_api_key)
+):
+    """Stream charger firmware through a gateway; progress arrives on the charger_ota topic."""
+    if not mqtt_client:
+        raise HTTPException(status_code=503, detail="MQTT client not initialized")
+
+    if request.firmware_id:
+        params = firmware_download_params(request.firmware_id, http_request)
+    elif request.firmware_url:
+        params = {"url": request.firmware_url}
+    else:
+        raise HTTPException(status_code=400, detail="firmware_id or firmware_url required")
+    params["confirm"] = request.confirm
+    if request.window:
+        params["window"] = request.window
+
+    try:
+        response = await mqtt_client.send_command(gateway_id, "charger_ota", params)
+        if response:
+            return JSONResponse(content={"success": response.get("success", False), "response": response})
+        else:
+            return JSONResponse(content={"success": False, "error": "Command timeout"})
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=str(e))
+
+
+@app.get("/api/gateway/{gateway_id}/charger_ota")
+async def get_charger_ota(gateway_id: str, _: bool = Depends(verify_api_key)):
+    """Get the last charger firmware transfer event (phase, offset, percent, rate)."""
+    if not mqtt_client:
+        raise HTTPException(status_code=503, detail="MQTT client not initialized")
+
+    status = mqtt_client.data_store.get_charger_ota(gateway_id)
+    if not status:
+        raise HTTPException(status_code=404, detail="No charger firmware transfer reported")
+
+    return JSONResponse(content=status)
+
+
+@app.get("/api/gateway/{gateway_id}/ota")
+async def get_ota_status(gateway_id: str, _: bool = Depends(verify_api_key)):
+    """Get the last pull OTA event of a gateway (phase, offset, percent, rate)."""
+    if not mqtt_client:
+        raise HTTPException(status_code=503, detail="MQTT client not initialized")
+
+    status = mqtt_client.data_store.get_ota(gateway_id)
+    if not status:
+        raise HTTPException(status_code=404, detail="No OTA update reported")
+
+    return JSONResponse(content=status)
+
+
 @app.delete("/api/ota/firmware/{firmware_id}")
 async def delete_firmware(firmware_id: str, _: bool = Depends(verify_api_key)):
     """Delete uploaded firmware file."""
@@ -776,6 +1027,21 @@ async def get_gateway_events(
     return JSONResponse(content={"events": events, "count": len(events)})
 
 
+@app.get("/api/gateway/{gateway_id}/sessions")
+async def get_gateway_sessions(
+    gateway_id: str,
+    port_id: Optional[int] = Query(None),
+    hours: int = Query(24, ge=1, le=168),
+    limit: int = Query(100, ge=1, le=1000),
+    _: bool = Depends(verify_api_key)
+):
+    if not history_store:
+        raise HTTPException(status_code=503, detail="History store not initialized")
+    
+    sessions = history_store.get_sessions(gateway_id, port_id, hours, limit)
+    return JSONResponse(content={"sessions": sessions, "count": len(sessions)})
+
+
 # ============ Status Endpoint ============
 @app.get("/api/status")
 async def get_status(_: bool = Depends(verify_api_key)):
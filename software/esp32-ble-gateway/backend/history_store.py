@@ -63,6 +63,45 @@ class HistoryStore:
                 
                 CREATE INDEX IF NOT EXISTS idx_power_aggregates 
                     ON power_aggregates(gateway_id, period_type, period_start);
+                
+                CREATE TABLE IF NOT EXISTS port_energy (
+                    id INTEGER PRIMARY KEY AUTOINCREMENT,
+                    gateway_id TEXT NOT NULL,
+                    port_id INTEGER NOT NULL,
+                    period_start DATETIME NOT NULL,
+                    duration_s REAL,
+                    covered_s REAL,
+                    energy_wh REAL,
+                    min_power_w REAL,
+                    max_power_w REAL,
+                    avg_power_w REAL
+                );
+                
+                CREATE INDEX IF NOT EXISTS idx_port_energy 
+                    ON port_energy(gateway_id, port_id, period_start);
+                
+                CREATE TABLE IF NOT EXISTS charge_sessions (
+                    id INTEGER PRIMARY KEY AUTOINCREMENT,
+                    gateway_id TEXT NOT NULL,
+                    port_id INTEGER NOT NULL,
+                    ended_at DATETIME NOT NULL,
+                    start_ms INTEGER,
+                    duration_s INTEGER,
+                    energy_wh REAL,
+                    peak_power_w REAL,
+                    start_protocol TEXT,
+                    end_protocol TEXT,
+                    protocol_changes INTEGER,
+                    tapered INTEGER,
+                    end_reason TEXT,
+                    battery_start INTEGER,
+                    battery_end INTEGER,
+                    charger_start_ts INTEGER,
+                    UNIQUE(gateway_id, port_id, start_ms, duration_s)
+                );
+                
+                CREATE INDEX IF NOT EXISTS idx_charge_sessions 
+                    ON charge_sessions(gateway_id, ended_at);
             ''')
         logger.info(f"History database initialized at {self.db_path}")
 
@@ -93,6 +132,99 @@ class HistoryStore:
                     port.get("temperature", 0)
                 ))
 
+    def record_port_samples(self, gateway_id: str, rows: List[Dict[str, Any]]):
+        """Store port samples that carry their own (UTC) timestamp, e.g. backfill.
+
+        Timestamps are written in the CURRENT_TIMESTAMP format so they sort
+        with live rows.
+        """
+        with self._get_conn() as conn:
+            conn.executemany('''
+                INSERT INTO port_history 
+                (gateway_id, port_id, timestamp, voltage_mv, current_ma, power_w, protocol, temperature)
+                VALUES (?, ?, ?, ?, ?, ?, ?, ?)
+            ''', [(
+                gateway_id,
+                row.get("port_id", 0),
+                row["timestamp"].strftime("%Y-%m-%d %H:%M:%S"),
+                row.get("voltage", 0),
+                row.get("current", 0),
+                row.get("power", 0.0),
+                row.get("protocol", 0),
+                row.get("temperature", 0)
+            ) for row in rows])
+
+    def get_last_port_timestamp(self, gateway_id: str) -> Optional[datetime]:
+        """Time of the newest stored port sample (UTC)."""
+        with self._get_conn() as conn:
+            row = conn.execute('''
+                SELECT MAX(timestamp) as last FROM port_history WHERE gateway_id = ?
+            ''', (gateway_id,)).fetchone()
+        return datetime.fromisoformat(row["last"]) if row and row["last"] else None
+
+    def record_aggregate(self, gateway_id: str, aggregate: Dict[str, Any]):
+        """Store a per-minute aggregate integrated on the gateway (energy in mJ)."""
+        period_start = datetime.now() - timedelta(milliseconds=aggregate.get("duration_ms", 0))
+        duration_s = aggregate.get("duration_ms", 0) / 1000.0
+        covered_s = aggregate.get("covered_ms", 0) / 1000.0
+        
+        with self._get_conn() as conn:
+            conn.execute('''
+                INSERT OR REPLACE INTO power_aggregates 
+                (gateway_id, period_type, period_start, total_power_wh, max_power_w, avg_power_w, sample_count)
+                VALUES (?, 'minute', ?, ?, ?, ?, ?)
+            ''', (
+                gateway_id,
+                period_start.isoformat(),
+                aggregate.get("energy_mj", 0) / 3.6e6,
+                aggregate.get("max_power", 0.0),
+                aggregate.get("avg_power", 0.0),
+                aggregate.get("samples", 0)
+            ))
+            for port in aggregate.get("ports", []):
+                conn.execute('''
+                    INSERT INTO port_energy 
+                    (gateway_id, port_id, period_start, duration_s, covered_s, energy_wh, min_power_w, max_power_w, avg_power_w)
+                    VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)
+                ''', (
+                    gateway_id,
+                    port.get("port_id", 0),
+                    period_start.isoformat(),
+                    duration_s,
+                    covered_s,
+                    port.get("energy_mj", 0) / 3.6e6,
+                    port.get("min_power", 0.0),
+                    port.get("max_power", 0.0),
+                    port.get("avg_power", 0.0)
+                ))
+
+    def record_session(self, gateway_id: str, session: Dict[str, Any]):
+        """Store a closed charge session; republished records are ignored."""
+        with self._get_conn() as conn:
+            conn.execute('''
+                INSERT OR IGNORE INTO charge_sessions 
+                (gateway_id, port_id, ended_at, start_ms, duration_s, energy_wh, peak_power_w,
+                 start_protocol, end_protocol, protocol_changes, tapered, end_reason,
+                 battery_start, battery_end, charger_start_ts)
+                VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+            ''', (
+                gateway_id,
+                session.get("port_id", 0),
+                datetime.now().isoformat(),
+                session.get("start_ms"),
+                session.get("duration_s"),
+                session.get("energy_wh"),
+                session.get("peak_power"),
+                session.get("start_protocol"),
+                session.get("end_protocol"),
+                session.get("protocol_changes"),
+                1 if session.get("tapered") else 0,
+                session.get("reason"),
+                session.get("battery_start"),
+                session.get("battery_end"),
+                session.get("charger_start_ts")
+            ))
+
     def record_event(self, gateway_id: str, event_type: str, event_data: Any = None):
         with self._get_conn() as conn:
             conn.execute('''
@@ -107,7 +239,8 @@ class HistoryStore:
         hours: int = 24,
         limit: int = 1000
     ) -> List[Dict[str, Any]]:
-        since = datetime.now() - timedelta(hours=hours)
+        # port_history timestamps are CURRENT_TIMESTAMP strings (UTC)
+        since = (datetime.utcnow() - timedelta(hours=hours)).strftime("%Y-%m-%d %H:%M:%S")
         
         with self._get_conn() as conn:
             if port_id is not None:
@@ -115,28 +248,30 @@ class HistoryStore:
                     SELECT * FROM port_history 
                     WHERE gateway_id = ? AND port_id = ? AND timestamp > ?
                     ORDER BY timestamp DESC LIMIT ?
-                ''', (gateway_id, port_id, since.isoformat(), limit)).fetchall()
+                ''', (gateway_id, port_id, since, limit)).fetchall()
             else:
                 rows = conn.execute('''
                     SELECT * FROM port_history 
                     WHERE gateway_id = ? AND timestamp > ?
                     ORDER BY timestamp DESC LIMIT ?
-                ''', (gateway_id, since.isoformat(), limit)).fetchall()
+                ''', (gateway_id, since, limit)).fetchall()
         
         return [dict(row) for row in rows]
 
     def get_power_stats(self, gateway_id: str, hours: int = 24) -> Dict[str, Any]:
+        # Energy comes from the gateway's per-minute aggregates, which are
+        # integrated over real sample times; raw samples are not evenly spaced
         since = datetime.now() - timedelta(hours=hours)
         
         with self._get_conn() as conn:
             row = conn.execute('''
                 SELECT 
-                    SUM(power_w) / 3600.0 as total_wh,
-                    MAX(power_w) as max_power,
-                    AVG(power_w) as avg_power,
-                    COUNT(*) as samples
-                FROM port_history
-                WHERE gateway_id = ? AND timestamp > ?
+                    SUM(total_power_wh) as total_wh,
+                    MAX(max_power_w) as max_power,
+                    AVG(avg_power_w) as avg_power,
+                    SUM(sample_count) as samples
+                FROM power_aggregates
+                WHERE gateway_id = ? AND period_type = 'minute' AND period_start > ?
             ''', (gateway_id, since.isoformat())).fetchone()
         
         return {
@@ -149,18 +284,21 @@ class HistoryStore:
         }
 
     def get_hourly_power(self, gateway_id: str, hours: int = 24) -> List[Dict[str, Any]]:
+        # total_power keeps its old meaning (sum of sampled watts) for
+        # existing clients; energy_wh is the integrated energy
         since = datetime.now() - timedelta(hours=hours)
         
         with self._get_conn() as conn:
             rows = conn.execute('''
                 SELECT 
-                    strftime('%Y-%m-%d %H:00:00', timestamp) as hour,
-                    SUM(power_w) as total_power,
-                    MAX(power_w) as max_power,
-                    AVG(power_w) as avg_power,
-                    COUNT(*) as samples
-                FROM port_history
-                WHERE gateway_id = ? AND timestamp > ?
+                    strftime('%Y-%m-%d %H:00:00', period_start) as hour,
+                    SUM(total_power_wh) as energy_wh,
+                    SUM(avg_power_w * sample_count) as total_power,
+                    MAX(max_power_w) as max_power,
+                    AVG(avg_power_w) as avg_power,
+                    SUM(sample_count) as samples
+                FROM power_aggregates
+                WHERE gateway_id = ? AND period_type = 'minute' AND period_start > ?
                 GROUP BY hour
                 ORDER BY hour
             ''', (gateway_id, since.isoformat())).fetchall()
@@ -198,12 +336,40 @@ class HistoryStore:
             result.append(item)
         return result
 
+    def get_sessions(
+        self,
+        gateway_id: str,
+        port_id: Optional[int] = None,
+        hours: int = 24,
+        limit: int = 100
+    ) -> List[Dict[str, Any]]:
+        since = datetime.now() - timedelta(hours=hours)
+        
+        with self._get_conn() as conn:
+            if port_id is not None:
+                rows = conn.execute('''
+                    SELECT * FROM charge_sessions 
+                    WHERE gateway_id = ? AND port_id = ? AND ended_at > ?
+                    ORDER BY ended_at DESC LIMIT ?
+                ''', (gateway_id, port_id, since.isoformat(), limit)).fetchall()
+            else:
+                rows = conn.execute('''
+                    SELECT * FROM charge_sessions 
+                    WHERE gateway_id = ? AND ended_at > ?
+                    ORDER BY ended_at DESC LIMIT ?
+                ''', (gateway_id, since.isoformat(), limit)).fetchall()
+        
+        return [dict(row) for row in rows]
+
     def cleanup_old_data(self, days: int = 7):
         cutoff = datetime.now() - timedelta(days=days)
         
         with self._get_conn() as conn:
             conn.execute('DELETE FROM port_history WHERE timestamp < ?', (cutoff.isoformat(),))
             conn.execute('DELETE FROM gateway_events WHERE timestamp < ?', (cutoff.isoformat(),))
+            conn.execute('DELETE FROM power_aggregates WHERE period_start < ?', (cutoff.isoformat(),))
+            conn.execute('DELETE FROM port_energy WHERE period_start < ?', (cutoff.isoformat(),))
+            conn.execute('DELETE FROM charge_sessions WHERE ended_at < ?', (cutoff.isoformat(),))
         
         logger.info(f"Cleaned up history data older than {days} days")
 
@@ -6,10 +6,11 @@ Forwards commands to specific gateways via MQTT.
 """
 
 import asyncio
+import base64
 import json
 import logging
-from datetime import datetime
-from typing import Dict, Any, Optional, Callable, List
+from datetime import datetime, timedelta
+from typing import Dict, Any, Optional, Callable, List, Tuple
 from dataclasses import dataclass, field
 from collections import defaultdict
 
@@ -28,8 +29,17 @@ class PortData:
     current_ma: int = 0
     power_w: float = 0.0
     temperature: int = 0
+    battery_last_full: int = 0  # 0.1 Wh units, reported by the attached device
+    battery_present: int = 0    # 0.1 Wh units
     updated_at: datetime = field(default_factory=datetime.now)
 
+    @property
+    def battery_soc(self) -> Optional[int]:
+        """Estimated state of charge (%) of the attached device, if known."""
+        if self.battery_last_full <= 0:
+            return None
+        return max(0, min(100, round(self.battery_present * 100 / self.battery_last_full)))
+
     def to_dict(self) -> Dict[str, Any]:
         return {
             "port_id": self.port_id,
@@ -39,10 +49,131 @@ class PortData:
             "current": self.current_ma,
             "power": self.power_w,
             "temperature": self.temperature,
+            "battery_last_full": self.battery_last_full,
+            "battery_present": self.battery_present,
+            "battery_soc": self.battery_soc,
             "updated_at": self.updated_at.isoformat()
         }
 
 
+def decode_power_curve(data: Dict[str, Any]) -> Dict[str, Any]:
+    """Expand a delta-encoded power_curve message into per-sample values."""
+    current_step_ua = data.get("current_step_ua", 31250)
+    voltage_step_mv = data.get("voltage_step_mv", 125)
+    current_raw = 0
+    voltage_raw = 0
+    samples = []
+    for index, (d_current, d_voltage) in enumerate(zip(data.get("current", []), data.get("voltage", []))):
+        current_raw += d_current
+        voltage_raw += d_voltage
+        current_ma = current_raw * current_step_ua / 1000
+        voltage_mv = voltage_raw * voltage_step_mv
+        samples.append({
+            "index": data.get("offset", 0) + index,
+            "voltage": round(voltage_mv / 1000, 2),
+            "current": round(current_ma / 1000, 3),
+            "power": round(voltage_mv * current_ma / 1_000_000, 2)
+        })
+    return {
+        "port_id": data.get("port_id", 0),
+        "offset": data.get("offset", 0),
+        "count": len(samples),
+        "samples": samples,
+        "updated_at": datetime.now().isoformat()
+    }
+
+
+def decode_history_chunk(data: Dict[str, Any], received_at: datetime) -> List[Dict[str, Any]]:
+    """Expand a get_history chunk into per-port rows with wall-clock timestamps.
+
+    Sample times are gateway uptime seconds; now_s is the gateway uptime when
+    the chunk was sent, which is taken to be received_at.
+    """
+    now_s = data.get("now_s", 0)
+    rows = []
+    for index, t in enumerate(data.get("t", [])):
+        timestamp = received_at - timedelta(seconds=now_s - t)
+        for port in data.get("ports", []):
+            rows.append({
+                "timestamp": timestamp,
+                "port_id": port.get("port_id", 0),
+                "voltage": round(port["voltage_mv"][index] / 1000, 2),
+                "current": round(port["current_ma"][index] / 1000, 3),
+                "power": round(port["power_cw"][index] / 100, 2),
+                "protocol": port["protocol"][index],
+                "temperature": port["temperature"][index]
+            })
+    return rows
+
+
+def _read_varint(blob: bytes, pos: int) -> Tuple[int, int]:
+    value = 0
+    shift = 0
+    while True:
+        byte = blob[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+
+def _read_delta(blob: bytes, pos: int) -> Tuple[int, int]:
+    value, pos = _read_varint(blob, pos)
+    return (value >> 1) ^ -(value & 1), pos
+
+
+def decode_burst_blob(blob: bytes) -> Dict[str, Any]:
+    """Decode a burst_data blob (layout documented in firmware burst_capture.h)."""
+    if len(blob) < 17 or blob[:4] != b"CPB1":
+        raise ValueError("Not a burst capture blob")
+    flags, port_count, pd_port = blob[5], blob[6], blob[7]
+    count = int.from_bytes(blob[8:12], "little")
+    duration_us = int.from_bytes(blob[12:16], "little")
+    cmd_id_len = blob[16]
+    cmd_id = blob[17:17 + cmd_id_len].decode("utf-8", errors="replace")
+    pos = 17 + cmd_id_len
+
+    timestamp_us = 0
+    values = [0] * (port_count * 4 + 1)
+    pd_operating = 0
+    samples = []
+    for _ in range(count):
+        dt, pos = _read_varint(blob, pos)
+        timestamp_us += dt
+        for i in range(len(values)):
+            delta, pos = _read_delta(blob, pos)
+            values[i] += delta
+        sample = {
+            "t_us": timestamp_us,
+            "ports": [
+                {
+                    "voltage_mv": values[p * 4],
+                    "current_ma": values[p * 4 + 1],
+                    "power_mw": values[p * 4] * values[p * 4 + 1] // 1000,
+                    "temperature": values[p * 4 + 2],
+                    "protocol": values[p * 4 + 3]
+                }
+                for p in range(port_count)
+            ],
+            "charging_mask": values[-1]
+        }
+        if flags & 0x01:
+            xor, pos = _read_varint(blob, pos)
+            pd_operating ^= xor
+            sample["pd_voltage_mv"] = ((pd_operating >> 16) & 0x7FFF) * 10
+            sample["pd_current_ma"] = (pd_operating & 0x3FF) * 10
+        samples.append(sample)
+
+    return {
+        "cmd_id": cmd_id,
+        "pd_port": pd_port if flags & 0x01 else None,
+        "duration_us": duration_us,
+        "count": count,
+        "samples": samples
+    }
+
+
 @dataclass
 class GatewayInfo:
     """Gateway information and status."""
@@ -54,11 +185,21 @@ class GatewayInfo:
     serial: Optional[str] = None
     uptime_seconds: int = 0
     rssi: int = 0
+    poll_interval_ms: int = 0  # Current adaptive port polling interval
+    cache_hit_rate: float = 0.0  # Gateway BLE response cache hits / lookups
+    ble_saved: int = 0  # BLE transactions avoided by coalescing identical reads
+    mtu: int = 0  # ATT MTU negotiated with the charger
+    link_profile: Optional[str] = None  # BLE connection parameter profile ("burst" / "idle")
     connected: bool = False
     last_heartbeat: datetime = field(default_factory=datetime.now)
     ports: Dict[int, PortData] = field(default_factory=dict)
     total_power: float = 0.0
     active_ports: int = 0
+    power_curves: Dict[int, Dict[str, Any]] = field(default_factory=dict)  # Latest curve per port, not in to_dict()
+    shadow: Optional[Dict[str, Any]] = None  # Retained charger configuration shadow, not in to_dict()
+    metrics: Optional[Dict[str, Any]] = None  # Last BLE link metrics document, not in to_dict()
+    charger_ota: Optional[Dict[str, Any]] = None  # Last charger firmware transfer event, not in to_dict()
+    ota: Optional[Dict[str, Any]] = None  # Last gateway pull OTA event, not in to_dict()
 
     def to_dict(self) -> Dict[str, Any]:
         return {
@@ -70,6 +211,11 @@ class GatewayInfo:
             "serial": self.serial,
             "uptime_seconds": self.uptime_seconds,
             "rssi": self.rssi,
+            "poll_interval_ms": self.poll_interval_ms,
+            "cache_hit_rate": self.cache_hit_rate,
+            "ble_saved": self.ble_saved,
+            "mtu": self.mtu,
+            "link_profile": self.link_profile,
             "connected": self.connected,
             "last_heartbeat": self.last_heartbeat.isoformat(),
             "ports": {k: v.to_dict() for k, v in self.ports.items()},
@@ -84,6 +230,8 @@ class GatewayDataStore:
     def __init__(self):
         self._gateways: Dict[str, GatewayInfo] = {}
         self._command_responses: Dict[str, asyncio.Future] = {}
+        self._debug_logs: Dict[Tuple[str, str], Dict[int, bytes]] = {}  # (gateway, cmd_id) -> seq -> chunk
+        self._bursts: Dict[Tuple[str, str], Dict[str, Any]] = {}  # (gateway, cmd_id) -> capture + report
         self._subscribers: List[Callable[[str, str, Any], None]] = []
 
     def get_gateway(self, gateway_id: str) -> Optional[GatewayInfo]:
@@ -127,6 +275,8 @@ class GatewayDataStore:
                 current_ma=port_data.get("current", 0),
                 power_w=port_data.get("power", 0.0),
                 temperature=port_data.get("temperature", 0),
+                battery_last_full=port_data.get("battery_last_full", 0),
+                battery_present=port_data.get("battery_present", 0),
                 updated_at=datetime.now()
             )
             gw.ports[port_id] = port
@@ -151,6 +301,7 @@ class GatewayDataStore:
         gw.model = info.get("model", gw.model)
         gw.serial = info.get("serial", gw.serial)
         gw.uptime_seconds = info.get("uptime", gw.uptime_seconds)
+        gw.mtu = info.get("mtu", gw.mtu)
         gw.connected = True
         self._notify_subscribers(gateway_id, "device_info", gw.to_dict())
 
@@ -163,6 +314,10 @@ class GatewayDataStore:
         gw.last_heartbeat = datetime.now()
         gw.uptime_seconds = heartbeat.get("uptime", gw.uptime_seconds)
         gw.rssi = heartbeat.get("rssi", gw.rssi)
+        gw.poll_interval_ms = heartbeat.get("poll_interval_ms", gw.poll_interval_ms)
+        gw.cache_hit_rate = heartbeat.get("cache_hit_rate", gw.cache_hit_rate)
+        gw.ble_saved = heartbeat.get("ble_saved", gw.ble_saved)
+        gw.link_profile = heartbeat.get("link_profile", gw.link_profile)
         gw.connected = heartbeat.get("connected", True)
         self._notify_subscribers(gateway_id, "heartbeat", gw.to_dict())
 
@@ -177,6 +332,164 @@ class GatewayDataStore:
         gw.device_address = status.get("device_address", gw.device_address)
         self._notify_subscribers(gateway_id, "status", gw.to_dict())
 
+    def update_power_curve(self, gateway_id: str, data: Dict[str, Any]) -> None:
+        """Store the latest historical power curve of a port."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+
+        curve = decode_power_curve(data)
+        self._gateways[gateway_id].power_curves[curve["port_id"]] = curve
+        self._notify_subscribers(gateway_id, "power_curve", curve)
+
+    def get_power_curve(self, gateway_id: str, port_id: int) -> Optional[Dict[str, Any]]:
+        """Get the latest power curve of a port, if one has been fetched."""
+        gw = self._gateways.get(gateway_id)
+        return gw.power_curves.get(port_id) if gw else None
+
+    def handle_debug_log(self, gateway_id: str, data: Dict[str, Any]) -> None:
+        """Collect debug log chunks; emit the reassembled log on the final message."""
+        key = (gateway_id, data.get("cmd_id", ""))
+        chunks = self._debug_logs.setdefault(key, {})
+        if not data.get("final"):
+            chunks[data.get("seq", len(chunks))] = base64.b64decode(data.get("data", ""))
+            return
+
+        self._debug_logs.pop(key, None)
+        expected = data.get("chunks", len(chunks))
+        missing = [seq for seq in range(expected) if seq not in chunks]
+        content = b"".join(chunks[seq] for seq in sorted(chunks))
+        if missing or data.get("dropped"):
+            logger.warning(f"Debug log {key[1]} from {gateway_id} incomplete: "
+                           f"missing chunks {missing}, {data.get('dropped', 0)} bytes dropped on gateway")
+        self._notify_subscribers(gateway_id, "debug_log", {
+            "cmd_id": key[1],
+            "success": data.get("success", False),
+            "bytes": len(content),
+            "missing_chunks": missing,
+            "dropped_bytes": data.get("dropped", 0),
+            "content": content
+        })
+
+    MAX_BURSTS = 8  # Captures kept in memory across all gateways
+
+    def _burst_entry(self, gateway_id: str, cmd_id: str) -> Dict[str, Any]:
+        key = (gateway_id, cmd_id)
+        if key not in self._bursts:
+            while len(self._bursts) >= self.MAX_BURSTS:
+                self._bursts.pop(next(iter(self._bursts)))
+            self._bursts[key] = {}
+        return self._bursts[key]
+
+    def handle_aggregate(self, gateway_id: str, aggregate: Dict[str, Any]) -> None:
+        """Forward a per-minute energy aggregate from the gateway."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+        self._notify_subscribers(gateway_id, "aggregate", aggregate)
+
+    def handle_session(self, gateway_id: str, event: Dict[str, Any]) -> None:
+        """Forward a charge session event (start/protocol/taper/end/history)."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+        self._notify_subscribers(gateway_id, "session", event)
+
+    def handle_history(self, gateway_id: str, data: Dict[str, Any]) -> None:
+        """Forward a get_history chunk or its final summary."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+        self._notify_subscribers(gateway_id, "history", data)
+
+    def handle_rule(self, gateway_id: str, firing: Dict[str, Any]) -> None:
+        """Forward a rule firing reported by the gateway's local rule engine."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+        self._notify_subscribers(gateway_id, "rule", firing)
+
+    def handle_allocator(self, gateway_id: str, change: Dict[str, Any]) -> None:
+        """Forward an allocation change with the controller metrics."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+        self._notify_subscribers(gateway_id, "allocator", change)
+
+    def update_shadow(self, gateway_id: str, data: Dict[str, Any]) -> None:
+        """Store the charger configuration shadow published by the gateway."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+
+        self._gateways[gateway_id].shadow = data
+        self._notify_subscribers(gateway_id, "shadow", data)
+
+    def get_shadow(self, gateway_id: str) -> Optional[Dict[str, Any]]:
+        """Get the last configuration shadow of a gateway's charger."""
+        gw = self._gateways.get(gateway_id)
+        return gw.shadow if gw else None
+
+    def update_metrics(self, gateway_id: str, data: Dict[str, Any]) -> None:
+        """Store the BLE link metrics published by the gateway."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+
+        self._gateways[gateway_id].metrics = data
+        self._notify_subscribers(gateway_id, "metrics", data)
+
+    def get_metrics(self, gateway_id: str) -> Optional[Dict[str, Any]]:
+        """Get the last link metrics of a gateway."""
+        gw = self._gateways.get(gateway_id)
+        return gw.metrics if gw else None
+
+    def update_charger_ota(self, gateway_id: str, data: Dict[str, Any]) -> None:
+        """Store a charger firmware transfer event (start, progress, paused, done, failed)."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+
+        self._gateways[gateway_id].charger_ota = data
+        self._notify_subscribers(gateway_id, "charger_ota", data)
+
+    def get_charger_ota(self, gateway_id: str) -> Optional[Dict[str, Any]]:
+        """Get the last charger firmware transfer event of a gateway."""
+        gw = self._gateways.get(gateway_id)
+        return gw.charger_ota if gw else None
+
+    def update_ota(self, gateway_id: str, data: Dict[str, Any]) -> None:
+        """Store a gateway pull OTA event (start, progress, paused, commit, done, failed)."""
+        if gateway_id not in self._gateways:
+            self._gateways[gateway_id] = GatewayInfo(gateway_id=gateway_id)
+
+        self._gateways[gateway_id].ota = data
+        self._notify_subscribers(gateway_id, "ota", data)
+
+    def get_ota(self, gateway_id: str) -> Optional[Dict[str, Any]]:
+        """Get the last pull OTA event of a gateway."""
+        gw = self._gateways.get(gateway_id)
+        return gw.ota if gw else None
+
+    def handle_burst_data(self, gateway_id: str, chunk: bytes) -> None:
+        """Collect a burst_data chunk; decode the blob once all chunks are in."""
+        if len(chunk) < 9 or chunk[:4] != b"CPBC":
+            raise ValueError("Not a burst capture chunk")
+        index = int.from_bytes(chunk[4:6], "little")
+        count = int.from_bytes(chunk[6:8], "little")
+        cmd_id_len = chunk[8]
+        cmd_id = chunk[9:9 + cmd_id_len].decode("utf-8", errors="replace")
+
+        entry = self._burst_entry(gateway_id, cmd_id)
+        parts = entry.setdefault("chunks", {})
+        parts[index] = chunk[9 + cmd_id_len:]
+        if len(parts) < count:
+            return
+        blob = b"".join(parts[i] for i in range(count))
+        del entry["chunks"]
+        entry["capture"] = decode_burst_blob(blob)
+
+    def handle_burst_report(self, gateway_id: str, report: Dict[str, Any]) -> None:
+        """Store a burst capture summary and notify subscribers."""
+        entry = self._burst_entry(gateway_id, report.get("cmd_id", ""))
+        entry["report"] = report
+        self._notify_subscribers(gateway_id, "burst_report", report)
+
+    def get_burst(self, gateway_id: str, cmd_id: str) -> Optional[Dict[str, Any]]:
+        """Get a stored burst capture with its report."""
+        return self._bursts.get((gateway_id, cmd_id))
+
     def handle_command_response(self, gateway_id: str, response: Dict[str, Any]) -> None:
         """Handle command response from gateway."""
         cmd_id = response.get("cmd_id")
@@ -254,6 +567,19 @@ class MQTTClient:
                     await client.subscribe(f"{self.topic_prefix}/+/heartbeat")
                     await client.subscribe(f"{self.topic_prefix}/+/status")
                     await client.subscribe(f"{self.topic_prefix}/+/cmd_response")
+                    await client.subscribe(f"{self.topic_prefix}/+/power_curve")
+                    await client.subscribe(f"{self.topic_prefix}/+/debug_log")
+                    await client.subscribe(f"{self.topic_prefix}/+/burst_data")
+                    await client.subscribe(f"{self.topic_prefix}/+/burst_report")
+                    await client.subscribe(f"{self.topic_prefix}/+/aggregate")
+                    await client.subscribe(f"{self.topic_prefix}/+/session")
+                    await client.subscribe(f"{self.topic_prefix}/+/history")
+                    await client.subscribe(f"{self.topic_prefix}/+/rule")
+                    await client.subscribe(f"{self.topic_prefix}/+/allocator")
+                    await client.subscribe(f"{self.topic_prefix}/+/shadow")
+                    await client.subscribe(f"{self.topic_prefix}/+/metrics")
+                    await client.subscribe(f"{self.topic_prefix}/+/charger_ota")
+                    await client.subscribe(f"{self.topic_prefix}/+/ota")
 
                     logger.info(f"Subscribed to {self.topic_prefix}/+/* topics")
 
@@ -279,8 +605,6 @@ class MQTTClient:
         """Handle incoming MQTT message."""
         try:
             topic = str(message.topic)
-            payload = message.payload.decode("utf-8")
-            data = json.loads(payload)
 
             # Parse topic: cp02/{gateway_id}/{type}
             parts = topic.split("/")
@@ -290,6 +614,14 @@ class MQTTClient:
             gateway_id = parts[1]
             msg_type = parts[2]
 
+            # Binary payloads
+            if msg_type == "burst_data":
+                self.data_store.handle_burst_data(gateway_id, bytes(message.payload))
+                return
+
+            payload = message.payload.decode("utf-8")
+            data = json.loads(payload)
+
             logger.debug(f"Received {msg_type} from {gateway_id}: {data}")
 
             if msg_type == "ports":
@@ -302,6 +634,30 @@ class MQTTClient:
                 self.data_store.update_status(gateway_id, data)
             elif msg_type == "cmd_response":
                 self.data_store.handle_command_response(gateway_id, data)
+            elif msg_type == "power_curve":
+                self.data_store.update_power_curve(gateway_id, data)
+            elif msg_type == "debug_log":
+                self.data_store.handle_debug_log(gateway_id, data)
+            elif msg_type == "burst_report":
+                self.data_store.handle_burst_report(gateway_id, data)
+            elif msg_type == "aggregate":
+                self.data_store.handle_aggregate(gateway_id, data)
+            elif msg_type == "session":
+                self.data_store.handle_session(gateway_id, data)
+            elif msg_type == "history":
+                self.data_store.handle_history(gateway_id, data)
+            elif msg_type == "rule":
+                self.data_store.handle_rule(gateway_id, data)
+            elif msg_type == "allocator":
+                self.data_store.handle_allocator(gateway_id, data)
+            elif msg_type == "shadow":
+                self.data_store.update_shadow(gateway_id, data)
+            elif msg_type == "metrics":
+                self.data_store.update_metrics(gateway_id, data)
+            elif msg_type == "charger_ota":
+                self.data_store.update_charger_ota(gateway_id, data)
+            elif msg_type == "ota":
+                self.data_store.update_ota(gateway_id, data)
 
         except json.JSONDecodeError as e:
             logger.error(f"Failed to parse JSON: {e}")
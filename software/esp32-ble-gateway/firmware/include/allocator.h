@@ -0,0 +1,89 @@
+/**
+ * Power Allocation Controller
+ *
+ * Optional closed loop that keeps the charger inside a site power budget
+ * while delivering as much power as possible. The allocator commands only
+ * select a charging strategy, so the controller steers per port through
+ * port priority (ports drawing the most are ranked first, so the charger's
+ * own allocator favours them) and, when the budget is exceeded, by shedding
+ * a port and restoring it once there is headroom again.
+ *
+ * Hysteresis: a rank swap needs a power difference above hysteresisMw,
+ * shedding and restoring need ALLOC_CONFIRM_POLLS consecutive polls past
+ * budget +/- hysteresisMw, and changes are at least ALLOC_MIN_CHANGE_MS
+ * apart.
+ */
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "telemetry.h"
+
+enum AllocAction : uint8_t {
+    ALLOC_ACTION_NONE = 0,
+    ALLOC_ACTION_PRIORITIES,        // Send a new priority list
+    ALLOC_ACTION_SHED,              // Turn a port off
+    ALLOC_ACTION_RESTORE            // Turn a shed port back on
+};
+
+struct AllocDecision {
+    uint8_t action;                 // AllocAction
+    uint8_t port;                   // Port shed or restored
+    uint32_t portPowerMw;           // Its power when shed
+    uint8_t priorities[CP02_PORT_COUNT];   // Rank per port, 0 = first
+    uint32_t totalMw;               // Total power the decision was based on
+    uint32_t sampleMs;              // Timestamp of that sample
+};
+
+struct PowerAllocator {
+    bool enabled;
+    uint32_t budgetMw;
+    uint32_t hysteresisMw;
+
+    uint8_t priorities[CP02_PORT_COUNT];   // Last list sent
+    bool prioritiesSent;
+    uint8_t shedOrder[CP02_PORT_COUNT];    // Shed ports, most recent last
+    uint32_t shedPowerMw[CP02_PORT_COUNT]; // Power of each when it was shed
+    uint8_t shedCount;
+    uint8_t overPolls;
+    uint8_t underPolls;
+    uint32_t lastChangeMs;
+
+    // Metrics
+    uint32_t changes;
+    uint32_t lastLatencyMs;         // Sample to command completion
+    uint32_t maxLatencyMs;
+};
+
+void initPowerAllocator(PowerAllocator* alloc, bool enabled, uint32_t budgetMw, uint32_t hysteresisMw);
+
+/**
+ * Change settings at runtime. Shed ports and the priority list are kept:
+ * with a higher budget (or none) shed ports are restored by later
+ * decisions, with a lower one more may be shed.
+ */
+void configurePowerAllocator(PowerAllocator* alloc, bool enabled, uint32_t budgetMw, uint32_t hysteresisMw);
+
+/**
+ * Decide on at most one change for this sample; returns false if there
+ * is nothing to do
+ */
+bool decideAllocation(PowerAllocator* alloc, const PortSnapshot& snapshot, AllocDecision* decision);
+
+/**
+ * Record a decision once its command has completed
+ */
+void applyAllocation(PowerAllocator* alloc, const AllocDecision& decision, bool success, uint32_t nowMs);
+
+/**
+ * Power budget cap; 0 disables the budget (priorities are still managed)
+ */
+inline bool allocatorHasBudget(const PowerAllocator& alloc) {
+    return alloc.budgetMw > 0;
+}
+
+const char* getAllocActionName(uint8_t action);
+
+#endif // ALLOCATOR_H
@@ -0,0 +1,72 @@
+/**
+ * Burst Capture
+ *
+ * High-rate sampling of all ports (and optionally one port's PD operating
+ * point) for debugging PD negotiation and thermal throttling. Samples are
+ * recorded as fixed-size records, then packed into one blob in which every
+ * field is stored as a zigzag varint delta from the previous sample, so
+ * steady signals cost one byte per field.
+ *
+ * Blob layout (little-endian):
+ *   0   "CPB1"
+ *   4   u8  version (1)
+ *   5   u8  flags (BURST_FLAG_*)
+ *   6   u8  port count
+ *   7   u8  PD port
+ *   8   u32 sample count
+ *   12  u32 capture duration in us
+ *   16  u8  cmd_id length, then cmd_id bytes
+ *   ..  samples: varint dt_us, then per port zigzag deltas of voltage_mv,
+ *       current_ma, temperature, protocol; charging mask delta; PD
+ *       operating dword as varint XOR previous if BURST_FLAG_PD *
+ * The blob is published in chunks, each prefixed with:
+ *   0   "CPBC"
+ *   4   u16 chunk index
+ *   6   u16 chunk count
+ *   8   u8  cmd_id length, then cmd_id bytes
+ *   ..  next slice of the blob
+ */
+
+#ifndef BURST_CAPTURE_H
+#define BURST_CAPTURE_H
+
+#include <Arduino.h>
+#include "protocol.h"
+
+#define BURST_VERSION       1
+#define BURST_FLAG_PD       0x01    // Samples carry the PD operating dword
+
+struct BurstSample {
+    uint32_t timestampUs;                   // micros() since capture start
+    uint16_t voltageMv[CP02_PORT_COUNT];
+    uint16_t currentMa[CP02_PORT_COUNT];
+    int8_t temperature[CP02_PORT_COUNT];
+    uint8_t protocol[CP02_PORT_COUNT];
+    uint8_t chargingMask;
+    uint32_t pdOperating;                   // Raw ClientPDStatus bytes 28-31
+};
+
+// Header plus the worst case of every field needing a full-width varint
+#define BURST_HEADER_MAX_SIZE   (17 + 255)
+#define BURST_SAMPLE_MAX_SIZE   (5 + CP02_PORT_COUNT * (3 + 3 + 2 + 2) + 2 + 5)
+#define BURST_CHUNK_HEADER_MAX_SIZE (9 + 255)
+
+/**
+ * Fill a sample from decoded port data (pdOperating is left 0)
+ */
+void recordBurstSample(const PortInfo* ports, int portCount, uint32_t timestampUs, BurstSample* sample);
+
+/**
+ * Pack samples into a blob; returns the blob length, 0 if out is too small
+ */
+size_t encodeBurst(const BurstSample* samples, uint32_t count, uint32_t durationUs,
+                   uint8_t flags, uint8_t pdPort, const char* cmdId,
+                   uint8_t* out, size_t outSize);
+
+/**
+ * Write the prefix of one blob chunk; returns its length, 0 if out is too small
+ */
+size_t encodeBurstChunkHeader(uint16_t index, uint16_t count, const char* cmdId,
+                              uint8_t* out, size_t outSize);
+
+#endif // BURST_CAPTURE_H
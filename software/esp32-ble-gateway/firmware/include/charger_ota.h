@@ -0,0 +1,85 @@
+/**
+ * Charger Firmware Pass-Through
+ *
+ * Progress bookkeeping for streaming a charger image from HTTP into the
+ * charger over BLE. The image is never held in RAM: it is read from the
+ * HTTP stream one buffer at a time, cut into chunks that fit one ATT
+ * write, and sent as a pipelined batch (see pipeline.h). Only chunks the
+ * charger acknowledged advance the offset, so a transfer interrupted by a
+ * BLE or WiFi drop resumes from there.
+ *
+ * Wire format (little-endian):
+ *   START_OTA        u32 image size, u32 resume offset (0 for a new image)
+ *   PERFORM_BLE_OTA  u32 offset, then image bytes
+ *   CONFIRM_OTA      empty, once every byte has been acknowledged
+ */
+
+#ifndef CHARGER_OTA_H
+#define CHARGER_OTA_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define CHARGER_OTA_OFFSET_SIZE 4   // Offset prefix of each PERFORM_BLE_OTA chunk
+
+enum ChargerOtaPhase : uint8_t {
+    CHARGER_OTA_IDLE = 0,
+    CHARGER_OTA_TRANSFER,           // Streaming chunks
+    CHARGER_OTA_PAUSED,             // Waiting for BLE/WiFi to resume
+    CHARGER_OTA_CONFIRM,            // All bytes acknowledged, CONFIRM_OTA next
+    CHARGER_OTA_DONE,
+    CHARGER_OTA_FAILED
+};
+
+struct ChargerOta {
+    uint8_t phase;
+    bool started;                   // START_OTA accepted since the last (re)connect
+    bool confirm;                   // Send CONFIRM_OTA at the end
+    uint8_t window;                 // Chunks in flight
+    uint16_t chunkSize;             // Image bytes per chunk
+    uint8_t resumes;
+    uint8_t restarts;               // Resumes the charger refused (started over at 0)
+    uint32_t size;                  // Image size, 0 until known
+    uint32_t offset;                // Bytes acknowledged by the charger
+    uint32_t runOffset;             // Offset when the current run started
+    uint32_t startMs;
+    uint32_t runStartMs;
+    uint32_t pausedMs;
+    uint32_t lastReportMs;
+    const char* error;
+};
+
+void initChargerOta(ChargerOta* ota, uint32_t size, uint8_t window, bool confirm, uint32_t nowMs);
+
+bool chargerOtaActive(const ChargerOta& ota);
+
+/**
+ * Image bytes per chunk so that a PERFORM_BLE_OTA frame fills one write at
+ * this MTU, within CHARGER_OTA_CHUNK_MIN..CHARGER_OTA_CHUNK_MAX
+ */
+uint16_t chargerOtaChunkSize(uint16_t mtu);
+
+/**
+ * Chunks of chunkSize (with their offset prefix) that fit in bufSize
+ */
+uint16_t chargerOtaChunksPerBuffer(uint16_t chunkSize, size_t bufSize);
+
+void chargerOtaPause(ChargerOta* ota, const char* reason, uint32_t nowMs);
+
+/**
+ * Begin a run (first or resumed) at the current offset
+ */
+void chargerOtaRun(ChargerOta* ota, uint32_t nowMs);
+
+void chargerOtaFail(ChargerOta* ota, const char* reason);
+
+uint8_t chargerOtaPercent(const ChargerOta& ota);
+
+/**
+ * Bytes/s acknowledged in the current run
+ */
+uint32_t chargerOtaRate(const ChargerOta& ota, uint32_t nowMs);
+
+const char* getChargerOtaPhaseName(uint8_t phase);
+
+#endif // CHARGER_OTA_H
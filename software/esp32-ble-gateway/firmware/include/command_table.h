@@ -0,0 +1,320 @@
+/**
+ * CP02 Command Descriptor Table
+ *
+ * Compile-time metadata for every ServiceCommand, indexed by service byte.
+ * Logging, request validation, token handling, timeouts, response
+ * decoding, response caching and retry safety all read from this one table.
+ */
+
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include <Arduino.h>
+#include "protocol.h"
+
+// ============ Descriptor Constants ============
+// Request payload size (excluding token) for commands with variable payloads
+#define CMD_REQ_VARIABLE        0xFF
+
+// Per-command response timeout ceilings (ms); the timeout actually used is
+// learned from observed round trips (rtt_estimator.h)
+#define CMD_TIMEOUT_DEFAULT     3000
+#define CMD_TIMEOUT_SLOW        5000    // Commands that stream or touch flash
+#define CMD_TIMEOUT_WIFI_SCAN   10000   // Charger-side WiFi scan
+
+// Response cache lifetimes (ms) for idempotent GETs
+#define CMD_CACHE_STATIC        600000  // Identity and versions; change only on reboot/OTA
+#define CMD_CACHE_CONFIG        30000   // Settings that change only when written
+#define CMD_CACHE_LINK          10000   // Charger WiFi link state
+#define CMD_CACHE_STATUS        2000    // Live status, absorbs repeated panel refreshes
+
+// How the response payload of a command should be interpreted
+enum ResponseDecoder : uint8_t {
+    DECODE_NONE = 0,        // Status only, payload ignored
+    DECODE_RAW,             // Opaque bytes
+    DECODE_U8,              // Single byte value
+    DECODE_STRING,          // Printable string (model, serial, version)
+    DECODE_UPTIME,          // u64 microseconds, little-endian
+    DECODE_PORT_STATS,      // GET_ALL_POWER_STATISTICS port chunks
+    DECODE_PD_STATUS,       // ClientPDStatus (decoders.h)
+    DECODE_POWER_SUPPLY,    // Open port bitmask
+    DECODE_CHARGING_STATUS, // Per-port voltage/current list
+    DECODE_WIFI_STATUS,     // Charger WiFi state + IP
+    DECODE_PORT_CONFIG,     // Port id + PowerFeatures bits
+    DECODE_STRATEGY,        // Charging strategy id
+    DECODE_PORT_PRIORITY,   // One priority byte per port
+    DECODE_TIMESTAMP,       // u32 Unix seconds, little-endian
+    DECODE_POWER_HISTORY    // Offset + [amperage, voltage] sample pairs
+};
+
+// Cached GET responses are grouped by the state they reflect; a write in
+// a group drops every cached response of that group
+enum CacheGroup : uint8_t {
+    CACHE_NONE = 0,
+    CACHE_DEVICE,           // Identity, versions
+    CACHE_WIFI,             // Charger WiFi state and records
+    CACHE_POWER,            // Port power state
+    CACHE_PORT_CONFIG,      // Protocol compatibility and allocators
+    CACHE_ALL               // Writes that affect everything (reboot, reset, OTA)
+};
+
+// Commands whose round trips are alike share one RTT estimate
+enum TimeoutClass : uint8_t {
+    TIMEOUT_CLASS_READ = 0,     // Single-notification GETs
+    TIMEOUT_CLASS_BULK,         // Multi-notification responses (port stats, power history)
+    TIMEOUT_CLASS_WRITE,        // Settings and port switching
+    TIMEOUT_CLASS_SLOW,         // Streaming or flash access
+    TIMEOUT_CLASS_WIFI_SCAN,
+    TIMEOUT_CLASS_COUNT
+};
+
+// ============ Command Descriptor ============
+struct CommandDescriptor {
+    const char* name;           // Command name for logs
+    bool needsToken;            // Prepend session token to payload
+    uint8_t requestSize;        // Expected payload bytes (CMD_REQ_VARIABLE = any)
+    ResponseDecoder decoder;    // Response payload format
+    uint16_t timeoutMs;         // Default response timeout
+    uint32_t cacheTtlMs;        // Response cache lifetime, 0 = never served from cache
+    CacheGroup cacheGroup;      // Cached group (GETs) or group invalidated (writes)
+    bool idempotent;            // Write that is safe to send again (see CMD_IDEMPOTENT)
+};
+
+struct CommandTable {
+    CommandDescriptor entries[256];
+};
+
+constexpr CommandTable buildCommandTable() {
+    CommandTable table{};
+    for (CommandDescriptor& entry : table.entries) {
+        entry = {"UNKNOWN", true, CMD_REQ_VARIABLE, DECODE_RAW, CMD_TIMEOUT_DEFAULT, 0, CACHE_NONE, false};
+    }
+
+#define CMD_ENTRY(cmd, token, reqSize, decoder, timeout) \
+    table.entries[CMD_##cmd] = {#cmd, token, reqSize, decoder, timeout, 0, CACHE_NONE, false}
+
+    // Test commands
+    CMD_ENTRY(BLE_ECHO_TEST,                    true,  CMD_REQ_VARIABLE, DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DEBUG_LOG,                    true,  0,                DECODE_RAW,             CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(GET_SECURE_BOOT_DIGEST,           true,  0,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(PING_MQTT_TELEMETRY,              true,  0,                DECODE_NONE,            CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(PING_HTTP,                        true,  0,                DECODE_NONE,            CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(GET_DEVICE_PASSWORD,              true,  0,                DECODE_STRING,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(MANAGE_POWER_ALLOCATOR_ENABLED,   true,  CMD_REQ_VARIABLE, DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+
+    // Device management
+    CMD_ENTRY(ASSOCIATE_DEVICE,                 false, CMD_REQ_VARIABLE, DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(REBOOT_DEVICE,                    true,  0,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(RESET_DEVICE,                     true,  0,                DECODE_NONE,            CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(GET_DEVICE_SERIAL_NO,             true,  0,                DECODE_STRING,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DEVICE_UPTIME,                true,  0,                DECODE_UPTIME,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_AP_VERSION,                   true,  0,                DECODE_STRING,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_BP_VERSION,                   true,  0,                DECODE_STRING,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_FPGA_VERSION,                 true,  0,                DECODE_STRING,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_ZRLIB_VERSION,                true,  0,                DECODE_STRING,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DEVICE_BLE_ADDR,              true,  0,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SWITCH_DEVICE,                    true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DEVICE_SWITCH,                true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DEVICE_MODEL,                 true,  0,                DECODE_STRING,          CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(PUSH_LICENSE,                     true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(GET_BLE_RSSI,                     true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_BLE_MTU,                      true,  0,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+
+    // OTA commands
+    CMD_ENTRY(PERFORM_BLE_OTA,                  true,  CMD_REQ_VARIABLE, DECODE_RAW,             CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(PERFORM_WIFI_OTA,                 true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(GET_WIFI_OTA_PROGRESS,            true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(CONFIRM_OTA,                      true,  0,                DECODE_NONE,            CMD_TIMEOUT_SLOW);
+
+    // WiFi commands
+    CMD_ENTRY(SCAN_WIFI,                        true,  0,                DECODE_NONE,            CMD_TIMEOUT_WIFI_SCAN);
+    CMD_ENTRY(GET_WIFI_SCAN_RESULT,             true,  0,                DECODE_RAW,             CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(SET_WIFI_SSID,                    true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(RESET_WIFI,                       true,  0,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_WIFI_STATUS,                  true,  0,                DECODE_WIFI_STATUS,     CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DEVICE_WIFI_ADDR,             true,  0,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_WIFI_SSID_AND_PASSWORD,       true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(GET_WIFI_RECORDS,                 true,  0,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(OPERATE_WIFI_RECORD,              true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_WIFI_STATE_MACHINE,           true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_WIFI_STATE_MACHINE,           true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+
+    // Power commands
+    CMD_ENTRY(TOGGLE_PORT_POWER,                true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_POWER_STATISTICS,             true,  1,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_POWER_SUPPLY_STATUS,          true,  0,                DECODE_POWER_SUPPLY,    CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_CHARGING_STRATEGY,            true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_CHARGING_STATUS,              true,  0,                DECODE_CHARGING_STATUS, CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_POWER_HISTORICAL_STATS,       true,  CMD_REQ_VARIABLE, DECODE_POWER_HISTORY,   CMD_TIMEOUT_SLOW);
+    CMD_ENTRY(SET_PORT_PRIORITY,                true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_PORT_PRIORITY,                true,  0,                DECODE_PORT_PRIORITY,   CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_CHARGING_STRATEGY,            true,  0,                DECODE_STRATEGY,        CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_PORT_PD_STATUS,               true,  1,                DECODE_PD_STATUS,       CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_ALL_POWER_STATISTICS,         true,  0,                DECODE_PORT_STATS,      CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_START_CHARGE_TIMESTAMP,       true,  CMD_REQ_VARIABLE, DECODE_TIMESTAMP,       CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(TURN_ON_PORT,                     true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(TURN_OFF_PORT,                    true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_STATIC_ALLOCATOR,             true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_STATIC_ALLOCATOR,             true,  0,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_PORT_CONFIG,                  true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_PORT_CONFIG,                  true,  1,                DECODE_PORT_CONFIG,     CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_PORT_COMPATIBILITY_SETTINGS,  true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_PORT_COMPATIBILITY_SETTINGS,  true,  CMD_REQ_VARIABLE, DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_TEMPERATURE_MODE,             true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_TEMPORARY_ALLOCATOR,          true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_PORT_CONFIG1,                 true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_PORT_CONFIG1,                 true,  CMD_REQ_VARIABLE, DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+
+    // Display commands
+    CMD_ENTRY(SET_DISPLAY_INTENSITY,            true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_DISPLAY_MODE,                 true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DISPLAY_INTENSITY,            true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DISPLAY_MODE,                 true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_DISPLAY_FLIP,                 true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DISPLAY_FLIP,                 true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_DISPLAY_CONFIG,               true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_DISPLAY_STATE,                true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DISPLAY_STATE,                true,  0,                DECODE_U8,              CMD_TIMEOUT_DEFAULT);
+
+    // System commands
+    CMD_ENTRY(START_TELEMETRY_STREAM,           true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(STOP_TELEMETRY_STREAM,            true,  0,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(GET_DEVICE_INFO,                  true,  0,                DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_BLE_STATE,                    true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_SYSLOG_STATE,                 true,  1,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(SET_SYSTEM_TIME,                  true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(START_OTA,                        true,  CMD_REQ_VARIABLE, DECODE_NONE,            CMD_TIMEOUT_SLOW);
+
+    // Feature management
+    CMD_ENTRY(MANAGE_POWER_CONFIG,              true,  CMD_REQ_VARIABLE, DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(MANAGE_FEATURE_TOGGLE,            true,  CMD_REQ_VARIABLE, DECODE_RAW,             CMD_TIMEOUT_DEFAULT);
+    CMD_ENTRY(ENABLE_RELEASE_MODE,              true,  0,                DECODE_NONE,            CMD_TIMEOUT_DEFAULT);
+
+#undef CMD_ENTRY
+
+    // Response cache. GETs with a TTL are served from the cache, keyed by
+    // service and payload; entries without one (cacheTtlMs 0) invalidate
+    // their group when sent. Port priority, port config, display and
+    // strategy GETs are not listed: the configuration shadow serves them.
+#define CMD_CACHE(cmd, ttl, group) \
+    table.entries[CMD_##cmd].cacheTtlMs = ttl; \
+    table.entries[CMD_##cmd].cacheGroup = group
+
+    CMD_CACHE(GET_DEVICE_SERIAL_NO,             CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_AP_VERSION,                   CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_BP_VERSION,                   CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_FPGA_VERSION,                 CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_ZRLIB_VERSION,                CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_DEVICE_BLE_ADDR,              CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_DEVICE_MODEL,                 CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_DEVICE_WIFI_ADDR,             CMD_CACHE_STATIC, CACHE_DEVICE);
+    CMD_CACHE(GET_WIFI_STATUS,                  CMD_CACHE_LINK,   CACHE_WIFI);
+    CMD_CACHE(GET_WIFI_RECORDS,                 CMD_CACHE_CONFIG, CACHE_WIFI);
+    CMD_CACHE(GET_POWER_SUPPLY_STATUS,          CMD_CACHE_STATUS, CACHE_POWER);
+    CMD_CACHE(GET_CHARGING_STATUS,              CMD_CACHE_STATUS, CACHE_POWER);
+    CMD_CACHE(GET_PORT_PD_STATUS,               CMD_CACHE_STATUS, CACHE_POWER);
+    CMD_CACHE(GET_STATIC_ALLOCATOR,             CMD_CACHE_CONFIG, CACHE_PORT_CONFIG);
+    CMD_CACHE(GET_PORT_COMPATIBILITY_SETTINGS,  CMD_CACHE_CONFIG, CACHE_PORT_CONFIG);
+
+    CMD_CACHE(SET_WIFI_SSID,                    0, CACHE_WIFI);
+    CMD_CACHE(RESET_WIFI,                       0, CACHE_WIFI);
+    CMD_CACHE(SET_WIFI_SSID_AND_PASSWORD,       0, CACHE_WIFI);
+    CMD_CACHE(OPERATE_WIFI_RECORD,              0, CACHE_WIFI);
+    CMD_CACHE(SET_WIFI_STATE_MACHINE,           0, CACHE_WIFI);
+    CMD_CACHE(TOGGLE_PORT_POWER,                0, CACHE_POWER);
+    CMD_CACHE(TURN_ON_PORT,                     0, CACHE_POWER);
+    CMD_CACHE(TURN_OFF_PORT,                    0, CACHE_POWER);
+    CMD_CACHE(SET_CHARGING_STRATEGY,            0, CACHE_POWER);
+    CMD_CACHE(SET_PORT_PRIORITY,                0, CACHE_POWER);
+    CMD_CACHE(SET_STATIC_ALLOCATOR,             0, CACHE_PORT_CONFIG);
+    CMD_CACHE(SET_TEMPORARY_ALLOCATOR,          0, CACHE_PORT_CONFIG);
+    CMD_CACHE(SET_PORT_CONFIG,                  0, CACHE_PORT_CONFIG);
+    CMD_CACHE(SET_PORT_CONFIG1,                 0, CACHE_PORT_CONFIG);
+    CMD_CACHE(SET_PORT_COMPATIBILITY_SETTINGS,  0, CACHE_PORT_CONFIG);
+    CMD_CACHE(REBOOT_DEVICE,                    0, CACHE_ALL);
+    CMD_CACHE(RESET_DEVICE,                     0, CACHE_ALL);
+    CMD_CACHE(PERFORM_BLE_OTA,                  0, CACHE_ALL);
+    CMD_CACHE(PERFORM_WIFI_OTA,                 0, CACHE_ALL);
+    CMD_CACHE(CONFIRM_OTA,                      0, CACHE_ALL);
+    CMD_CACHE(START_OTA,                        0, CACHE_ALL);
+
+#undef CMD_CACHE
+
+    // Writes that set absolute state, or carry their own offset, so that a
+    // second copy after a lost response leaves the charger as one would.
+    // Only these (and GETs) are resent by the pipelined transport; toggles,
+    // reboots and OTA control are not.
+#define CMD_IDEMPOTENT(cmd) \
+    table.entries[CMD_##cmd].idempotent = true
+
+    CMD_IDEMPOTENT(TURN_ON_PORT);
+    CMD_IDEMPOTENT(TURN_OFF_PORT);
+    CMD_IDEMPOTENT(SET_CHARGING_STRATEGY);
+    CMD_IDEMPOTENT(SET_PORT_PRIORITY);
+    CMD_IDEMPOTENT(SET_STATIC_ALLOCATOR);
+    CMD_IDEMPOTENT(SET_PORT_CONFIG);
+    CMD_IDEMPOTENT(SET_PORT_CONFIG1);
+    CMD_IDEMPOTENT(SET_PORT_COMPATIBILITY_SETTINGS);
+    CMD_IDEMPOTENT(SET_TEMPERATURE_MODE);
+    CMD_IDEMPOTENT(SET_DISPLAY_INTENSITY);
+    CMD_IDEMPOTENT(SET_DISPLAY_MODE);
+    CMD_IDEMPOTENT(SET_DISPLAY_FLIP);
+    CMD_IDEMPOTENT(SET_DISPLAY_CONFIG);
+    CMD_IDEMPOTENT(SET_DISPLAY_STATE);
+    CMD_IDEMPOTENT(SET_WIFI_STATE_MACHINE);
+    CMD_IDEMPOTENT(SET_BLE_STATE);
+    CMD_IDEMPOTENT(SET_SYSLOG_STATE);
+    CMD_IDEMPOTENT(PERFORM_BLE_OTA);        // Chunk rewritten at the same offset
+
+#undef CMD_IDEMPOTENT
+
+    return table;
+}
+
+inline constexpr CommandTable COMMAND_TABLE = buildCommandTable();
+
+/**
+ * Look up the descriptor for a service byte (never fails; unknown
+ * services get a permissive "UNKNOWN" entry)
+ */
+constexpr const CommandDescriptor& commandDescriptor(uint8_t service) {
+    return COMMAND_TABLE.entries[service];
+}
+
+/**
+ * GET_* commands only read charger state, so concurrent callers of the
+ * same one can share a response
+ */
+constexpr bool commandIsRead(const CommandDescriptor& desc) {
+    return desc.name[0] == 'G' && desc.name[1] == 'E' && desc.name[2] == 'T' && desc.name[3] == '_';
+}
+
+/**
+ * Whether a request may be resent when its response did not arrive
+ */
+constexpr bool commandIsIdempotent(const CommandDescriptor& desc) {
+    return desc.idempotent || commandIsRead(desc);
+}
+
+constexpr uint8_t commandTimeoutClass(const CommandDescriptor& desc) {
+    return desc.timeoutMs >= CMD_TIMEOUT_WIFI_SCAN ? TIMEOUT_CLASS_WIFI_SCAN
+         : desc.timeoutMs >= CMD_TIMEOUT_SLOW ? TIMEOUT_CLASS_SLOW
+         : desc.decoder == DECODE_PORT_STATS || desc.decoder == DECODE_POWER_HISTORY ? TIMEOUT_CLASS_BULK
+         : commandIsRead(desc) ? TIMEOUT_CLASS_READ
+         : TIMEOUT_CLASS_WRITE;
+}
+
+static_assert(!commandDescriptor(CMD_ASSOCIATE_DEVICE).needsToken,
+              "ASSOCIATE_DEVICE must be sent without a token");
+static_assert(commandDescriptor(CMD_GET_ALL_POWER_STATISTICS).decoder == DECODE_PORT_STATS,
+              "Port polling relies on the port statistics decoder");
+static_assert(commandDescriptor(CMD_GET_ALL_POWER_STATISTICS).cacheTtlMs == 0,
+              "Port polling must always reach the charger");
+static_assert(commandIsRead(commandDescriptor(CMD_GET_DEVICE_MODEL)) && !commandIsRead(commandDescriptor(CMD_TURN_ON_PORT)),
+              "Read detection relies on the GET_ name prefix");
+static_assert(!commandIsIdempotent(commandDescriptor(CMD_TOGGLE_PORT_POWER)),
+              "A resent toggle would undo the first one");
+static_assert(commandTimeoutClass(commandDescriptor(CMD_GET_ALL_POWER_STATISTICS)) == TIMEOUT_CLASS_BULK,
+              "Port polling must not share an RTT estimate with single-notification reads");
+
+#endif // COMMAND_TABLE_H
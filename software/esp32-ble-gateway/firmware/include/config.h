@@ -40,6 +40,55 @@
 #define BLE_RECONNECT_DELAY 5000    // Delay before reconnect attempt in ms
 #define BLE_MAX_RECONNECT   5       // Maximum reconnect attempts
 
+// BLE transport buffers
+#define BLE_TX_BUFFER_SIZE  1024    // Outgoing frame buffer (header + payload)
+#define BLE_ATT_HEADER_SIZE 3       // ATT opcode + handle, subtracted from MTU per write
+#define BLE_ATT_MTU_DEFAULT 23      // MTU before (or without) an exchange
+#define BLE_ATT_MTU_PREFERRED 517   // MTU requested on connect (512-byte values)
+#define BLE_ATT_MTU_MAX     527     // Largest MTU NimBLE accepts
+#define BLE_RX_BUFFER_SIZE  2048    // Reassembled response (header + payload)
+
+// BLE response cache (lifetimes per command in command_table.h)
+#define RESPONSE_CACHE_ENTRIES  12      // Cached responses
+#define RESPONSE_CACHE_FRAME_MAX 128    // Largest response frame cached
+#define RESPONSE_CACHE_KEY_MAX  4       // Longest request payload used as a key
+#define REFRESH_MAX_WAITERS     8       // refresh requests that can share one fetch
+
+// Adaptive response timeouts (per TimeoutClass, ceilings in command_table.h)
+#define RTO_MIN_MS              100     // Floor for learned timeouts
+#define RTO_GRANULARITY_MS      10      // Response wait polling step
+#define RTO_MAX_BACKOFF         4       // Timeout doublings after consecutive losses
+
+// Pipelined command transport (ble_batch)
+#define PIPELINE_WINDOW         4       // Default requests awaiting a response
+#define PIPELINE_MAX_WINDOW     8
+#define PIPELINE_MAX_ATTEMPTS   2       // Sends per request before it counts as failed
+#define PIPELINE_RETIRED_IDS    16      // msgIds of timed-out sends whose late replies are ignored
+#define PIPELINE_MAX_BATCH      16      // Commands per ble_batch
+#define PIPELINE_BATCH_BYTES    256     // Payload bytes per ble_batch
+
+// Connection parameter profiles (intervals in 1.25 ms units, timeouts in 10 ms units)
+#define LINK_BURST_INTERVAL_MIN 6       // 7.5 ms
+#define LINK_BURST_INTERVAL_MAX 12      // 15 ms
+#define LINK_BURST_LATENCY      0
+#define LINK_BURST_TIMEOUT      400     // 4 s
+#define LINK_IDLE_INTERVAL_MIN  80      // 100 ms
+#define LINK_IDLE_INTERVAL_MAX  160     // 200 ms
+#define LINK_IDLE_LATENCY       4       // Events the charger may skip with nothing to send
+#define LINK_IDLE_TIMEOUT       600     // 6 s, above 2 x (1 + latency) x interval
+#define LINK_BURST_POLL_MS      1000    // Port polling at or below this keeps the link in burst
+#define LINK_BURST_LINGER_MS    5000    // Burst kept this long after the last command
+#define LINK_PROFILE_MIN_DWELL_MS 2000  // Minimum time in burst before relaxing to idle
+#define LINK_THROUGHPUT_WINDOW_MS 1000  // Throughput measurement window
+
+// BLE link metrics (published on MQTT_TOPIC_METRICS)
+#define LINK_METRICS_SERVICES   24      // Services with their own latency histogram
+#define LINK_LATENCY_BUCKETS    14      // Log2 latency buckets: <2 ms ... >=8192 ms
+#define LINK_SIZE_BUCKETS       10      // Log2 notification size buckets: <2 B ... >=512 B
+#define LINK_RSSI_SAMPLES       60      // RSSI ring length
+#define LINK_RSSI_INTERVAL      10000   // RSSI sampling period (ms)
+#define LINK_METRICS_INTERVAL   60000   // Metrics publish period (ms)
+
 // ============ WiFi Configuration ============
 // Default WiFi credentials (used if WiFiManager is disabled)
 // Leave empty to force WiFiManager portal on first boot
@@ -74,6 +123,19 @@
 #define MQTT_TOPIC_PORTS        "ports"         // Port data
 #define MQTT_TOPIC_DEVICE_INFO  "device_info"   // Charger device info
 #define MQTT_TOPIC_HEARTBEAT    "heartbeat"     // Keep-alive
+#define MQTT_TOPIC_POWER_CURVE  "power_curve"   // Historical power curve per port
+#define MQTT_TOPIC_DEBUG_LOG    "debug_log"     // Charger debug log chunks
+#define MQTT_TOPIC_BURST_DATA   "burst_data"    // Burst capture blob (binary)
+#define MQTT_TOPIC_BURST_REPORT "burst_report"  // Burst capture summary
+#define MQTT_TOPIC_AGGREGATE    "aggregate"     // Per-minute energy and power aggregates
+#define MQTT_TOPIC_SESSION      "session"       // Charge session start/change/end events
+#define MQTT_TOPIC_HISTORY      "history"       // get_history chunks
+#define MQTT_TOPIC_RULE         "rule"          // Local rule firings
+#define MQTT_TOPIC_ALLOCATOR    "allocator"     // Allocation changes and controller metrics
+#define MQTT_TOPIC_SHADOW       "shadow"        // Charger configuration shadow (retained)
+#define MQTT_TOPIC_METRICS      "metrics"       // BLE latency, error and RSSI metrics
+#define MQTT_TOPIC_CHARGER_OTA  "charger_ota"   // Charger firmware transfer progress
+#define MQTT_TOPIC_OTA          "ota"           // Gateway pull OTA progress
 
 // Command topics (server -> device)
 #define MQTT_TOPIC_CMD          "cmd"           // Commands from server
@@ -101,20 +163,98 @@
 
 // HTTP OTA settings (for downloading firmware from server)
 #define OTA_UPDATE_CHECK_INTERVAL 3600000  // Check for updates every hour (ms)
+#define OTA_SLICE_MS            500     // Download time per loop() pass
+#define OTA_HTTP_TIMEOUT        10000   // Download stall before the stream is reopened
+#define OTA_RETRY_DELAY         2000    // Wait after an interruption before resuming
+#define OTA_RESUME_TIMEOUT      120000  // Give up when the link stays down this long
+#define OTA_MAX_RESUMES         10      // Interruptions survived per image
+#define OTA_PROGRESS_INTERVAL   2000    // Progress messages at most this often
+
+// Gateway pull OTA (ota_update, see gateway_ota.h)
+#define GATEWAY_OTA_CHUNK       4096    // Bytes read and written to flash at a time
+
+// Charger firmware pass-through (charger_ota, see charger_ota.h)
+#define CHARGER_OTA_BUFFER      4096    // Streaming buffer: image bytes held at once
+#define CHARGER_OTA_CHUNK_MIN   64      // Chunk floor at small MTUs (frames are then fragmented)
+#define CHARGER_OTA_CHUNK_MAX   496     // Chunk ceiling
+#define CHARGER_OTA_WINDOW      4       // Chunks in flight (PIPELINE_MAX_WINDOW at most)
 
 // ============ Data Collection Configuration ============
 // Polling intervals in milliseconds
-#define POLL_INTERVAL_PORTS     3000    // Port status polling interval
+#define POLL_INTERVAL_PORTS     3000    // Port polling interval while charging steadily
 #define POLL_INTERVAL_DEVICE    30000   // Device info polling interval
 #define POLL_INTERVAL_HEARTBEAT 10000   // Heartbeat interval
 
+// Adaptive port polling (bounds can be changed at runtime via set_poll_interval)
+#define POLL_INTERVAL_MIN       250     // Rate while ports are changing
+#define POLL_INTERVAL_MAX       30000   // Rate once every port is idle
+#define POLL_DELTA_TEMP_C       2       // Temperature step that counts as activity
+#define POLL_DELTA_VOLTAGE_MV   500     // Voltage step that counts as activity (PD renegotiation)
+#define POLL_DELTA_POWER_MW     1000    // Power step that counts as activity
+
+// Energy integration and aggregates
+#define AGGREGATE_WINDOW_MS     60000   // Aggregate publish period
+#define ENERGY_MAX_GAP_MS       60000   // Longer gaps between samples are not integrated
+
+// Charge session detection
+#define SESSION_VBUS_MIN_MV     4000    // Below this the port has no device attached
+#define SESSION_START_POWER_MW  500     // Power that opens a session
+#define SESSION_END_POLLS       3       // Consecutive idle polls that close a session
+#define SESSION_TAPER_PERCENT   50      // Below this share of peak power counts as taper
+#define SESSION_TAPER_MIN_PEAK_MW 5000  // Sessions with a lower peak never report taper
+#define SESSION_HISTORY_SIZE    16      // Closed session records kept for get_sessions
+
+// On-device history rings (downsampled, PSRAM); one tier per resolution
+#define HISTORY_TIER_COUNT      3
+#define HISTORY_TIER0_PERIOD_S  1       // 1 s for 10 minutes
+#define HISTORY_TIER0_CAPACITY  600
+#define HISTORY_TIER1_PERIOD_S  10      // 10 s for 6 hours
+#define HISTORY_TIER1_CAPACITY  2160
+#define HISTORY_TIER2_PERIOD_S  60      // 1 min for 7 days
+#define HISTORY_TIER2_CAPACITY  10080
+#define HISTORY_DRAM_DIVISOR    16      // Capacity divisor without PSRAM
+#define HISTORY_CHUNK_SAMPLES   32      // Samples per get_history chunk
+
+// Local rule engine
+#define RULE_MAX_RULES          16      // Rules in the active set
+#define RULE_TEXT_MAX           48      // Longest rule text accepted
+#define RULE_COOLDOWN_MS        30000   // Minimum time between firings of one rule on one port
+
+// Power allocation controller (off unless enabled with set_allocator)
+#define ALLOC_CONFIRM_POLLS     3       // Polls over/under budget before shedding/restoring
+#define ALLOC_MIN_CHANGE_MS     10000   // Minimum time between allocation changes
+#define ALLOC_HYSTERESIS_MW     5000    // Default power hysteresis
+
+// Charger configuration shadow
+#define SHADOW_TTL_MS           60000   // Shadowed settings are read again after this
+#define SHADOW_CONFIG_PORTS     8       // Port slots in a SET_PORT_CONFIG payload
+
+// Power history (GET_POWER_HISTORICAL_STATS) retrieval
+#define HISTORY_MAX_SAMPLES     720     // Samples kept per curve
+#define HISTORY_MAX_PAGES       16      // Upper bound on paged requests per fetch
+#define POWER_CURVE_HEADER_SIZE 256     // Curve JSON before the delta arrays
+
+// Debug log (GET_DEBUG_LOG) streaming
+#define DEBUG_LOG_CHUNK_SIZE    512     // Log bytes per MQTT message
+#define DEBUG_LOG_STREAM_BUFFER 2048    // Staging between BLE callback and publisher
+#define DEBUG_LOG_GAP_TIMEOUT   1000    // Log ends after this much silence (ms)
+#define DEBUG_LOG_MAX_BYTES     262144  // Hard stop for a single retrieval
+
+// Burst capture (burst_capture action)
+#define BURST_MAX_DURATION_S    60      // Longest capture allowed
+#define BURST_MAX_SAMPLES       16384   // Sample slots when PSRAM is present
+#define BURST_MAX_SAMPLES_DRAM  256     // Sample slots without PSRAM
+#define BURST_CHUNK_SIZE        4096    // Blob bytes per burst_data message
+#define BURST_CHUNK_RETRIES     20      // Publish attempts per chunk before giving up
+#define BURST_CHUNK_RETRY_MS    50      // Wait for the MQTT send buffer between attempts
+
 // ============ Token Configuration ============
 // Token for CP02 authentication (0-255)
 // Will be bruteforced if not set
 #define CP02_TOKEN          0xFF    // 0xFF means auto-discover
 
 // Token bruteforce parameters
-#define TOKEN_TEST_TIMEOUT  300     // Timeout for each token test in ms
+#define TOKEN_TEST_TIMEOUT  300     // Ceiling for each token test in ms (learned RTO below that)
 #define TOKEN_TEST_DELAY    20      // Delay between token tests in ms
 
 // ============ Debug Configuration ============
@@ -0,0 +1,185 @@
+/**
+ * Typed Response Decoders
+ *
+ * Ported from the parse_*_response functions in protocol.py. Each view
+ * wraps the response payload in place and decodes fields on access, so
+ * decoding never copies or allocates. The write*Json helpers publish a
+ * view as structured JSON.
+ */
+
+#ifndef DECODERS_H
+#define DECODERS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// ============ Byte Readers ============
+inline uint16_t readU16LE(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+inline uint16_t readU16BE(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+inline uint32_t readU32LE(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline void writeU32LE(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+// Bounds-checked access shared by all views; out of range reads return 0
+struct PayloadView {
+    const uint8_t* data;
+    size_t len;
+
+    uint8_t byteAt(size_t off) const { return off < len ? data[off] : 0; }
+    uint16_t wordAt(size_t off) const { return off + 1 < len ? readU16LE(data + off) : 0; }
+    uint32_t dwordAt(size_t off) const { return off + 3 < len ? readU32LE(data + off) : 0; }
+};
+
+// ============ GET_PORT_PD_STATUS (ClientPDStatus) ============
+struct PdStatusView : PayloadView {
+    // Battery (capacities in 0.1 Wh)
+    uint16_t batteryVid() const { return wordAt(0); }
+    uint16_t batteryPid() const { return wordAt(2); }
+    uint16_t designCapacity() const { return wordAt(4); }
+    uint16_t lastFullCapacity() const { return wordAt(6); }
+    uint16_t presentCapacity() const { return wordAt(8); }
+    uint8_t batteryPercent() const {
+        uint16_t full = lastFullCapacity();
+        return full > 0 ? (uint8_t)min<uint32_t>(100, (uint32_t)presentCapacity() * 100 / full) : 0;
+    }
+    bool batteryPresent() const { return byteAt(10) & 0x02; }
+    uint8_t batteryStatus() const { return (byteAt(10) >> 2) & 0x03; }   // 0 charging, 1 discharging, 2 idle
+
+    // Cable
+    uint8_t cableLatency() const { return byteAt(10) & 0x0F; }
+    bool cableActive() const { return byteAt(10) & 0x10; }
+    bool cableOptical() const { return (byteAt(10) >> 7) & 0x01; }
+    uint8_t cableMaxVoltage() const { return (byteAt(11) >> 4) & 0x03; }  // 20/30/40/50 V
+    uint8_t cableMaxCurrent() const { return (byteAt(11) >> 6) & 0x03; }  // unknown/3A/5A
+    uint8_t cableUsbSpeed() const { return byteAt(12) & 0x07; }
+    uint16_t cableVid() const { return wordAt(16); }
+    uint16_t cablePid() const { return wordAt(18); }
+
+    int8_t statusTemperature() const { return (int8_t)byteAt(15); }
+
+    // Operating point (bytes 28-31 bit fields)
+    bool hasOperating() const { return len >= 32; }
+    uint16_t operatingCurrentMa() const { return (dwordAt(28) & 0x3FF) * 10; }
+    uint8_t pdRevision() const { return (dwordAt(28) >> 10) & 0x03; }
+    bool ppsSupported() const { return (dwordAt(28) >> 12) & 0x01; }
+    bool hasBattery() const { return (dwordAt(28) >> 13) & 0x01; }
+    bool dualRolePower() const { return (dwordAt(28) >> 14) & 0x01; }
+    bool hasEmarker() const { return (dwordAt(28) >> 15) & 0x01; }
+    uint32_t operatingVoltageMv() const { return ((dwordAt(28) >> 16) & 0x7FFF) * 10; }
+};
+
+// ============ GET_POWER_SUPPLY_STATUS ============
+struct PowerSupplyStatusView : PayloadView {
+    uint8_t portMask() const { return byteAt(0); }
+    bool portOpen(uint8_t port) const { return portMask() & (1 << port); }
+};
+
+// ============ GET_CHARGING_STATUS ============
+struct ChargingStatusView : PayloadView {
+    uint8_t numPorts() const { return byteAt(0); }
+    uint8_t count() const {
+        size_t available = len > 0 ? (len - 1) / 4 : 0;
+        return (uint8_t)min<size_t>(numPorts(), available);
+    }
+    uint8_t portId(uint8_t i) const { return data[1 + i * 4]; }
+    uint16_t voltageMv(uint8_t i) const { return readU16BE(data + 2 + i * 4); }
+    uint8_t currentMa(uint8_t i) const { return data[4 + i * 4]; }
+};
+
+// ============ GET_DISPLAY_INTENSITY + GET_DISPLAY_MODE ============
+struct DisplaySettingsView : PayloadView {
+    uint8_t brightness() const { return byteAt(0); }
+    uint8_t mode() const { return byteAt(1); }
+};
+
+// ============ GET_WIFI_STATUS ============
+struct WifiStatusView : PayloadView {
+    uint8_t status() const { return byteAt(0); }    // 3 = connected
+    bool hasIp() const { return status() == 3 && len >= 5; }
+    const uint8_t* ip() const { return data + 1; }
+};
+
+// ============ GET_PORT_CONFIG ============
+#define PORT_CONFIG_PROTOCOL_COUNT 24
+
+struct PortConfigView : PayloadView {
+    uint8_t portId() const { return byteAt(0); }
+    const uint8_t* powerFeatures() const { return data + 1; }
+    bool protocolEnabled(uint8_t bit) const {
+        return powerFeatures()[bit / 8] & (1 << (bit % 8));
+    }
+};
+
+// ============ GET_CHARGING_STRATEGY ============
+struct ChargingStrategyView : PayloadView {
+    uint8_t strategy() const { return byteAt(0); }
+};
+
+// ============ GET_PORT_PRIORITY ============
+struct PortPriorityView : PayloadView {
+    uint8_t count() const { return (uint8_t)len; }
+    uint8_t priority(uint8_t port) const { return byteAt(port); }
+};
+
+// ============ GET_START_CHARGE_TIMESTAMP ============
+struct StartChargeTimestampView : PayloadView {
+    uint32_t timestamp() const { return dwordAt(0); }   // Unix seconds
+};
+
+// ============ GET_POWER_HISTORICAL_STATS ============
+// 2-byte LE offset, then one [amperage, voltage] byte pair per sample
+// in 1/32 A and 1/8 V steps
+#define POWER_HISTORY_HEADER_SIZE   2
+#define POWER_HISTORY_SAMPLE_SIZE   2
+
+struct PowerHistoryView : PayloadView {
+    uint16_t offset() const { return wordAt(0); }
+    uint16_t count() const { return (uint16_t)((len - POWER_HISTORY_HEADER_SIZE) / POWER_HISTORY_SAMPLE_SIZE); }
+    uint8_t currentRaw(uint16_t i) const { return data[POWER_HISTORY_HEADER_SIZE + i * 2]; }
+    uint8_t voltageRaw(uint16_t i) const { return data[POWER_HISTORY_HEADER_SIZE + i * 2 + 1]; }
+};
+
+// ============ Decoders ============
+// Each returns false if the payload is too short for the view
+
+bool decodePdStatus(const uint8_t* payload, size_t len, PdStatusView* view);
+bool decodePowerSupplyStatus(const uint8_t* payload, size_t len, PowerSupplyStatusView* view);
+bool decodeChargingStatus(const uint8_t* payload, size_t len, ChargingStatusView* view);
+bool decodeDisplaySettings(const uint8_t* payload, size_t len, DisplaySettingsView* view);
+bool decodeWifiStatus(const uint8_t* payload, size_t len, WifiStatusView* view);
+bool decodePortConfig(const uint8_t* payload, size_t len, PortConfigView* view);
+bool decodeChargingStrategy(const uint8_t* payload, size_t len, ChargingStrategyView* view);
+bool decodePortPriority(const uint8_t* payload, size_t len, PortPriorityView* view);
+bool decodeStartChargeTimestamp(const uint8_t* payload, size_t len, StartChargeTimestampView* view);
+bool decodePowerHistory(const uint8_t* payload, size_t len, PowerHistoryView* view);
+
+/**
+ * Name of a power feature bit in a port config (e.g. "PD", "PPS")
+ */
+const char* getPowerFeatureName(uint8_t bit);
+
+// ============ JSON Writers ============
+
+void writePdStatusJson(const PdStatusView& view, JsonObject out);
+void writePowerSupplyStatusJson(const PowerSupplyStatusView& view, JsonObject out);
+void writeChargingStatusJson(const ChargingStatusView& view, JsonObject out);
+void writeDisplaySettingsJson(const DisplaySettingsView& view, JsonObject out);
+void writeWifiStatusJson(const WifiStatusView& view, JsonObject out);
+void writePortConfigJson(const PortConfigView& view, JsonObject out);
+void writeChargingStrategyJson(const ChargingStrategyView& view, JsonObject out);
+void writePortPriorityJson(const PortPriorityView& view, JsonObject out);
+
+#endif // DECODERS_H
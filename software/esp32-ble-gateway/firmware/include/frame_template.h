@@ -0,0 +1,78 @@
+/**
+ * Prebuilt BLE Frame Templates
+ *
+ * Fixed, payload-less commands (port polling, device info queries) are
+ * built once at compile time. At send time only the message ID and the
+ * token byte are patched in place; the header checksum is fixed up
+ * incrementally instead of being recomputed.
+ */
+
+#ifndef FRAME_TEMPLATE_H
+#define FRAME_TEMPLATE_H
+
+#include <Arduino.h>
+#include "protocol.h"
+#include "command_table.h"
+
+#define FRAME_HEADER_SIZE       9
+#define FRAME_OFFSET_MSG_ID     1
+#define FRAME_OFFSET_CHECKSUM   8
+#define FRAME_NO_TOKEN          0xFF
+
+// Header plus optional token byte
+struct FrameTemplate {
+    uint8_t bytes[FRAME_HEADER_SIZE + 1];
+    uint8_t length;
+    uint8_t tokenOffset;    // FRAME_NO_TOKEN if the command is sent without one
+};
+
+/**
+ * Build the frame for a fixed command with msgId 0; token requirement
+ * comes from the command descriptor table
+ */
+constexpr FrameTemplate makeFrameTemplate(uint8_t service) {
+    FrameTemplate frame{};
+    const bool withToken = commandDescriptor(service).needsToken;
+    const uint8_t payloadLen = withToken ? 1 : 0;
+
+    frame.bytes[0] = 0;             // version
+    frame.bytes[1] = 0;             // msgId, patched at send time
+    frame.bytes[2] = service;
+    frame.bytes[3] = 0;             // sequence
+    frame.bytes[4] = FLAG_ACK;
+    frame.bytes[5] = 0;
+    frame.bytes[6] = 0;
+    frame.bytes[7] = payloadLen;
+
+    uint8_t sum = 0;
+    for (int i = 0; i < FRAME_OFFSET_CHECKSUM; i++) {
+        sum = (uint8_t)(sum + frame.bytes[i]);
+    }
+    frame.bytes[FRAME_OFFSET_CHECKSUM] = sum;
+
+    frame.length = FRAME_HEADER_SIZE + payloadLen;
+    frame.tokenOffset = withToken ? FRAME_HEADER_SIZE : FRAME_NO_TOKEN;
+    return frame;
+}
+
+/**
+ * Patch msgId and token into a template in place. The checksum is the
+ * byte sum of the header, so it moves by exactly the msgId delta.
+ */
+inline void patchFrameTemplate(FrameTemplate& frame, uint8_t msgId, uint8_t token) {
+    uint8_t oldMsgId = frame.bytes[FRAME_OFFSET_MSG_ID];
+    frame.bytes[FRAME_OFFSET_MSG_ID] = msgId;
+    frame.bytes[FRAME_OFFSET_CHECKSUM] += (uint8_t)(msgId - oldMsgId);
+    if (frame.tokenOffset != FRAME_NO_TOKEN) {
+        frame.bytes[frame.tokenOffset] = token;
+    }
+}
+
+// Templates for the hot-path commands
+constexpr FrameTemplate FRAME_GET_ALL_POWER_STATISTICS = makeFrameTemplate(CMD_GET_ALL_POWER_STATISTICS);
+constexpr FrameTemplate FRAME_GET_DEVICE_MODEL         = makeFrameTemplate(CMD_GET_DEVICE_MODEL);
+constexpr FrameTemplate FRAME_GET_DEVICE_SERIAL_NO     = makeFrameTemplate(CMD_GET_DEVICE_SERIAL_NO);
+constexpr FrameTemplate FRAME_GET_AP_VERSION           = makeFrameTemplate(CMD_GET_AP_VERSION);
+constexpr FrameTemplate FRAME_GET_DEVICE_UPTIME        = makeFrameTemplate(CMD_GET_DEVICE_UPTIME);
+
+#endif // FRAME_TEMPLATE_H
@@ -0,0 +1,71 @@
+/**
+ * Gateway Pull OTA
+ *
+ * Progress bookkeeping for updating the gateway from an HTTP URL (the
+ * backend's firmware endpoint). The image is streamed into the Update
+ * partition GATEWAY_OTA_CHUNK bytes at a time and hashed as it goes; after
+ * a WiFi drop the download resumes at the bytes already written, so the
+ * running SHA-256 stays valid. The image is committed only if its digest
+ * matches the expected one.
+ */
+
+#ifndef GATEWAY_OTA_H
+#define GATEWAY_OTA_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define SHA256_SIZE 32
+
+enum GatewayOtaPhase : uint8_t {
+    GATEWAY_OTA_IDLE = 0,
+    GATEWAY_OTA_DOWNLOAD,           // Streaming into the Update partition
+    GATEWAY_OTA_PAUSED,             // Waiting for WiFi to resume
+    GATEWAY_OTA_COMMIT,             // Verified, flash commit running
+    GATEWAY_OTA_DONE,               // Committed, restarting
+    GATEWAY_OTA_FAILED
+};
+
+struct GatewayOta {
+    uint8_t phase;
+    bool verify;                    // sha256 given
+    uint8_t sha256[SHA256_SIZE];    // Expected digest
+    uint8_t resumes;
+    uint32_t size;                  // Image size, 0 until known
+    uint32_t offset;                // Bytes written to the Update partition
+    uint32_t runOffset;             // Offset when the current run started
+    uint32_t startMs;
+    uint32_t runStartMs;
+    uint32_t pausedMs;
+    uint32_t lastReportMs;
+    const char* error;
+};
+
+void initGatewayOta(GatewayOta* ota, uint32_t size, const uint8_t* sha256, uint32_t nowMs);
+
+bool gatewayOtaActive(const GatewayOta& ota);
+
+void gatewayOtaPause(GatewayOta* ota, const char* reason, uint32_t nowMs);
+
+/**
+ * Begin a run (first or resumed) at the current offset
+ */
+void gatewayOtaRun(GatewayOta* ota, uint32_t nowMs);
+
+void gatewayOtaFail(GatewayOta* ota, const char* reason);
+
+uint8_t gatewayOtaPercent(const GatewayOta& ota);
+
+/**
+ * Bytes/s written in the current run
+ */
+uint32_t gatewayOtaRate(const GatewayOta& ota, uint32_t nowMs);
+
+const char* getGatewayOtaPhaseName(uint8_t phase);
+
+/**
+ * Parse 64 hex digits; false if hex is anything else
+ */
+bool parseSha256Hex(const char* hex, uint8_t* out);
+
+#endif // GATEWAY_OTA_H
@@ -0,0 +1,82 @@
+/**
+ * On-Device History Rings
+ *
+ * Downsampled port history kept on the gateway so a backend outage does not
+ * lose data. Each tier averages snapshots into fixed-period buckets and
+ * stores them in a ring, structure-of-arrays, in the same fixed-point units
+ * as PortSnapshot. Buckets without samples are not stored, so a tier covers
+ * more than capacity x period while polling is slow.
+ *
+ * Times are gateway uptime seconds (millis() / 1000); the backend maps them
+ * to wall time using the uptime sent with each chunk.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "telemetry.h"
+
+struct HistoryTier {
+    uint32_t periodS;
+    uint16_t capacity;
+    uint16_t head;                          // Next slot to write
+    uint16_t count;
+
+    // Ring, per-port fields indexed [slot * CP02_PORT_COUNT + port]
+    uint32_t* timeS;                        // Bucket start
+    uint16_t* voltageMv;
+    uint16_t* currentMa;
+    uint16_t* powerCw;                      // 10 mW
+    int8_t* temperature;
+    uint8_t* protocol;                      // Last protocol seen in the bucket
+    uint8_t* chargingMask;                  // OR over the bucket
+
+    // Bucket being accumulated
+    uint32_t bucketS;
+    uint16_t bucketSamples;
+    uint32_t sumVoltageMv[CP02_PORT_COUNT];
+    uint32_t sumCurrentMa[CP02_PORT_COUNT];
+    uint32_t sumPowerMw[CP02_PORT_COUNT];
+    int32_t sumTemperature[CP02_PORT_COUNT];
+    uint8_t bucketProtocol[CP02_PORT_COUNT];
+    uint8_t bucketMask;
+};
+
+struct HistoryRings {
+    HistoryTier tiers[HISTORY_TIER_COUNT];
+    bool psram;
+};
+
+/**
+ * Allocate all tiers, in PSRAM when present (capacity is divided by
+ * HISTORY_DRAM_DIVISOR otherwise); returns false if allocation failed
+ */
+bool initHistoryRings(HistoryRings* rings);
+
+/**
+ * Add a snapshot to every tier, closing buckets whose period has passed
+ */
+void recordHistory(HistoryRings* rings, const PortSnapshot& snapshot);
+
+/**
+ * Ring slot of the i-th stored sample, 0 = oldest
+ */
+inline uint16_t historySlot(const HistoryTier& tier, uint16_t i) {
+    return (uint16_t)((tier.head + tier.capacity - tier.count + i) % tier.capacity);
+}
+
+/**
+ * Index (0 = oldest) of the first stored sample newer than afterS, or
+ * tier.count if there is none
+ */
+uint16_t findHistoryIndex(const HistoryTier& tier, uint32_t afterS);
+
+/**
+ * Finest tier whose oldest sample reaches back to fromS, or the coarsest
+ * tier if none does
+ */
+uint8_t selectHistoryTier(const HistoryRings& rings, uint32_t fromS);
+
+#endif // HISTORY_H
@@ -0,0 +1,73 @@
+/**
+ * BLE Link Metrics
+ *
+ * Fixed-size counters describing the charger link: per-service round-trip
+ * latency histograms with timeout and write error counts, a histogram of
+ * notification sizes and a ring of RSSI samples. Histograms are log2
+ * bucketed: bucket i counts values in [2^i, 2^(i+1)), bucket 0 also takes
+ * 0 and the last bucket takes everything above.
+ *
+ * Services get a slot on first use; once LINK_METRICS_SERVICES are taken,
+ * the rest are counted together in an "other" slot.
+ */
+
+#ifndef LINK_METRICS_H
+#define LINK_METRICS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define LINK_SERVICE_OTHER  0xFF    // Service id of the overflow slot
+
+struct LatencyHistogram {
+    uint32_t buckets[LINK_LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t sumMs;
+    uint32_t minMs;
+    uint32_t maxMs;
+};
+
+struct ServiceMetrics {
+    bool used;
+    uint8_t service;
+    LatencyHistogram latency;       // Responses received
+    uint32_t timeouts;
+    uint32_t writeErrors;
+};
+
+struct LinkMetrics {
+    ServiceMetrics services[LINK_METRICS_SERVICES + 1];    // Last slot is "other"
+    uint32_t sizeBuckets[LINK_SIZE_BUCKETS];                // Notification sizes (bytes)
+    uint32_t notifications;
+    uint32_t notifyBytes;
+    int8_t rssi[LINK_RSSI_SAMPLES];                         // Gateway-side RSSI ring
+    uint16_t rssiHead;
+    uint16_t rssiCount;
+    uint32_t sinceMs;                                       // Start of the counting period
+};
+
+void initLinkMetrics(LinkMetrics* metrics, uint32_t nowMs);
+
+/**
+ * Log2 bucket of a value, clamped to bucketCount - 1
+ */
+uint8_t log2Bucket(uint32_t value, uint8_t bucketCount);
+
+/**
+ * Record the outcome of one request: a response after latencyMs, a
+ * timeout or a failed write
+ */
+void recordLatency(LinkMetrics* metrics, uint8_t service, uint32_t latencyMs);
+void recordTimeout(LinkMetrics* metrics, uint8_t service);
+void recordWriteError(LinkMetrics* metrics, uint8_t service);
+
+void recordNotification(LinkMetrics* metrics, size_t length);
+void recordRssi(LinkMetrics* metrics, int8_t rssi);
+
+/**
+ * Approximate latency percentile (0-100): the upper bound of the bucket
+ * holding it, capped at the largest value seen; 0 with no samples
+ */
+uint32_t latencyPercentile(const LatencyHistogram& hist, uint8_t percent);
+
+#endif // LINK_METRICS_H
@@ -0,0 +1,80 @@
+/**
+ * BLE Connection Parameter Profiles
+ *
+ * Two sets of connection parameters: a short interval without slave
+ * latency for command bursts and streaming transfers, and a long interval
+ * with slave latency that lets both radios sleep while the link only
+ * carries slow port polls. The profile follows activity: MQTT commands,
+ * fast port polling (the scheduler at or below LINK_BURST_POLL_MS) and
+ * explicit holds select burst; the link relaxes to idle LINK_BURST_LINGER_MS
+ * after the last of them, and no sooner than LINK_PROFILE_MIN_DWELL_MS
+ * after the last switch. A profile can also be pinned.
+ *
+ * Throughput (written plus notified bytes) is measured over
+ * LINK_THROUGHPUT_WINDOW_MS windows, with the peak kept per profile.
+ */
+
+#ifndef LINK_PROFILE_H
+#define LINK_PROFILE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+enum LinkProfile : uint8_t {
+    LINK_PROFILE_IDLE = 0,
+    LINK_PROFILE_BURST,
+    LINK_PROFILE_COUNT,
+    LINK_PROFILE_AUTO = LINK_PROFILE_COUNT  // Pin value: follow activity
+};
+
+struct ConnParams {
+    uint16_t minInterval;           // 1.25 ms units
+    uint16_t maxInterval;
+    uint16_t latency;               // Connection events the charger may skip
+    uint16_t timeout;               // Supervision timeout, 10 ms units
+};
+
+struct LinkProfileState {
+    uint8_t current;                // Profile last requested
+    uint8_t pinned;                 // LinkProfile, or LINK_PROFILE_AUTO
+    uint8_t holds;                  // Transfers that need burst until released
+    uint32_t lastActivityMs;
+    uint32_t switchedMs;
+    uint32_t switches;
+
+    // Throughput
+    uint32_t windowStartMs;
+    uint32_t windowBytes;
+    uint32_t lastBps;               // Bytes/s over the last full window
+    uint32_t peakBps[LINK_PROFILE_COUNT];
+};
+
+void initLinkProfile(LinkProfileState* state, uint8_t pinned, uint32_t nowMs);
+
+const ConnParams& linkProfileParams(uint8_t profile);
+
+/**
+ * Profile the link should be in now
+ */
+uint8_t chooseLinkProfile(const LinkProfileState& state, uint32_t pollIntervalMs,
+                          bool otaInProgress, uint32_t nowMs);
+
+/**
+ * Record a switch to profile once its update has been requested
+ */
+void setLinkProfile(LinkProfileState* state, uint8_t profile, uint32_t nowMs);
+
+/**
+ * Count bytes moved over the link and close the throughput window when
+ * it has run its length
+ */
+void addLinkBytes(LinkProfileState* state, uint32_t bytes, uint32_t nowMs);
+
+const char* getLinkProfileName(uint8_t profile);
+
+/**
+ * Profile by name ("idle", "burst", "auto"); LINK_PROFILE_AUTO + 1 if unknown
+ */
+uint8_t parseLinkProfile(const char* name);
+
+#endif // LINK_PROFILE_H
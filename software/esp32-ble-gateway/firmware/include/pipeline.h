@@ -0,0 +1,86 @@
+/**
+ * Pipelined Command Transport
+ *
+ * Window and credit bookkeeping for sending several requests before their
+ * responses arrive. Each request in flight holds one credit and is
+ * identified by its msgId; a response returns the credit of the request
+ * with the same msgId. The msgId of a send that timed out is retired, so
+ * its reply, if it turns up after all (e.g. after the request was resent
+ * under a new msgId), is ignored. A response matching neither is dropped
+ * as a mismatch; like a NAK or a timeout it drops the window to one: the
+ * rest of the batch is sent stop-and-wait.
+ *
+ * The caller owns the BLE side: it builds and writes frames, feeds
+ * responses and timeouts in, and retries requests the pipeline hands
+ * back as dropped.
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+struct PipelineSlot {
+    bool used;
+    uint8_t msgId;
+    uint8_t attempts;               // Sends so far, including this one
+    uint16_t request;               // Caller's request index
+    uint32_t seq;                   // Send order
+    uint32_t sentMs;
+};
+
+// Completed response frame, queued by the notification callback
+struct PipelineResponse {
+    uint8_t msgId;
+    bool ok;                        // Response flag set and not reset (NAK)
+};
+
+struct PipelineStats {
+    uint32_t sent;
+    uint32_t completed;
+    uint32_t naks;
+    uint32_t drops;                 // Requests whose response never came
+    uint32_t mismatches;            // Responses with an unknown msgId, dropped
+    uint32_t late;                  // Replies to timed-out sends, ignored
+    uint32_t fallbacks;             // Batches that fell back to stop-and-wait
+};
+
+struct Pipeline {
+    uint8_t window;                 // Credits while pipelining
+    bool stopAndWait;
+    uint8_t outstanding;
+    uint32_t nextSeq;
+    uint32_t lastProgressMs;        // Last send or response
+    PipelineSlot slots[PIPELINE_MAX_WINDOW];
+    uint8_t retired[PIPELINE_RETIRED_IDS];  // msgIds of expired sends, oldest overwritten
+    uint8_t retiredCount;
+    uint8_t retiredHead;
+    PipelineStats stats;
+};
+
+void initPipeline(Pipeline* pipe, uint8_t window, uint32_t nowMs);
+
+/**
+ * Requests that may be sent now
+ */
+uint8_t pipelineCredits(const Pipeline& pipe);
+
+void pipelineSent(Pipeline* pipe, uint8_t msgId, uint16_t request, uint8_t attempts, uint32_t nowMs);
+
+/**
+ * Match a response to its request and free its credit; false if no
+ * request in flight has its msgId (a late reply to an expired send, or a
+ * mismatch). A NAK (ok false) or a mismatch falls back to stop-and-wait.
+ */
+bool pipelineComplete(Pipeline* pipe, uint8_t msgId, bool ok, uint32_t nowMs, PipelineSlot* done);
+
+/**
+ * Hand back the oldest request once it has waited timeoutMs since it was
+ * sent or since the last progress, whichever is later (requests queue
+ * behind each other at the charger); retires its msgId and falls back to
+ * stop-and-wait
+ */
+bool pipelineExpire(Pipeline* pipe, uint32_t timeoutMs, uint32_t nowMs, PipelineSlot* dropped);
+
+#endif // PIPELINE_H
@@ -23,7 +23,10 @@ enum BLEFlags {
     FLAG_ACK = 0x2,
     FLAG_FIN = 0x3,
     FLAG_RST = 0x4,
-    FLAG_SYN_ACK = 0x5
+    FLAG_SYN_ACK = 0x5,
+    FLAG_FRAG_FIRST = 0x6,  // Fragments of a request longer than one write,
+    FLAG_FRAG_MORE = 0x7,   // each with its own header (sequence = index)
+    FLAG_FRAG_LAST = 0x8
 };
 
 // ============ Service Commands ============
@@ -165,14 +168,19 @@ enum StrategyType {
 
 // ============ Data Structures ============
 
-// Port information structure
+// Number of USB ports on a CP02 charger
+#define CP02_PORT_COUNT 5
+
+// Port information structure (fixed-point, converted to V/A/W only for JSON)
 struct PortInfo {
     uint8_t portId;
     uint8_t protocol;       // Fast charging protocol
-    float voltage;          // Voltage in V
-    float current;          // Current in A
-    float power;            // Power in W
+    uint16_t voltageMv;     // Voltage in mV
+    uint16_t currentMa;     // Current in mA
+    uint32_t powerMw;       // Power in mW
     int8_t temperature;     // Temperature in °C
+    uint16_t batteryLastFull;   // Device battery last full capacity (0.1 Wh)
+    uint16_t batteryPresent;    // Device battery present capacity (0.1 Wh)
     bool charging;          // Is charging
     bool enabled;           // Is enabled
 };
@@ -186,6 +194,12 @@ struct DeviceInfo {
     char bleAddr[18];       // BLE address
 };
 
+// Payload segment for scatter-gather message building
+struct PayloadSegment {
+    const uint8_t* data;
+    size_t len;
+};
+
 // BLE Response structure
 struct BLEResponse {
     uint8_t version;
@@ -207,6 +221,13 @@ struct BLEResponse {
  */
 uint8_t calcChecksum(const uint8_t* header, size_t len);
 
+/**
+ * Write a 9-byte frame header (with its checksum) declaring payloadLen
+ * bytes; the payload itself is left untouched
+ */
+void writeFrameHeader(uint8_t* header, uint8_t version, uint8_t msgId, uint8_t service,
+                      uint8_t sequence, uint8_t flags, uint32_t payloadLen);
+
 /**
  * Build a complete BLE message
  * Returns message length, fills buffer with message data
@@ -216,6 +237,23 @@ size_t buildMessage(uint8_t* buffer, size_t bufferSize,
                     uint8_t sequence, uint8_t flags,
                     const uint8_t* payload, size_t payloadLen);
 
+/**
+ * Build a complete BLE message from a list of payload segments, written
+ * back to back after the header (no intermediate staging buffer)
+ * Returns message length, 0 if the buffer is too small or a segment
+ * has a length but no data
+ */
+size_t buildMessageSegments(uint8_t* buffer, size_t bufferSize,
+                            uint8_t version, uint8_t msgId, uint8_t service,
+                            uint8_t sequence, uint8_t flags,
+                            const PayloadSegment* segments, size_t segmentCount);
+
+/**
+ * Payload size declared in a frame header (at least 9 bytes); byte order
+ * depends on the protocol version
+ */
+uint32_t framePayloadSize(const uint8_t* header);
+
 /**
  * Parse a BLE response message
  */
@@ -223,7 +261,8 @@ bool parseResponse(const uint8_t* data, size_t len, BLEResponse* response);
 
 /**
  * Parse port statistics from GET_ALL_POWER_STATISTICS response
- * Returns number of ports parsed
+ * Decodes every 8-byte port chunk in one pass, including the battery
+ * capacity fields. Returns number of ports parsed
  */
 int parsePortStatistics(const uint8_t* payload, size_t len, PortInfo* ports, int maxPorts);
 
@@ -0,0 +1,67 @@
+/**
+ * BLE Response Cache
+ *
+ * Read-through cache of whole response frames for idempotent GET commands,
+ * keyed by service and request payload (without the token). Lifetimes and
+ * invalidation groups come from the command descriptor table; the least
+ * recently used entry is replaced when the cache is full.
+ */
+
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "command_table.h"
+
+struct CacheEntry {
+    bool used;
+    uint8_t service;
+    uint8_t keyLen;
+    uint8_t key[RESPONSE_CACHE_KEY_MAX];
+    uint8_t group;                  // CacheGroup of the service
+    uint16_t length;
+    uint32_t storedMs;
+    uint32_t usedMs;
+    uint8_t frame[RESPONSE_CACHE_FRAME_MAX];
+};
+
+struct CacheStats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t stores;
+    uint32_t evictions;             // Live entries replaced to make room
+    uint32_t invalidations;         // Entries dropped by writes or resets
+};
+
+struct ResponseCache {
+    CacheEntry entries[RESPONSE_CACHE_ENTRIES];
+    CacheStats stats;
+};
+
+void initResponseCache(ResponseCache* cache);
+
+/**
+ * Look up a response; returns the cached frame (length in *length) or
+ * nullptr on a miss. Counts a hit or miss.
+ */
+const uint8_t* cacheLookup(ResponseCache* cache, uint8_t service, const uint8_t* key, size_t keyLen,
+                           uint32_t nowMs, size_t* length);
+
+/**
+ * Store a response frame; frames or keys too large for an entry are skipped
+ */
+void cacheStore(ResponseCache* cache, uint8_t service, const uint8_t* key, size_t keyLen,
+                const uint8_t* frame, size_t length, uint32_t nowMs);
+
+/**
+ * Drop every entry of a group (CACHE_ALL drops everything)
+ */
+void cacheInvalidate(ResponseCache* cache, uint8_t group);
+
+/**
+ * Hits over lookups, 0 before the first lookup
+ */
+float cacheHitRate(const CacheStats& stats);
+
+#endif // RESPONSE_CACHE_H
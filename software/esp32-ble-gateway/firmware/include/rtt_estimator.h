@@ -0,0 +1,54 @@
+/**
+ * Adaptive Response Timeouts
+ *
+ * Smoothed round-trip time and variance per command class, maintained as
+ * in TCP (RFC 6298): SRTT += (R - SRTT) / 8, RTTVAR += (|SRTT - R| -
+ * RTTVAR) / 4, RTO = SRTT + max(G, 4 * RTTVAR), clamped to RTO_MIN_MS and
+ * the command's ceiling. Until the first sample the ceiling is used. Each
+ * timeout doubles the RTO (up to RTO_MAX_BACKOFF times) until a response
+ * is measured again.
+ *
+ * Estimates are kept in 1/8 ms so the integer updates keep their precision.
+ */
+
+#ifndef RTT_ESTIMATOR_H
+#define RTT_ESTIMATOR_H
+
+#include <Arduino.h>
+#include "config.h"
+
+struct RttEstimator {
+    uint32_t srtt8;                 // Smoothed RTT, 1/8 ms
+    uint32_t rttvar8;               // RTT mean deviation, 1/8 ms
+    uint32_t samples;
+    uint8_t backoff;                // Doublings since the last sample
+};
+
+void initRttEstimator(RttEstimator* est);
+
+/**
+ * Feed the round trip of a request answered within its timeout
+ */
+void rttSample(RttEstimator* est, uint32_t rttMs);
+
+/**
+ * Note a request that timed out on the learned RTO
+ */
+void rttBackoff(RttEstimator* est);
+
+/**
+ * Timeout to use for the next request, never above ceilingMs
+ */
+uint32_t rttTimeout(const RttEstimator& est, uint32_t ceilingMs);
+
+inline uint32_t rttSmoothedMs(const RttEstimator& est) {
+    return est.srtt8 / 8;
+}
+
+inline uint32_t rttVarianceMs(const RttEstimator& est) {
+    return est.rttvar8 / 8;
+}
+
+const char* getTimeoutClassName(uint8_t timeoutClass);
+
+#endif // RTT_ESTIMATOR_H
@@ -0,0 +1,115 @@
+/**
+ * Local Rule Engine
+ *
+ * Conditions on port samples that trigger charger commands directly from
+ * the gateway, so a reaction costs one poll interval instead of a round
+ * trip through the backend. Rules arrive as short text, are compiled into
+ * fixed-size records, and are persisted in Preferences as those records.
+ *
+ * Rule text:  <target>.<metric><op><value>[@<polls>] -> <action>[:<arg>]
+ *   target   0-4 (one port), * (each port), total (sum of all ports)
+ *   metric   temp (C), volt (mV), curr (mA), power (mW), proto (protocol id)
+ *   op       > < >= <= == !=
+ *   @polls   consecutive matching polls before firing (default 1)
+ *   action   off[:port], on[:port], priority:<level>, strategy:<mode>, alert
+ *
+ * e.g.  *.temp>=75@2->off      total.power>90000->off:4      3.proto==18->alert
+ *
+ * A rule fires once when its condition starts to hold and re-arms only
+ * after the condition clears and RULE_COOLDOWN_MS has passed.
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "telemetry.h"
+
+#define RULE_TARGET_EACH    0xFE            // '*': evaluated per port
+#define RULE_TARGET_TOTAL   0xFF            // Sum over ports (power only)
+#define RULE_ACTION_PORT_MATCHED 0xFF       // Act on the port that matched
+
+enum RuleMetric : uint8_t {
+    RULE_METRIC_TEMP = 0,
+    RULE_METRIC_VOLT,
+    RULE_METRIC_CURR,
+    RULE_METRIC_POWER,
+    RULE_METRIC_PROTO
+};
+
+enum RuleOp : uint8_t {
+    RULE_OP_GT = 0,
+    RULE_OP_LT,
+    RULE_OP_GE,
+    RULE_OP_LE,
+    RULE_OP_EQ,
+    RULE_OP_NE
+};
+
+enum RuleAction : uint8_t {
+    RULE_ACTION_OFF = 0,
+    RULE_ACTION_ON,
+    RULE_ACTION_PRIORITY,
+    RULE_ACTION_STRATEGY,
+    RULE_ACTION_ALERT
+};
+
+// Compiled rule, stored as-is in Preferences
+struct Rule {
+    uint8_t target;                 // Port, RULE_TARGET_EACH or RULE_TARGET_TOTAL
+    uint8_t metric;                 // RuleMetric
+    uint8_t op;                     // RuleOp
+    uint8_t action;                 // RuleAction
+    int32_t threshold;
+    uint8_t holdPolls;
+    uint8_t actionArg;              // Port for on/off, level/mode otherwise
+};
+
+// Rule that fired on this sample
+struct RuleFiring {
+    uint8_t rule;                   // Index in the rule set
+    uint8_t port;                   // Matching port, RULE_TARGET_TOTAL for total
+    uint8_t action;
+    uint8_t actionPort;             // Resolved port for on/off/priority
+    uint8_t actionArg;
+    int32_t value;                  // Metric value that matched
+};
+
+struct RuleEngine {
+    Rule rules[RULE_MAX_RULES];
+    uint8_t count;
+    uint8_t matchPolls[RULE_MAX_RULES][CP02_PORT_COUNT];   // Consecutive matches (total uses [0])
+    uint32_t lastFiredMs[RULE_MAX_RULES][CP02_PORT_COUNT];
+};
+
+/**
+ * Compile one rule from text; returns false on a syntax error
+ */
+bool compileRule(const char* text, Rule* rule);
+
+/**
+ * Check a compiled rule's fields and their combination; compileRule
+ * applies it, and rules read back from Preferences must pass it too
+ */
+bool ruleValid(const Rule& rule);
+
+/**
+ * Write a rule back as text
+ */
+void formatRule(const Rule& rule, char* out, size_t outSize);
+
+/**
+ * Replace the rule set (clears all match state)
+ */
+void setRules(RuleEngine* engine, const Rule* rules, uint8_t count);
+
+/**
+ * Evaluate every rule against a snapshot; returns the number of firings
+ * written to out
+ */
+uint8_t evaluateRules(RuleEngine* engine, const PortSnapshot& snapshot, RuleFiring* out, uint8_t maxOut);
+
+const char* getRuleActionName(uint8_t action);
+
+#endif // RULES_H
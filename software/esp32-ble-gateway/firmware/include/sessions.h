@@ -0,0 +1,102 @@
+/**
+ * Charge Session Detection
+ *
+ * Per-port state machine fed from each port snapshot. A session opens when
+ * a device draws power, follows protocol renegotiations (e.g. PD 5V ->
+ * PD PPS) and the drop to constant-voltage taper, and closes when the
+ * device is unplugged or the charge settles at full. Energy is integrated
+ * with the same trapezoidal rule as the aggregate windows.
+ *
+ *   IDLE --start--> CHARGING --power < taper% of peak--> TAPER
+ *     ^                 |  ^------- power recovers ---------|
+ *     |                 v                                   v
+ *     +---- end (unplugged / stopped)        end (full / unplugged)
+ */
+
+#ifndef SESSIONS_H
+#define SESSIONS_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "telemetry.h"
+
+enum SessionState : uint8_t {
+    SESSION_IDLE = 0,
+    SESSION_CHARGING,
+    SESSION_TAPER
+};
+
+enum SessionEvent : uint8_t {
+    SESSION_EVENT_NONE = 0,
+    SESSION_EVENT_START,
+    SESSION_EVENT_PROTOCOL,         // Protocol changed mid-session
+    SESSION_EVENT_TAPER,
+    SESSION_EVENT_END
+};
+
+enum SessionEndReason : uint8_t {
+    SESSION_END_UNPLUGGED = 0,      // VBUS gone
+    SESSION_END_FULL,               // Power settled after taper
+    SESSION_END_STOPPED,            // Power dropped without a taper
+    SESSION_END_LOST                // Charger link lost mid-session
+};
+
+// Closed session, kept small so a history of them fits in DRAM
+struct SessionRecord {
+    uint8_t portId;
+    uint8_t endReason;              // SessionEndReason
+    uint8_t startProtocol;
+    uint8_t endProtocol;
+    uint8_t protocolChanges;
+    uint8_t tapered;
+    uint16_t batteryStart;          // 0.1 Wh, as reported by the port
+    uint16_t batteryEnd;
+    uint32_t startMs;               // Gateway millis() at start
+    uint32_t durationMs;
+    uint32_t energyMwh;
+    uint32_t peakPowerMw;
+    uint32_t chargerStartTs;        // Charger's own session start (Unix s), 0 if unknown
+};
+
+// Open session of one port
+struct PortSession {
+    SessionState state;
+    uint8_t protocol;               // Current protocol
+    uint8_t prevProtocol;           // Protocol before the last change
+    uint8_t idlePolls;              // Consecutive polls below start power
+    uint32_t lastMs;
+    uint32_t lastPowerMw;
+    uint64_t energyUj;
+    SessionRecord record;
+};
+
+struct SessionTracker {
+    PortSession ports[CP02_PORT_COUNT];
+    SessionRecord history[SESSION_HISTORY_SIZE];
+    uint8_t historyHead;            // Next slot to overwrite
+    uint8_t historyCount;
+};
+
+void initSessionTracker(SessionTracker* tracker);
+
+/**
+ * Advance one port's state machine with a new snapshot; returns the event
+ * it produced. On SESSION_EVENT_END the closed record is in
+ * tracker->ports[port].record and has been appended to the history.
+ */
+SessionEvent updatePortSession(SessionTracker* tracker, uint8_t port, const PortSnapshot& snapshot);
+
+/**
+ * Close an open session without a new sample (e.g. BLE disconnect);
+ * returns false if the port had no session
+ */
+bool endPortSession(SessionTracker* tracker, uint8_t port, SessionEndReason reason);
+
+/**
+ * Closed record i, 0 = most recent
+ */
+const SessionRecord* sessionHistoryAt(const SessionTracker& tracker, uint8_t i);
+
+const char* getSessionEndReasonName(uint8_t reason);
+
+#endif // SESSIONS_H
@@ -0,0 +1,84 @@
+/**
+ * Charger Configuration Shadow
+ *
+ * RAM copy of the charger settings the gateway can read or write: port
+ * priorities, per-port protocol config, display brightness/mode/flip,
+ * charging strategy and temperature mode. Each slot is filled lazily from
+ * its GET command and trusted for SHADOW_TTL_MS, so reads are answered
+ * without a BLE round trip and partial updates are read-modify-write
+ * against the shadow, writing a slot only when its value changes.
+ *
+ * Temperature mode has no GET command; its slot is only known from the
+ * last value written.
+ */
+
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "protocol.h"
+
+#define SHADOW_FEATURE_BYTES    3   // PowerFeatures bytes per port config
+
+enum ShadowSlot : uint8_t {
+    SHADOW_STRATEGY = 0,            // Single-byte settings first
+    SHADOW_BRIGHTNESS,
+    SHADOW_DISPLAY_MODE,
+    SHADOW_DISPLAY_FLIP,
+    SHADOW_TEMP_MODE,
+    SHADOW_VALUE_COUNT,
+    SHADOW_PRIORITIES = SHADOW_VALUE_COUNT,
+    SHADOW_PORT_CONFIG,             // + port id
+    SHADOW_SLOT_COUNT = SHADOW_PORT_CONFIG + CP02_PORT_COUNT
+};
+
+struct ChargerShadow {
+    uint8_t values[SHADOW_VALUE_COUNT];     // Single-byte settings, by slot
+    uint8_t priorities[CP02_PORT_COUNT];
+    uint8_t portFeatures[CP02_PORT_COUNT][SHADOW_FEATURE_BYTES];
+    uint32_t updatedMs[SHADOW_SLOT_COUNT];  // Last read or write, 0 = unknown
+    uint32_t version;                       // Bumped whenever a value changes
+    uint32_t publishedVersion;
+};
+
+void initChargerShadow(ChargerShadow* shadow);
+
+/**
+ * Storage and size of a slot
+ */
+uint8_t* shadowSlotData(ChargerShadow* shadow, uint8_t slot, size_t* len);
+
+inline bool shadowKnown(const ChargerShadow& shadow, uint8_t slot) {
+    return shadow.updatedMs[slot] != 0;
+}
+
+inline bool shadowFresh(const ChargerShadow& shadow, uint8_t slot, uint32_t nowMs) {
+    return shadowKnown(shadow, slot) && nowMs - shadow.updatedMs[slot] < SHADOW_TTL_MS;
+}
+
+/**
+ * True if writing value to slot would change the charger: the slot is
+ * stale, unknown or holds something else
+ */
+bool shadowNeedsWrite(ChargerShadow* shadow, uint8_t slot, const uint8_t* value, uint32_t nowMs);
+
+/**
+ * Store a value read from or written to the charger; returns true if it
+ * differs from what the shadow held
+ */
+bool shadowStore(ChargerShadow* shadow, uint8_t slot, const uint8_t* value, uint32_t nowMs);
+
+/**
+ * Forget every slot (e.g. after the charger disconnects); values are kept
+ * but will be read again before use
+ */
+void shadowInvalidate(ChargerShadow* shadow);
+
+/**
+ * Set or clear a PowerFeatures bit by protocol name; returns false if the
+ * name is unknown
+ */
+bool setPortFeature(uint8_t* features, const char* name, bool enabled);
+
+#endif // SHADOW_H
@@ -0,0 +1,157 @@
+/**
+ * Port Telemetry Snapshots
+ *
+ * Compact fixed-point view of all ports at one instant, laid out as
+ * structure-of-arrays so ring buffers and aggregates can scan one field
+ * across ports without touching the rest. Values stay integer (mV, mA,
+ * mW); conversion to V/A/W happens only when JSON is written.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "protocol.h"
+
+// One sample of every port
+struct PortSnapshot {
+    uint32_t timestampMs;                   // millis() when sampled
+    uint16_t voltageMv[CP02_PORT_COUNT];
+    uint16_t currentMa[CP02_PORT_COUNT];
+    uint32_t powerMw[CP02_PORT_COUNT];
+    int8_t temperature[CP02_PORT_COUNT];
+    uint8_t protocol[CP02_PORT_COUNT];
+    uint16_t batteryLastFull[CP02_PORT_COUNT];  // 0.1 Wh
+    uint16_t batteryPresent[CP02_PORT_COUNT];   // 0.1 Wh
+    uint8_t chargingMask;                   // bit n = port n charging
+    uint8_t enabledMask;                    // bit n = port n enabled
+};
+
+/**
+ * Fill a snapshot from decoded port data
+ */
+void captureSnapshot(const PortInfo* ports, int portCount, uint32_t timestampMs,
+                     PortSnapshot* snapshot);
+
+/**
+ * Sum of power over all ports in mW
+ */
+uint32_t snapshotTotalPowerMw(const PortSnapshot& snapshot);
+
+/**
+ * Number of ports currently charging
+ */
+uint8_t snapshotActivePorts(const PortSnapshot& snapshot);
+
+// Power history of one port, kept in the charger's own fixed-point steps
+// so a full curve costs two bytes per sample
+#define CURVE_CURRENT_STEP_UA   31250   // 1/32 A
+#define CURVE_VOLTAGE_STEP_MV   125     // 1/8 V
+
+struct PowerCurve {
+    uint8_t portId;
+    uint16_t startOffset;                   // History offset of sample 0
+    uint16_t count;
+    uint32_t fetchedMs;                     // millis() when retrieved
+    uint8_t currentRaw[HISTORY_MAX_SAMPLES];
+    uint8_t voltageRaw[HISTORY_MAX_SAMPLES];
+};
+
+/**
+ * Empty a curve before paging a port's history into it
+ */
+void resetPowerCurve(PowerCurve* curve, uint8_t portId, uint32_t timestampMs);
+
+/**
+ * Append one raw sample; returns false once the curve is full
+ */
+bool appendCurveSample(PowerCurve* curve, uint8_t currentRaw, uint8_t voltageRaw);
+
+/**
+ * Power of sample i in mW, rounded like PortInfo::powerMw
+ */
+inline uint32_t curveSamplePowerMw(const PowerCurve& curve, uint16_t i) {
+    return ((uint32_t)curve.voltageRaw[i] * curve.currentRaw[i] * 125 + 16) / 32;
+}
+
+// ============ Adaptive Polling ============
+// Poll interval drops to the minimum as soon as a port changes state,
+// then doubles on every quiet poll: up to POLL_INTERVAL_PORTS while any
+// port is charging, up to the maximum once all ports are idle
+struct PollScheduler {
+    uint32_t minIntervalMs;
+    uint32_t maxIntervalMs;
+    uint32_t intervalMs;                    // Interval until the next poll
+};
+
+void initPollScheduler(PollScheduler* scheduler, uint32_t minIntervalMs, uint32_t maxIntervalMs);
+
+/**
+ * True if a port switched on/off, started/stopped charging, changed
+ * protocol, or moved by more than the POLL_DELTA_* thresholds
+ */
+bool snapshotShowsActivity(const PortSnapshot& prev, const PortSnapshot& cur);
+
+/**
+ * Pick the next poll interval from the last two snapshots
+ */
+uint32_t updatePollInterval(PollScheduler* scheduler, const PortSnapshot& prev, const PortSnapshot& cur);
+
+// ============ Energy Integration ============
+// Energy is integrated per port with the trapezoidal rule over the real
+// sample timestamps, in mW x ms (uJ). Gaps longer than ENERGY_MAX_GAP_MS
+// (BLE outage, paused polling) are skipped rather than interpolated.
+
+// Min/max/energy of one aggregate window; average power is derived from
+// energy over covered time, so uneven polling does not skew it
+struct EnergyWindow {
+    uint32_t startMs;
+    uint32_t coveredMs;                     // Time actually integrated
+    uint16_t samples;
+    uint64_t energyUj[CP02_PORT_COUNT];
+    uint32_t minPowerMw[CP02_PORT_COUNT];
+    uint32_t maxPowerMw[CP02_PORT_COUNT];
+    uint32_t minTotalMw;
+    uint32_t maxTotalMw;
+};
+
+struct EnergyIntegrator {
+    bool hasPrev;
+    uint32_t prevMs;
+    uint32_t prevPowerMw[CP02_PORT_COUNT];
+    uint64_t lifetimeUj[CP02_PORT_COUNT];   // Since boot
+    EnergyWindow window;
+};
+
+void initEnergyIntegrator(EnergyIntegrator* integrator, uint32_t nowMs);
+
+/**
+ * Add a snapshot: integrates the segment since the previous one and
+ * updates the window min/max
+ */
+void integrateSnapshot(EnergyIntegrator* integrator, const PortSnapshot& snapshot);
+
+/**
+ * Start a new aggregate window (after the current one is published)
+ */
+void resetEnergyWindow(EnergyIntegrator* integrator, uint32_t nowMs);
+
+/**
+ * Average power over the window's covered time in mW
+ */
+inline uint32_t windowAvgPowerMw(const EnergyWindow& window, uint64_t energyUj) {
+    return window.coveredMs > 0 ? (uint32_t)(energyUj / window.coveredMs) : 0;
+}
+
+/**
+ * Fixed-point to JSON helpers: value rounded to the given number of
+ * decimals (e.g. mV -> V with 2 decimals)
+ */
+inline float milliToUnit(uint32_t milli, uint8_t decimals) {
+    uint32_t div = decimals >= 3 ? 1 : (decimals == 2 ? 10 : (decimals == 1 ? 100 : 1000));
+    uint32_t scale = 1000 / div;
+    return (float)((milli + div / 2) / div) / scale;
+}
+
+#endif // TELEMETRY_H
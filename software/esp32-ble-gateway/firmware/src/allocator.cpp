@@ -0,0 +1,151 @@
+#include "allocator.h"
+#include <string.h>
+
+static const char* ALLOC_ACTION_NAMES[] = {"none", "priorities", "shed", "restore"};
+
+void initPowerAllocator(PowerAllocator* alloc, bool enabled, uint32_t budgetMw, uint32_t hysteresisMw) {
+    memset(alloc, 0, sizeof(PowerAllocator));
+    alloc->enabled = enabled;
+    alloc->budgetMw = budgetMw;
+    alloc->hysteresisMw = hysteresisMw;
+    for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+        alloc->priorities[i] = i;
+    }
+}
+
+void configurePowerAllocator(PowerAllocator* alloc, bool enabled, uint32_t budgetMw, uint32_t hysteresisMw) {
+    alloc->enabled = enabled;
+    alloc->budgetMw = budgetMw;
+    alloc->hysteresisMw = hysteresisMw;
+    alloc->overPolls = 0;
+    alloc->underPolls = 0;
+}
+
+static bool isShed(const PowerAllocator* alloc, uint8_t port) {
+    for (uint8_t i = 0; i < alloc->shedCount; i++) {
+        if (alloc->shedOrder[i] == port) return true;
+    }
+    return false;
+}
+
+// Port to shed for an excess: the smallest load that clears it on its
+// own, otherwise the largest one
+static int pickShedPort(const PowerAllocator* alloc, const PortSnapshot& snapshot, uint32_t excessMw) {
+    int best = -1;
+    int largest = -1;
+    for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+        uint32_t p = snapshot.powerMw[i];
+        if (p == 0 || isShed(alloc, i)) continue;
+        if (p >= excessMw && (best < 0 || p < snapshot.powerMw[best])) best = i;
+        if (largest < 0 || p > snapshot.powerMw[largest]) largest = i;
+    }
+    return best >= 0 ? best : largest;
+}
+
+// Re-ranks ports by power, starting from the current order and swapping
+// neighbours only when the lower-ranked one draws more by over hysteresis
+static void rankPorts(const PowerAllocator* alloc, const PortSnapshot& snapshot, uint8_t* priorities) {
+    uint8_t order[CP02_PORT_COUNT];
+    for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+        order[alloc->priorities[i]] = i;
+    }
+    
+    bool swapped = true;
+    while (swapped) {
+        swapped = false;
+        for (uint8_t r = 0; r + 1 < CP02_PORT_COUNT; r++) {
+            uint32_t upper = snapshot.powerMw[order[r]];
+            uint32_t lower = snapshot.powerMw[order[r + 1]];
+            if (lower > upper + alloc->hysteresisMw) {
+                uint8_t tmp = order[r];
+                order[r] = order[r + 1];
+                order[r + 1] = tmp;
+                swapped = true;
+            }
+        }
+    }
+    
+    for (uint8_t r = 0; r < CP02_PORT_COUNT; r++) {
+        priorities[order[r]] = r;
+    }
+}
+
+bool decideAllocation(PowerAllocator* alloc, const PortSnapshot& snapshot, AllocDecision* decision) {
+    if (!alloc->enabled) return false;
+    
+    uint32_t totalMw = snapshotTotalPowerMw(snapshot);
+    memset(decision, 0, sizeof(AllocDecision));
+    decision->totalMw = totalMw;
+    decision->sampleMs = snapshot.timestampMs;
+    memcpy(decision->priorities, alloc->priorities, sizeof(alloc->priorities));
+    
+    // Budget state is tracked every poll, even while changes are held off
+    if (allocatorHasBudget(*alloc)) {
+        bool over = totalMw > alloc->budgetMw + alloc->hysteresisMw;
+        bool room = alloc->shedCount > 0 &&
+                    totalMw + alloc->shedPowerMw[alloc->shedCount - 1] + alloc->hysteresisMw <= alloc->budgetMw;
+        alloc->overPolls = over ? min(alloc->overPolls + 1, 255) : 0;
+        alloc->underPolls = room ? min(alloc->underPolls + 1, 255) : 0;
+    } else {
+        // Budget removed: nothing justifies keeping ports shed
+        alloc->overPolls = 0;
+        alloc->underPolls = alloc->shedCount > 0 ? ALLOC_CONFIRM_POLLS : 0;
+    }
+    
+    if (alloc->lastChangeMs != 0 && snapshot.timestampMs - alloc->lastChangeMs < ALLOC_MIN_CHANGE_MS) return false;
+    
+    if (alloc->overPolls >= ALLOC_CONFIRM_POLLS) {
+        int port = pickShedPort(alloc, snapshot, totalMw - alloc->budgetMw);
+        if (port >= 0 && alloc->shedCount < CP02_PORT_COUNT) {
+            decision->action = ALLOC_ACTION_SHED;
+            decision->port = port;
+            decision->portPowerMw = snapshot.powerMw[port];
+            return true;
+        }
+    }
+    
+    if (alloc->underPolls >= ALLOC_CONFIRM_POLLS) {
+        decision->action = ALLOC_ACTION_RESTORE;
+        decision->port = alloc->shedOrder[alloc->shedCount - 1];
+        return true;
+    }
+    
+    rankPorts(alloc, snapshot, decision->priorities);
+    if (alloc->prioritiesSent && memcmp(decision->priorities, alloc->priorities, sizeof(alloc->priorities)) == 0) {
+        return false;
+    }
+    decision->action = ALLOC_ACTION_PRIORITIES;
+    return true;
+}
+
+void applyAllocation(PowerAllocator* alloc, const AllocDecision& decision, bool success, uint32_t nowMs) {
+    uint32_t latency = nowMs - decision.sampleMs;
+    alloc->lastLatencyMs = latency;
+    alloc->maxLatencyMs = max(alloc->maxLatencyMs, latency);
+    alloc->lastChangeMs = nowMs ? nowMs : 1;
+    if (!success) return;
+    
+    switch (decision.action) {
+        case ALLOC_ACTION_PRIORITIES:
+            memcpy(alloc->priorities, decision.priorities, sizeof(alloc->priorities));
+            alloc->prioritiesSent = true;
+            break;
+        case ALLOC_ACTION_SHED:
+            alloc->shedOrder[alloc->shedCount] = decision.port;
+            alloc->shedPowerMw[alloc->shedCount] = decision.portPowerMw;
+            alloc->shedCount++;
+            alloc->overPolls = 0;
+            break;
+        case ALLOC_ACTION_RESTORE:
+            alloc->shedCount--;
+            alloc->underPolls = 0;
+            break;
+        default:
+            return;
+    }
+    alloc->changes++;
+}
+
+const char* getAllocActionName(uint8_t action) {
+    return action <= ALLOC_ACTION_RESTORE ? ALLOC_ACTION_NAMES[action] : "unknown";
+}
@@ -0,0 +1,110 @@
+#include "burst_capture.h"
+#include <string.h>
+
+// ============ Varint Writer ============
+
+struct BlobWriter {
+    uint8_t* out;
+    size_t size;
+    size_t pos;
+    bool overflow;
+};
+
+static void putByte(BlobWriter* w, uint8_t b) {
+    if (w->pos < w->size) {
+        w->out[w->pos++] = b;
+    } else {
+        w->overflow = true;
+    }
+}
+
+static void putU32(BlobWriter* w, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        putByte(w, (uint8_t)(v >> (i * 8)));
+    }
+}
+
+static void putVarint(BlobWriter* w, uint32_t v) {
+    while (v >= 0x80) {
+        putByte(w, (uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    putByte(w, (uint8_t)v);
+}
+
+// Signed delta -> small unsigned: 0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ...
+static void putDelta(BlobWriter* w, int32_t delta) {
+    putVarint(w, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+}
+
+// ============ Burst Capture ============
+
+void recordBurstSample(const PortInfo* ports, int portCount, uint32_t timestampUs, BurstSample* sample) {
+    if (portCount > CP02_PORT_COUNT) portCount = CP02_PORT_COUNT;
+    
+    memset(sample, 0, sizeof(BurstSample));
+    sample->timestampUs = timestampUs;
+    
+    for (int i = 0; i < portCount; i++) {
+        sample->voltageMv[i] = ports[i].voltageMv;
+        sample->currentMa[i] = ports[i].currentMa;
+        sample->temperature[i] = ports[i].temperature;
+        sample->protocol[i] = ports[i].protocol;
+        sample->chargingMask |= (uint8_t)(ports[i].charging << i);
+    }
+}
+
+size_t encodeBurst(const BurstSample* samples, uint32_t count, uint32_t durationUs,
+                   uint8_t flags, uint8_t pdPort, const char* cmdId,
+                   uint8_t* out, size_t outSize) {
+    BlobWriter w = {out, outSize, 0, false};
+    
+    size_t cmdIdLen = cmdId ? min(strlen(cmdId), (size_t)255) : 0;
+    putByte(&w, 'C'); putByte(&w, 'P'); putByte(&w, 'B'); putByte(&w, '1');
+    putByte(&w, BURST_VERSION);
+    putByte(&w, flags);
+    putByte(&w, CP02_PORT_COUNT);
+    putByte(&w, pdPort);
+    putU32(&w, count);
+    putU32(&w, durationUs);
+    putByte(&w, (uint8_t)cmdIdLen);
+    for (size_t i = 0; i < cmdIdLen; i++) {
+        putByte(&w, (uint8_t)cmdId[i]);
+    }
+    
+    BurstSample prev;
+    memset(&prev, 0, sizeof(prev));
+    for (uint32_t n = 0; n < count && !w.overflow; n++) {
+        const BurstSample& s = samples[n];
+        putVarint(&w, s.timestampUs - prev.timestampUs);
+        for (int i = 0; i < CP02_PORT_COUNT; i++) {
+            putDelta(&w, (int32_t)s.voltageMv[i] - prev.voltageMv[i]);
+            putDelta(&w, (int32_t)s.currentMa[i] - prev.currentMa[i]);
+            putDelta(&w, (int32_t)s.temperature[i] - prev.temperature[i]);
+            putDelta(&w, (int32_t)s.protocol[i] - prev.protocol[i]);
+        }
+        putDelta(&w, (int32_t)s.chargingMask - prev.chargingMask);
+        if (flags & BURST_FLAG_PD) {
+            putVarint(&w, s.pdOperating ^ prev.pdOperating);
+        }
+        prev = s;
+    }
+    
+    return w.overflow ? 0 : w.pos;
+}
+
+size_t encodeBurstChunkHeader(uint16_t index, uint16_t count, const char* cmdId,
+                              uint8_t* out, size_t outSize) {
+    BlobWriter w = {out, outSize, 0, false};
+    
+    size_t cmdIdLen = cmdId ? min(strlen(cmdId), (size_t)255) : 0;
+    putByte(&w, 'C'); putByte(&w, 'P'); putByte(&w, 'B'); putByte(&w, 'C');
+    putByte(&w, (uint8_t)index); putByte(&w, (uint8_t)(index >> 8));
+    putByte(&w, (uint8_t)count); putByte(&w, (uint8_t)(count >> 8));
+    putByte(&w, (uint8_t)cmdIdLen);
+    for (size_t i = 0; i < cmdIdLen; i++) {
+        putByte(&w, (uint8_t)cmdId[i]);
+    }
+    
+    return w.overflow ? 0 : w.pos;
+}
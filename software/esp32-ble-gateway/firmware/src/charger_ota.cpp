@@ -0,0 +1,62 @@
+#include "charger_ota.h"
+#include "frame_template.h"
+#include <string.h>
+
+static const char* PHASE_NAMES[] = {"idle", "transfer", "paused", "confirm", "done", "failed"};
+
+void initChargerOta(ChargerOta* ota, uint32_t size, uint8_t window, bool confirm, uint32_t nowMs) {
+    memset(ota, 0, sizeof(ChargerOta));
+    ota->phase = CHARGER_OTA_TRANSFER;
+    ota->confirm = confirm;
+    ota->window = constrain(window, 1, PIPELINE_MAX_WINDOW);
+    ota->size = size;
+    ota->startMs = nowMs;
+    ota->runStartMs = nowMs;
+}
+
+bool chargerOtaActive(const ChargerOta& ota) {
+    return ota.phase == CHARGER_OTA_TRANSFER || ota.phase == CHARGER_OTA_PAUSED ||
+           ota.phase == CHARGER_OTA_CONFIRM;
+}
+
+uint16_t chargerOtaChunkSize(uint16_t mtu) {
+    // ATT header, frame header, token, offset prefix
+    int room = (int)mtu - BLE_ATT_HEADER_SIZE - FRAME_HEADER_SIZE - 1 - CHARGER_OTA_OFFSET_SIZE;
+    room &= ~3;
+    return constrain(room, CHARGER_OTA_CHUNK_MIN, CHARGER_OTA_CHUNK_MAX);
+}
+
+uint16_t chargerOtaChunksPerBuffer(uint16_t chunkSize, size_t bufSize) {
+    return bufSize / (chunkSize + CHARGER_OTA_OFFSET_SIZE);
+}
+
+void chargerOtaPause(ChargerOta* ota, const char* reason, uint32_t nowMs) {
+    ota->phase = CHARGER_OTA_PAUSED;
+    ota->pausedMs = nowMs;
+    ota->error = reason;
+}
+
+void chargerOtaRun(ChargerOta* ota, uint32_t nowMs) {
+    ota->phase = CHARGER_OTA_TRANSFER;
+    ota->runOffset = ota->offset;
+    ota->runStartMs = nowMs;
+    ota->error = nullptr;
+}
+
+void chargerOtaFail(ChargerOta* ota, const char* reason) {
+    ota->phase = CHARGER_OTA_FAILED;
+    ota->error = reason;
+}
+
+uint8_t chargerOtaPercent(const ChargerOta& ota) {
+    return ota.size > 0 ? (uint64_t)ota.offset * 100 / ota.size : 0;
+}
+
+uint32_t chargerOtaRate(const ChargerOta& ota, uint32_t nowMs) {
+    uint32_t elapsed = nowMs - ota.runStartMs;
+    return elapsed > 0 ? (uint64_t)(ota.offset - ota.runOffset) * 1000 / elapsed : 0;
+}
+
+const char* getChargerOtaPhaseName(uint8_t phase) {
+    return phase <= CHARGER_OTA_FAILED ? PHASE_NAMES[phase] : "unknown";
+}
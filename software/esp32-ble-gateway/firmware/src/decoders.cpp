@@ -0,0 +1,179 @@
+#include "decoders.h"
+
+static const char* POWER_FEATURE_NAMES[PORT_CONFIG_PROTOCOL_COUNT] = {
+    "TFCP", "PE", "QC2.0", "QC3.0", "QC3+", "AFC", "FCP", "HV_SCP",
+    "LV_SCP", "SFCP", "Apple 5V", "Samsung 5V", "BC1.2", "UFCS", "RPi 5V5A", "VOOC",
+    "PD", "PPS", "QC4.0", "QC4+", "Dash/Warp", "SFC", "MTK PE", "MTK PE+"
+};
+
+static const char* WIFI_STATUS_NAMES[] = {"未配置", "失败", "连接中", "已连接", "断开连接中"};
+static const char* STRATEGY_NAMES[] = {"自动分配", "固定分配", "优先级分配"};
+static const char* DISPLAY_MODE_NAMES[] = {"默认", "简洁", "详细"};
+static const char* BATTERY_STATUS_NAMES[] = {"充电中", "放电中", "空闲"};
+static const char* CABLE_MAX_VOLTAGE_NAMES[] = {"20V", "30V", "40V", "50V"};
+static const char* CABLE_MAX_CURRENT_NAMES[] = {"未知", "3A", "5A"};
+static const char* USB_SPEED_NAMES[] = {"USB 2.0", "USB 3.2 Gen1", "USB 3.2 Gen2", "USB4 Gen3"};
+static const char* CABLE_LENGTH_NAMES[] = {"未知", "<1m", "~2m", "~3m", "~4m", "~5m", "~6m", "~7m", ">7m"};
+static const char* PD_REVISION_NAMES[] = {"1.0", "2.0", "2.0", "3.0"};
+
+#define NAME_OR_UNKNOWN(table, index) \
+    ((index) < sizeof(table) / sizeof(table[0]) ? table[index] : "未知")
+
+// ============ Decoders ============
+
+static bool bindView(const uint8_t* payload, size_t len, size_t minLen, PayloadView* view) {
+    if (payload == nullptr || view == nullptr || len < minLen) return false;
+    view->data = payload;
+    view->len = len;
+    return true;
+}
+
+bool decodePdStatus(const uint8_t* payload, size_t len, PdStatusView* view) {
+    return bindView(payload, len, 2, view);
+}
+
+bool decodePowerSupplyStatus(const uint8_t* payload, size_t len, PowerSupplyStatusView* view) {
+    return bindView(payload, len, 1, view);
+}
+
+bool decodeChargingStatus(const uint8_t* payload, size_t len, ChargingStatusView* view) {
+    return bindView(payload, len, 1, view);
+}
+
+bool decodeDisplaySettings(const uint8_t* payload, size_t len, DisplaySettingsView* view) {
+    return bindView(payload, len, 2, view);
+}
+
+bool decodeWifiStatus(const uint8_t* payload, size_t len, WifiStatusView* view) {
+    return bindView(payload, len, 1, view);
+}
+
+bool decodePortConfig(const uint8_t* payload, size_t len, PortConfigView* view) {
+    return bindView(payload, len, 4, view);
+}
+
+bool decodeChargingStrategy(const uint8_t* payload, size_t len, ChargingStrategyView* view) {
+    return bindView(payload, len, 1, view);
+}
+
+bool decodePortPriority(const uint8_t* payload, size_t len, PortPriorityView* view) {
+    return bindView(payload, len, 1, view);
+}
+
+bool decodeStartChargeTimestamp(const uint8_t* payload, size_t len, StartChargeTimestampView* view) {
+    return bindView(payload, len, 4, view);
+}
+
+bool decodePowerHistory(const uint8_t* payload, size_t len, PowerHistoryView* view) {
+    return bindView(payload, len, POWER_HISTORY_HEADER_SIZE, view);
+}
+
+const char* getPowerFeatureName(uint8_t bit) {
+    return bit < PORT_CONFIG_PROTOCOL_COUNT ? POWER_FEATURE_NAMES[bit] : "UNKNOWN";
+}
+
+// ============ JSON Writers ============
+
+static void writeHex16(JsonObject out, const char* key, uint16_t value) {
+    char hex[8];
+    snprintf(hex, sizeof(hex), "0x%04X", value);
+    out[key] = hex;
+}
+
+void writePdStatusJson(const PdStatusView& view, JsonObject out) {
+    JsonObject battery = out.createNestedObject("battery");
+    writeHex16(battery, "vid", view.batteryVid());
+    writeHex16(battery, "pid", view.batteryPid());
+    battery["design_capacity"] = view.designCapacity() / 10.0f;
+    battery["last_full_capacity"] = view.lastFullCapacity() / 10.0f;
+    battery["present_capacity"] = view.presentCapacity() / 10.0f;
+    battery["percent"] = view.batteryPercent();
+    battery["present"] = view.batteryPresent();
+    battery["status_name"] = NAME_OR_UNKNOWN(BATTERY_STATUS_NAMES, view.batteryStatus());
+
+    JsonObject cable = out.createNestedObject("cable");
+    cable["is_active"] = view.cableActive();
+    cable["phy_type"] = view.cableOptical() ? "光缆" : "铜缆";
+    cable["max_voltage"] = NAME_OR_UNKNOWN(CABLE_MAX_VOLTAGE_NAMES, view.cableMaxVoltage());
+    cable["max_current"] = NAME_OR_UNKNOWN(CABLE_MAX_CURRENT_NAMES, view.cableMaxCurrent());
+    cable["usb_speed"] = NAME_OR_UNKNOWN(USB_SPEED_NAMES, view.cableUsbSpeed());
+    writeHex16(cable, "vid", view.cableVid());
+    writeHex16(cable, "pid", view.cablePid());
+    cable["length"] = NAME_OR_UNKNOWN(CABLE_LENGTH_NAMES, view.cableLatency());
+
+    out["temperature"] = view.statusTemperature();
+
+    JsonObject operating = out.createNestedObject("operating");
+    if (view.hasOperating()) {
+        uint32_t currentMa = view.operatingCurrentMa();
+        uint32_t voltageMv = view.operatingVoltageMv();
+        operating["current"] = currentMa / 1000.0f;
+        operating["voltage"] = voltageMv / 1000.0f;
+        operating["power"] = (currentMa * voltageMv / 10000) / 100.0f;
+        operating["pd_revision"] = PD_REVISION_NAMES[view.pdRevision()];
+        operating["pps_charging_supported"] = view.ppsSupported();
+        operating["has_battery"] = view.hasBattery();
+        operating["has_emarker"] = view.hasEmarker();
+    }
+}
+
+void writePowerSupplyStatusJson(const PowerSupplyStatusView& view, JsonObject out) {
+    out["port_mask"] = view.portMask();
+    JsonArray open = out.createNestedArray("open_ports");
+    for (uint8_t i = 0; i < 8; i++) {
+        if (view.portOpen(i)) open.add(i);
+    }
+}
+
+void writeChargingStatusJson(const ChargingStatusView& view, JsonObject out) {
+    out["num_ports"] = view.numPorts();
+    JsonArray ports = out.createNestedArray("ports");
+    for (uint8_t i = 0; i < view.count(); i++) {
+        JsonObject port = ports.createNestedObject();
+        port["port_id"] = view.portId(i);
+        port["voltage"] = view.voltageMv(i) / 1000.0f;
+        port["current"] = view.currentMa(i) / 1000.0f;
+    }
+}
+
+void writeDisplaySettingsJson(const DisplaySettingsView& view, JsonObject out) {
+    out["brightness"] = view.brightness();
+    out["mode"] = view.mode();
+    out["mode_name"] = NAME_OR_UNKNOWN(DISPLAY_MODE_NAMES, view.mode());
+}
+
+void writeWifiStatusJson(const WifiStatusView& view, JsonObject out) {
+    out["status"] = view.status();
+    out["status_name"] = NAME_OR_UNKNOWN(WIFI_STATUS_NAMES, view.status());
+    if (view.hasIp()) {
+        char ip[16];
+        const uint8_t* b = view.ip();
+        snprintf(ip, sizeof(ip), "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+        out["ip"] = ip;
+    }
+}
+
+void writePortConfigJson(const PortConfigView& view, JsonObject out) {
+    const uint8_t* features = view.powerFeatures();
+    char hex[7];
+    snprintf(hex, sizeof(hex), "%02x%02x%02x", features[0], features[1], features[2]);
+
+    out["port_id"] = view.portId();
+    out["power_features"] = hex;
+    JsonArray protocols = out.createNestedArray("protocols");
+    for (uint8_t bit = 0; bit < PORT_CONFIG_PROTOCOL_COUNT; bit++) {
+        if (view.protocolEnabled(bit)) protocols.add(POWER_FEATURE_NAMES[bit]);
+    }
+}
+
+void writeChargingStrategyJson(const ChargingStrategyView& view, JsonObject out) {
+    out["strategy"] = view.strategy();
+    out["strategy_name"] = NAME_OR_UNKNOWN(STRATEGY_NAMES, view.strategy());
+}
+
+void writePortPriorityJson(const PortPriorityView& view, JsonObject out) {
+    JsonArray priorities = out.createNestedArray("priorities");
+    for (uint8_t i = 0; i < view.count(); i++) {
+        priorities.add(view.priority(i));
+    }
+}
@@ -0,0 +1,68 @@
+#include "gateway_ota.h"
+#include <string.h>
+
+static const char* PHASE_NAMES[] = {"idle", "download", "paused", "commit", "done", "failed"};
+
+void initGatewayOta(GatewayOta* ota, uint32_t size, const uint8_t* sha256, uint32_t nowMs) {
+    memset(ota, 0, sizeof(GatewayOta));
+    ota->phase = GATEWAY_OTA_DOWNLOAD;
+    ota->verify = sha256 != nullptr;
+    if (sha256 != nullptr) memcpy(ota->sha256, sha256, SHA256_SIZE);
+    ota->size = size;
+    ota->startMs = nowMs;
+    ota->runStartMs = nowMs;
+}
+
+bool gatewayOtaActive(const GatewayOta& ota) {
+    return ota.phase == GATEWAY_OTA_DOWNLOAD || ota.phase == GATEWAY_OTA_PAUSED ||
+           ota.phase == GATEWAY_OTA_COMMIT;
+}
+
+void gatewayOtaPause(GatewayOta* ota, const char* reason, uint32_t nowMs) {
+    ota->phase = GATEWAY_OTA_PAUSED;
+    ota->pausedMs = nowMs;
+    ota->error = reason;
+}
+
+void gatewayOtaRun(GatewayOta* ota, uint32_t nowMs) {
+    ota->phase = GATEWAY_OTA_DOWNLOAD;
+    ota->runOffset = ota->offset;
+    ota->runStartMs = nowMs;
+    ota->error = nullptr;
+}
+
+void gatewayOtaFail(GatewayOta* ota, const char* reason) {
+    ota->phase = GATEWAY_OTA_FAILED;
+    ota->error = reason;
+}
+
+uint8_t gatewayOtaPercent(const GatewayOta& ota) {
+    return ota.size > 0 ? (uint64_t)ota.offset * 100 / ota.size : 0;
+}
+
+uint32_t gatewayOtaRate(const GatewayOta& ota, uint32_t nowMs) {
+    uint32_t elapsed = nowMs - ota.runStartMs;
+    return elapsed > 0 ? (uint64_t)(ota.offset - ota.runOffset) * 1000 / elapsed : 0;
+}
+
+const char* getGatewayOtaPhaseName(uint8_t phase) {
+    return phase <= GATEWAY_OTA_FAILED ? PHASE_NAMES[phase] : "unknown";
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool parseSha256Hex(const char* hex, uint8_t* out) {
+    if (hex == nullptr || strlen(hex) != SHA256_SIZE * 2) return false;
+    for (uint8_t i = 0; i < SHA256_SIZE; i++) {
+        int hi = hexDigit(hex[i * 2]);
+        int lo = hexDigit(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
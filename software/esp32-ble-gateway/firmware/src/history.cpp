@@ -0,0 +1,132 @@
+#include "history.h"
+#include <string.h>
+
+static const uint32_t TIER_PERIODS[HISTORY_TIER_COUNT] = {
+    HISTORY_TIER0_PERIOD_S, HISTORY_TIER1_PERIOD_S, HISTORY_TIER2_PERIOD_S
+};
+static const uint16_t TIER_CAPACITIES[HISTORY_TIER_COUNT] = {
+    HISTORY_TIER0_CAPACITY, HISTORY_TIER1_CAPACITY, HISTORY_TIER2_CAPACITY
+};
+
+static void* historyAlloc(size_t size, bool psram) {
+    return psram ? ps_malloc(size) : malloc(size);
+}
+
+// Frees whatever allocTier managed to allocate and leaves the tier empty
+static void freeTier(HistoryTier* tier) {
+    free(tier->timeS);
+    free(tier->voltageMv);
+    free(tier->currentMa);
+    free(tier->powerCw);
+    free(tier->temperature);
+    free(tier->protocol);
+    free(tier->chargingMask);
+    memset(tier, 0, sizeof(HistoryTier));
+}
+
+static bool allocTier(HistoryTier* tier, uint32_t periodS, uint16_t capacity, bool psram) {
+    memset(tier, 0, sizeof(HistoryTier));
+    tier->periodS = periodS;
+    tier->capacity = capacity;
+    
+    size_t fields = (size_t)capacity * CP02_PORT_COUNT;
+    tier->timeS = (uint32_t*)historyAlloc(capacity * sizeof(uint32_t), psram);
+    tier->voltageMv = (uint16_t*)historyAlloc(fields * sizeof(uint16_t), psram);
+    tier->currentMa = (uint16_t*)historyAlloc(fields * sizeof(uint16_t), psram);
+    tier->powerCw = (uint16_t*)historyAlloc(fields * sizeof(uint16_t), psram);
+    tier->temperature = (int8_t*)historyAlloc(fields, psram);
+    tier->protocol = (uint8_t*)historyAlloc(fields, psram);
+    tier->chargingMask = (uint8_t*)historyAlloc(capacity, psram);
+    
+    if (tier->timeS && tier->voltageMv && tier->currentMa && tier->powerCw &&
+        tier->temperature && tier->protocol && tier->chargingMask) {
+        return true;
+    }
+    freeTier(tier);
+    return false;
+}
+
+bool initHistoryRings(HistoryRings* rings) {
+    rings->psram = psramFound();
+    bool ok = true;
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        uint16_t capacity = rings->psram ? TIER_CAPACITIES[t] : TIER_CAPACITIES[t] / HISTORY_DRAM_DIVISOR;
+        if (!allocTier(&rings->tiers[t], TIER_PERIODS[t], capacity, rings->psram)) {
+            rings->tiers[t].periodS = TIER_PERIODS[t];  // Tier stays empty
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Stores the averaged bucket in the ring and starts an empty one
+static void closeBucket(HistoryTier* tier) {
+    uint16_t slot = tier->head;
+    uint16_t n = tier->bucketSamples;
+    tier->timeS[slot] = tier->bucketS;
+    tier->chargingMask[slot] = tier->bucketMask;
+    
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        size_t f = (size_t)slot * CP02_PORT_COUNT + i;
+        tier->voltageMv[f] = (uint16_t)((tier->sumVoltageMv[i] + n / 2) / n);
+        tier->currentMa[f] = (uint16_t)((tier->sumCurrentMa[i] + n / 2) / n);
+        tier->powerCw[f] = (uint16_t)min((tier->sumPowerMw[i] / n + 5) / 10, (uint32_t)UINT16_MAX);
+        tier->temperature[f] = (int8_t)(tier->sumTemperature[i] / n);
+        tier->protocol[f] = tier->bucketProtocol[i];
+    }
+    
+    tier->head = (tier->head + 1) % tier->capacity;
+    if (tier->count < tier->capacity) tier->count++;
+    
+    tier->bucketSamples = 0;
+    tier->bucketMask = 0;
+    memset(tier->sumVoltageMv, 0, sizeof(tier->sumVoltageMv));
+    memset(tier->sumCurrentMa, 0, sizeof(tier->sumCurrentMa));
+    memset(tier->sumPowerMw, 0, sizeof(tier->sumPowerMw));
+    memset(tier->sumTemperature, 0, sizeof(tier->sumTemperature));
+}
+
+void recordHistory(HistoryRings* rings, const PortSnapshot& snapshot) {
+    uint32_t nowS = snapshot.timestampMs / 1000;
+    
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        HistoryTier* tier = &rings->tiers[t];
+        if (tier->capacity == 0) continue;
+        
+        uint32_t bucketS = nowS - nowS % tier->periodS;
+        if (tier->bucketSamples > 0 && bucketS != tier->bucketS) closeBucket(tier);
+        
+        tier->bucketS = bucketS;
+        tier->bucketSamples++;
+        tier->bucketMask |= snapshot.chargingMask;
+        for (int i = 0; i < CP02_PORT_COUNT; i++) {
+            tier->sumVoltageMv[i] += snapshot.voltageMv[i];
+            tier->sumCurrentMa[i] += snapshot.currentMa[i];
+            tier->sumPowerMw[i] += snapshot.powerMw[i];
+            tier->sumTemperature[i] += snapshot.temperature[i];
+            tier->bucketProtocol[i] = snapshot.protocol[i];
+        }
+    }
+}
+
+uint16_t findHistoryIndex(const HistoryTier& tier, uint32_t afterS) {
+    uint16_t lo = 0;
+    uint16_t hi = tier.count;
+    while (lo < hi) {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (tier.timeS[historySlot(tier, mid)] <= afterS) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+uint8_t selectHistoryTier(const HistoryRings& rings, uint32_t fromS) {
+    for (uint8_t t = 0; t < HISTORY_TIER_COUNT; t++) {
+        const HistoryTier& tier = rings.tiers[t];
+        if (tier.count > 0 && tier.timeS[historySlot(tier, 0)] <= fromS) return t;
+    }
+    return HISTORY_TIER_COUNT - 1;
+}
@@ -0,0 +1,71 @@
+#include "link_metrics.h"
+#include <string.h>
+
+void initLinkMetrics(LinkMetrics* metrics, uint32_t nowMs) {
+    memset(metrics, 0, sizeof(LinkMetrics));
+    metrics->services[LINK_METRICS_SERVICES].used = true;
+    metrics->services[LINK_METRICS_SERVICES].service = LINK_SERVICE_OTHER;
+    metrics->sinceMs = nowMs;
+}
+
+uint8_t log2Bucket(uint32_t value, uint8_t bucketCount) {
+    uint8_t bucket = value > 1 ? 31 - __builtin_clz(value) : 0;
+    return bucket < bucketCount ? bucket : bucketCount - 1;
+}
+
+static ServiceMetrics* serviceSlot(LinkMetrics* metrics, uint8_t service) {
+    for (uint8_t i = 0; i < LINK_METRICS_SERVICES; i++) {
+        ServiceMetrics& slot = metrics->services[i];
+        if (!slot.used) {
+            slot.used = true;
+            slot.service = service;
+            return &slot;
+        }
+        if (slot.service == service) return &slot;
+    }
+    return &metrics->services[LINK_METRICS_SERVICES];
+}
+
+void recordLatency(LinkMetrics* metrics, uint8_t service, uint32_t latencyMs) {
+    LatencyHistogram& hist = serviceSlot(metrics, service)->latency;
+    hist.buckets[log2Bucket(latencyMs, LINK_LATENCY_BUCKETS)]++;
+    if (hist.count == 0 || latencyMs < hist.minMs) hist.minMs = latencyMs;
+    if (latencyMs > hist.maxMs) hist.maxMs = latencyMs;
+    hist.sumMs += latencyMs;
+    hist.count++;
+}
+
+void recordTimeout(LinkMetrics* metrics, uint8_t service) {
+    serviceSlot(metrics, service)->timeouts++;
+}
+
+void recordWriteError(LinkMetrics* metrics, uint8_t service) {
+    serviceSlot(metrics, service)->writeErrors++;
+}
+
+void recordNotification(LinkMetrics* metrics, size_t length) {
+    metrics->sizeBuckets[log2Bucket(length, LINK_SIZE_BUCKETS)]++;
+    metrics->notifications++;
+    metrics->notifyBytes += length;
+}
+
+void recordRssi(LinkMetrics* metrics, int8_t rssi) {
+    metrics->rssi[metrics->rssiHead] = rssi;
+    metrics->rssiHead = (metrics->rssiHead + 1) % LINK_RSSI_SAMPLES;
+    if (metrics->rssiCount < LINK_RSSI_SAMPLES) metrics->rssiCount++;
+}
+
+uint32_t latencyPercentile(const LatencyHistogram& hist, uint8_t percent) {
+    if (hist.count == 0) return 0;
+    
+    uint32_t rank = ((uint64_t)hist.count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < LINK_LATENCY_BUCKETS; i++) {
+        seen += hist.buckets[i];
+        if (seen >= rank) {
+            uint32_t upper = i + 1 < LINK_LATENCY_BUCKETS ? (2u << i) : hist.maxMs;
+            return min(upper, hist.maxMs);
+        }
+    }
+    return hist.maxMs;
+}
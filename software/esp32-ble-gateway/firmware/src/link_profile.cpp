@@ -0,0 +1,70 @@
+#include "link_profile.h"
+#include <string.h>
+
+static const char* PROFILE_NAMES[] = {"idle", "burst", "auto"};
+
+static const ConnParams PROFILE_PARAMS[LINK_PROFILE_COUNT] = {
+    {LINK_IDLE_INTERVAL_MIN, LINK_IDLE_INTERVAL_MAX, LINK_IDLE_LATENCY, LINK_IDLE_TIMEOUT},
+    {LINK_BURST_INTERVAL_MIN, LINK_BURST_INTERVAL_MAX, LINK_BURST_LATENCY, LINK_BURST_TIMEOUT}
+};
+
+void initLinkProfile(LinkProfileState* state, uint8_t pinned, uint32_t nowMs) {
+    memset(state, 0, sizeof(LinkProfileState));
+    state->current = LINK_PROFILE_BURST;    // Connections start on a short interval
+    state->pinned = pinned <= LINK_PROFILE_AUTO ? pinned : (uint8_t)LINK_PROFILE_AUTO;
+    state->switchedMs = nowMs;
+    state->windowStartMs = nowMs;
+}
+
+const ConnParams& linkProfileParams(uint8_t profile) {
+    return PROFILE_PARAMS[profile < LINK_PROFILE_COUNT ? profile : (uint8_t)LINK_PROFILE_IDLE];
+}
+
+uint8_t chooseLinkProfile(const LinkProfileState& state, uint32_t pollIntervalMs,
+                          bool otaInProgress, uint32_t nowMs) {
+    if (state.pinned < LINK_PROFILE_COUNT) return state.pinned;
+    
+    // Gateway OTA is a WiFi transfer; the shared radio is better left to it
+    if (otaInProgress) return LINK_PROFILE_IDLE;
+    
+    bool active = state.holds > 0 || pollIntervalMs <= LINK_BURST_POLL_MS ||
+                  (state.lastActivityMs != 0 && nowMs - state.lastActivityMs < LINK_BURST_LINGER_MS);
+    if (active) return LINK_PROFILE_BURST;
+    
+    // Relaxing waits out the dwell time so a lull between commands does
+    // not bounce the link
+    if (state.current == LINK_PROFILE_BURST && nowMs - state.switchedMs < LINK_PROFILE_MIN_DWELL_MS) {
+        return LINK_PROFILE_BURST;
+    }
+    return LINK_PROFILE_IDLE;
+}
+
+void setLinkProfile(LinkProfileState* state, uint8_t profile, uint32_t nowMs) {
+    if (profile == state->current) return;
+    state->current = profile;
+    state->switchedMs = nowMs;
+    state->switches++;
+}
+
+void addLinkBytes(LinkProfileState* state, uint32_t bytes, uint32_t nowMs) {
+    state->windowBytes += bytes;
+    uint32_t elapsed = nowMs - state->windowStartMs;
+    if (elapsed < LINK_THROUGHPUT_WINDOW_MS) return;
+    
+    state->lastBps = (uint64_t)state->windowBytes * 1000 / elapsed;
+    uint32_t& peak = state->peakBps[state->current];
+    if (state->lastBps > peak) peak = state->lastBps;
+    state->windowBytes = 0;
+    state->windowStartMs = nowMs;
+}
+
+const char* getLinkProfileName(uint8_t profile) {
+    return profile <= LINK_PROFILE_AUTO ? PROFILE_NAMES[profile] : "unknown";
+}
+
+uint8_t parseLinkProfile(const char* name) {
+    for (uint8_t i = 0; name != nullptr && i <= LINK_PROFILE_AUTO; i++) {
+        if (strcmp(PROFILE_NAMES[i], name) == 0) return i;
+    }
+    return LINK_PROFILE_AUTO + 1;
+}
@@ -16,15 +16,37 @@
 #include <ArduinoJson.h>
 #include <Ticker.h>
 #include <Preferences.h>
+#include <freertos/stream_buffer.h>
+#include <freertos/queue.h>
+#include <mbedtls/base64.h>
+#include <mbedtls/sha256.h>
+
+#include <HTTPClient.h>
 
 #if OTA_ENABLED
 #include <ArduinoOTA.h>
-#include <HTTPClient.h>
 #include <Update.h>
 #endif
 
 #include "config.h"
 #include "protocol.h"
+#include "command_table.h"
+#include "frame_template.h"
+#include "telemetry.h"
+#include "decoders.h"
+#include "burst_capture.h"
+#include "sessions.h"
+#include "history.h"
+#include "rules.h"
+#include "allocator.h"
+#include "shadow.h"
+#include "response_cache.h"
+#include "link_metrics.h"
+#include "rtt_estimator.h"
+#include "link_profile.h"
+#include "pipeline.h"
+#include "charger_ota.h"
+#include "gateway_ota.h"
 
 // ============ Global Objects ============
 AsyncMqttClient mqttClient;
@@ -43,6 +65,8 @@ NimBLEClient* pBleClient = nullptr;
 NimBLERemoteService* pRemoteService = nullptr;
 NimBLERemoteCharacteristic* pTxChar = nullptr;
 NimBLERemoteCharacteristic* pRxChar = nullptr;
+uint16_t bleMtu = BLE_ATT_MTU_DEFAULT;  // ATT MTU in use for writes (see negotiateMtu)
+uint16_t chargerMtu = 0;                // MTU reported by GET_BLE_MTU, 0 = unknown
 
 // ============ State Variables ============
 volatile bool bleConnected = false;
@@ -55,12 +79,178 @@ uint8_t msgId = 0;
 String chargerDeviceName = "";
 String chargerAddress = "";
 
-PortInfo portData[5];
+PortInfo portData[CP02_PORT_COUNT];
+PortSnapshot portSnapshot;    // Latest fixed-point sample of portData
+PollScheduler pollScheduler;  // Adaptive port polling interval
+EnergyIntegrator energy;      // Per-port energy and current aggregate window
+SessionTracker sessions;      // Per-port charge sessions
+HistoryRings historyRings;    // Downsampled history for backfill (get_history)
+RuleEngine ruleEngine;        // Local rules evaluated on every port sample
+PowerAllocator allocator;     // Closed-loop power allocation (optional)
+ChargerShadow shadow;         // Charger configuration mirror (see shadow.h)
+ResponseCache responseCache;  // Cached GET responses (TTLs in command_table.h)
+LinkMetrics linkMetrics;      // BLE latency, error and RSSI metrics
+RttEstimator rttEstimators[TIMEOUT_CLASS_COUNT];    // Learned response timeouts
+LinkProfileState linkProfile; // Connection parameter profile and throughput
+volatile bool pollingActive = false;
+volatile bool pollPending = false;  // Set by dataPollingTimer, polled from loop()
 DeviceInfo deviceInfo;
 
+// Prebuilt frames for polled commands (patched in place on each send)
+FrameTemplate framePortStats = FRAME_GET_ALL_POWER_STATISTICS;
+FrameTemplate frameDeviceModel = FRAME_GET_DEVICE_MODEL;
+FrameTemplate frameDeviceSerial = FRAME_GET_DEVICE_SERIAL_NO;
+FrameTemplate frameApVersion = FRAME_GET_AP_VERSION;
+FrameTemplate frameDeviceUptime = FRAME_GET_DEVICE_UPTIME;
+
 volatile bool responseReceived = false;
-uint8_t responseBuffer[512];
+uint8_t responseBuffer[BLE_RX_BUFFER_SIZE];
 size_t responseLength = 0;
+size_t responseExpected = 0;    // Header + declared payload size of the frame being reassembled
+volatile uint8_t awaitedMsgId = 0;  // Request transmitFrame waits for; other replies are stale
+volatile bool responseAwaited = false;  // transmitFrame is waiting; notifications outside that are stale
+
+// A response copied out of responseBuffer while bleLock is still held.
+// responseBuffer belongs to the next transaction once the lock is
+// released, so callers decode their copy instead.
+struct BleReply {
+    uint8_t frame[BLE_RX_BUFFER_SIZE];
+    size_t length;
+};
+
+PowerCurve powerCurve;          // Last historical power curve fetched
+
+// get_power_curve request, paged in from loop() (one round trip per page)
+volatile bool powerCurvePending = false;
+char powerCurveCmdId[40] = "";
+char powerCurveAction[16] = "";
+uint8_t powerCurvePort = 0;
+
+// Streaming receive: while responseStreaming is set, response payloads
+// bypass responseBuffer and go into debugLogStream, which the loop task
+// drains into MQTT chunks (see streamDebugLog)
+volatile bool responseStreaming = false;
+volatile bool streamFinReceived = false;
+volatile uint32_t streamLastRxMs = 0;
+volatile uint32_t streamDroppedBytes = 0;
+StreamBufferHandle_t debugLogStream = nullptr;
+StaticStreamBuffer_t debugLogStreamStruct;
+uint8_t debugLogStreamStorage[DEBUG_LOG_STREAM_BUFFER + 1];
+
+// get_debug_log is served from loop() so publishing many chunks does not
+// stall the MQTT task that delivered the command
+volatile bool debugLogPending = false;
+char debugLogCmdId[40] = "";
+
+// burst_capture request, also served from loop()
+volatile bool burstPending = false;
+char burstCmdId[40] = "";
+uint32_t burstDurationMs = 0;
+bool burstIncludePd = false;
+uint8_t burstPdPort = 0;
+
+// get_history request, streamed from loop() as well
+volatile bool historyPending = false;
+char historyCmdId[40] = "";
+uint32_t historyFromS = 0;
+uint32_t historyToS = 0;
+uint8_t historyTier = 0;
+
+// Session work handed to loop(): ports whose start event waits for the
+// charger's start timestamp (a BLE round trip), and sessions closed by a
+// disconnect. Bitmasks by port, under sessionMux.
+volatile uint8_t sessionStartPending = 0;
+volatile uint8_t sessionEndPending = 0;
+portMUX_TYPE sessionMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Outgoing frames are assembled here directly from payload segments
+uint8_t txBuffer[BLE_TX_BUFFER_SIZE];
+
+// BLE transaction lock and the read currently in flight (see
+// beginBleTransaction)
+struct InflightRead {
+    bool active;                    // Shareable read in progress
+    uint8_t service;
+    uint8_t keyLen;
+    uint8_t key[RESPONSE_CACHE_KEY_MAX];
+    uint32_t seq;                   // Transaction number
+};
+
+struct BleStats {
+    uint32_t transactions;          // Frames sent to the charger
+    uint32_t coalesced;             // Requests answered by another caller's transaction
+    uint32_t saved;                 // Transactions avoided that way
+    uint32_t stale;                 // Late replies to timed-out requests, discarded
+};
+
+SemaphoreHandle_t bleLock = nullptr;
+SemaphoreHandle_t rulesLock = nullptr;     // ruleEngine: set_rules vs. evaluation in polling
+portMUX_TYPE inflightMux = portMUX_INITIALIZER_UNLOCKED;
+InflightRead inflightRead;
+uint32_t bleTxCounter = 0;
+uint32_t lastBleTxSeq = 0;      // Transaction whose response is in responseBuffer
+bool lastBleTxResult = false;
+BleStats bleStats;
+
+// refresh / get_device_info requests, served together from loop(): all
+// requests that arrive before the fetch completes share it
+struct RefreshRequest {
+    char cmdId[40];
+    char action[16];
+};
+
+volatile bool refreshPending = false;
+RefreshRequest refreshRequests[REFRESH_MAX_WAITERS];
+uint8_t refreshRequestCount = 0;
+portMUX_TYPE refreshMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Pipelined transport (see sendBlePipelined): while responsePipelined is
+// set, notifyCallback queues every completed response frame
+volatile bool responsePipelined = false;
+QueueHandle_t pipelineResponses = nullptr;
+PipelineStats pipelineTotals;
+
+// ble_batch request, sent from loop() so a batch does not hold up the MQTT
+// task; command i is batchServices[i] with batchLens[i] bytes of batchData
+volatile bool batchPending = false;
+char batchCmdId[40] = "";
+uint8_t batchServices[PIPELINE_MAX_BATCH];
+uint16_t batchLens[PIPELINE_MAX_BATCH];
+uint8_t batchData[PIPELINE_BATCH_BYTES];
+uint16_t batchCount = 0;
+uint8_t batchWindow = PIPELINE_WINDOW;
+
+// Charger firmware pass-through (charger_ota), advanced from loop() in
+// slices; the request is handed over through chargerOtaPending
+ChargerOta chargerOta;
+HTTPClient chargerOtaHttp;
+bool chargerOtaStreamOpen = false;
+uint32_t chargerOtaStreamOffset = 0;    // Image offset of the next byte the download delivers
+uint8_t chargerOtaBuffer[CHARGER_OTA_BUFFER];
+volatile bool chargerOtaPending = false;
+volatile bool chargerOtaCancel = false;
+char chargerOtaCmdId[40] = "";
+char chargerOtaUrl[192] = "";
+uint32_t chargerOtaRequestSize = 0;
+uint8_t chargerOtaRequestWindow = CHARGER_OTA_WINDOW;
+bool chargerOtaRequestConfirm = true;
+
+// Pull OTA of the gateway itself (ota_update), also advanced from loop()
+GatewayOta gatewayOta;
+HTTPClient gatewayOtaHttp;
+bool gatewayOtaStreamOpen = false;
+mbedtls_sha256_context gatewayOtaSha;   // Running digest of the bytes written
+uint8_t gatewayOtaBuffer[GATEWAY_OTA_CHUNK];
+volatile bool gatewayOtaPending = false;
+volatile bool gatewayOtaCancel = false;
+char gatewayOtaCmdId[40] = "";
+char gatewayOtaUrl[192] = "";
+uint32_t gatewayOtaRequestSize = 0;
+uint8_t gatewayOtaRequestSha[SHA256_SIZE];
+
+// Link metrics sampling and publishing, driven from loop()
+uint32_t lastRssiSampleMs = 0;
+uint32_t lastMetricsPublishMs = 0;
 
 // Custom MQTT parameters from WiFiManager
 char mqttHost[64] = MQTT_HOST;
@@ -138,67 +328,565 @@ String buildMqttTopic(const char* topic) {
 }
 
 // ============ BLE Notification Callback ============
+// A response larger than one notification arrives as a header fragment
+// followed by raw continuation bytes; they are appended until the size
+// declared in the header is reached, and only then is the response
+// signalled as received
+void streamNotification(const uint8_t* pData, size_t length);
+
 void notifyCallback(NimBLERemoteCharacteristic* pChar, uint8_t* pData, size_t length, bool isNotify) {
-    if (length > 0 && length < sizeof(responseBuffer)) {
-        memcpy(responseBuffer, pData, length);
-        responseLength = length;
+    if (length == 0) return;
+    recordNotification(&linkMetrics, length);
+    addLinkBytes(&linkProfile, length, millis());
+    if (responseStreaming) {
+        streamNotification(pData, length);
+        return;
+    }
+    if (!responseAwaited && !responsePipelined) {
+        // Nobody waits: a late reply must not overwrite the response a
+        // caller is still copying out
+        return;
+    }
+    
+    if (responseLength == 0 || responseLength >= responseExpected) {
+        if (length < FRAME_HEADER_SIZE) return;
+        responseExpected = min((size_t)(FRAME_HEADER_SIZE + framePayloadSize(pData)),
+                               sizeof(responseBuffer));
+        responseLength = 0;
+    }
+    
+    size_t copyLen = min(length, sizeof(responseBuffer) - responseLength);
+    memcpy(responseBuffer + responseLength, pData, copyLen);
+    responseLength += copyLen;
+    
+    if (responseLength >= responseExpected) {
+        if (responsePipelined) {
+            PipelineResponse done = {responseBuffer[1],
+                                     (int8_t)responseBuffer[2] < 0 && responseBuffer[4] != FLAG_RST};
+            xQueueSend(pipelineResponses, &done, 0);
+        } else if (responseBuffer[1] != awaitedMsgId) {
+            // Reply to an earlier request that timed out: drop it so it is
+            // not taken as the answer to the current one
+            bleStats.stale++;
+            responseLength = 0;
+            responseExpected = 0;
+            return;
+        }
+        responseAwaited = false;
         responseReceived = true;
-        
 #if DEBUG_BLE
-        logf("[BLE] Response received: %d bytes", length);
+        logf("[BLE] Response received: %d bytes", responseLength);
 #endif
     }
 }
 
+// Streaming variant: headers are stripped at each frame boundary and the
+// payload bytes pushed to debugLogStream. Nothing is buffered here, so a
+// log of any length passes through in DEBUG_LOG_STREAM_BUFFER of RAM.
+void streamNotification(const uint8_t* pData, size_t length) {
+    size_t offset = 0;
+    if (responseLength >= responseExpected) {
+        if (length < FRAME_HEADER_SIZE) return;
+        responseExpected = FRAME_HEADER_SIZE + framePayloadSize(pData);
+        responseLength = 0;
+        if (pData[4] == FLAG_FIN) streamFinReceived = true;
+        offset = FRAME_HEADER_SIZE;
+    }
+    responseLength += length;
+    
+    size_t sent = xStreamBufferSend(debugLogStream, pData + offset, length - offset, 0);
+    streamDroppedBytes += (length - offset) - sent;
+    streamLastRxMs = millis();
+    responseReceived = true;
+}
+
 // ============ BLE Command Sender ============
-bool sendBleCommand(uint8_t service, const uint8_t* payload = nullptr, size_t payloadLen = 0, 
-                    bool useToken = true, uint32_t timeout = 3000) {
+// Writes a frame in one ATT write when it fits. Longer frames are split
+// into fragments that each carry their own header: same msgId and
+// service, sequence = fragment index, FLAG_FRAG_FIRST/MORE/LAST, and the
+// size of that fragment's payload (see ble_manager.py's send_command).
+// Each fragment header is written over the 9 bytes in front of its slice
+// of the frame, which are put back after the write, so the payload is
+// never copied; frame is unchanged on return.
+bool writeFragmented(uint8_t* frame, size_t frameLen) {
+    size_t writeSize = bleMtu - BLE_ATT_HEADER_SIZE;
+    if (frameLen <= writeSize) {
+        if (!pRxChar->writeValue(frame, frameLen, false)) return false;
+        addLinkBytes(&linkProfile, frameLen, millis());
+        return true;
+    }
+    
+    uint8_t version = frame[0];
+    uint8_t id = frame[1];
+    uint8_t service = frame[2];
+    size_t payloadLen = frameLen - FRAME_HEADER_SIZE;
+    size_t piece = writeSize - FRAME_HEADER_SIZE;
+    size_t count = (payloadLen + piece - 1) / piece;
+    if (count > 256) return false;
+    
+    uint8_t saved[FRAME_HEADER_SIZE];
+    size_t written = 0;
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; i++) {
+        size_t offset = i * piece;
+        size_t len = min(piece, payloadLen - offset);
+        uint8_t flags = i == 0 ? FLAG_FRAG_FIRST : i + 1 == count ? FLAG_FRAG_LAST : FLAG_FRAG_MORE;
+        uint8_t* fragment = frame + offset;
+        memcpy(saved, fragment, FRAME_HEADER_SIZE);
+        writeFrameHeader(fragment, version, id, service, (uint8_t)i, flags, len);
+        ok = pRxChar->writeValue(fragment, FRAME_HEADER_SIZE + len, false);
+        memcpy(fragment, saved, FRAME_HEADER_SIZE);
+        if (ok) written += FRAME_HEADER_SIZE + len;
+    }
+    addLinkBytes(&linkProfile, written, millis());
+    return ok;
+}
+
+// Writes a complete frame and blocks until the response notification
+// arrives or the timeout expires. A timeout of 0 uses the one learned for
+// the command's class; round trips feed that estimate either way.
+bool transmitFrame(uint8_t* frame, size_t frameLen, const CommandDescriptor& desc,
+                   uint32_t timeout) {
+    RttEstimator& rtt = rttEstimators[commandTimeoutClass(desc)];
+    bool adaptive = timeout == 0;
+    if (adaptive) timeout = rttTimeout(rtt, desc.timeoutMs);
+    
+    responseReceived = false;
+    responseLength = 0;
+    responseExpected = 0;
+    awaitedMsgId = frame[1];
+    responseAwaited = true;
+    
+#if DEBUG_BLE
+    logf("[BLE] -> %s (%u bytes)", desc.name, frameLen);
+#endif
+    
+    uint8_t service = frame[2];
+    if (!writeFragmented(frame, frameLen)) {
+        responseAwaited = false;
+        logf("[BLE] Write failed: %s", desc.name);
+        recordWriteError(&linkMetrics, service);
+        return false;
+    }
+    
+    uint32_t startTime = millis();
+    while (!responseReceived && (millis() - startTime) < timeout) {
+        delay(RTO_GRANULARITY_MS);
+    }
+    responseAwaited = false;
+    
+    if (responseReceived) {
+        uint32_t rttMs = millis() - startTime;
+        recordLatency(&linkMetrics, service, rttMs);
+        rttSample(&rtt, rttMs);
+    } else {
+        recordTimeout(&linkMetrics, service);
+        if (adaptive) rttBackoff(&rtt);
+#if DEBUG_BLE
+        logf("[BLE] %s timed out after %u ms", desc.name, timeout);
+#endif
+    }
+    return responseReceived;
+}
+
+// ============ BLE Transactions ============
+// bleLock serializes transactions (frame building, write and wait for the
+// response) between the MQTT task and loop(), which also runs the polling.
+// A read identical to the one in flight (same service and payload) waits
+// for it and takes its response from responseBuffer instead of sending
+// again.
+// Responses leave responseBuffer only as a BleReply copied before the
+// lock is released.
+
+// Copies the response of the transaction just ended into reply (if any);
+// bleLock must be held
+void copyBleReply(bool result, BleReply* reply) {
+    if (reply == nullptr) return;
+    reply->length = result ? min(responseLength, sizeof(reply->frame)) : 0;
+    if (reply->length > 0) memcpy(reply->frame, responseBuffer, reply->length);
+}
+
+// Takes bleLock for one transaction. Returns true when the caller must
+// send and then call endBleTransaction(); false when a shareable read was
+// answered by the identical one in flight (outcome in *result, response
+// in reply, lock already released).
+bool beginBleTransaction(uint8_t service, const uint8_t* key, size_t keyLen, bool shareable, bool* result,
+                         BleReply* reply) {
+    shareable = shareable && !responseStreaming;
+    
+    uint32_t joinSeq = 0;
+    if (shareable) {
+        portENTER_CRITICAL(&inflightMux);
+        if (inflightRead.active && inflightRead.service == service && inflightRead.keyLen == keyLen &&
+            (keyLen == 0 || memcmp(inflightRead.key, key, keyLen) == 0)) {
+            joinSeq = inflightRead.seq;
+        }
+        portEXIT_CRITICAL(&inflightMux);
+    }
+    
+    xSemaphoreTake(bleLock, portMAX_DELAY);
+    
+    // The response is still in responseBuffer only if nothing else was
+    // sent after the transaction joined
+    if (joinSeq != 0 && lastBleTxSeq == joinSeq) {
+        *result = lastBleTxResult;
+        copyBleReply(*result, reply);
+        bleStats.coalesced++;
+        bleStats.saved++;
+        xSemaphoreGive(bleLock);
+        return false;
+    }
+    
+    portENTER_CRITICAL(&inflightMux);
+    inflightRead.active = shareable;
+    inflightRead.service = service;
+    inflightRead.keyLen = keyLen;
+    if (keyLen > 0) memcpy(inflightRead.key, key, keyLen);
+    inflightRead.seq = ++bleTxCounter;
+    portEXIT_CRITICAL(&inflightMux);
+    return true;
+}
+
+// Ends the transaction begun last, copying its response into reply; sent
+// is false when it was answered without reaching the charger (cache hit,
+// invalid request)
+void endBleTransaction(bool result, bool sent, BleReply* reply) {
+    copyBleReply(result, reply);
+    
+    portENTER_CRITICAL(&inflightMux);
+    inflightRead.active = false;
+    portEXIT_CRITICAL(&inflightMux);
+    
+    lastBleTxSeq = inflightRead.seq;
+    lastBleTxResult = result;
+    if (sent) bleStats.transactions++;
+    xSemaphoreGive(bleLock);
+}
+
+// Builds header + token + segments straight into txBuffer with the next
+// msgId; returns the frame length, 0 if it does not fit or has more
+// segments than the frame can gather
+size_t buildCommandFrame(uint8_t service, const CommandDescriptor& desc,
+                         const PayloadSegment* segments, size_t segmentCount) {
+    PayloadSegment frameSegments[8];
+    size_t frameSegmentCount = 0;
+    if (desc.needsToken) {
+        frameSegments[frameSegmentCount++] = {&currentToken, 1};
+    }
+    if (frameSegmentCount + segmentCount > sizeof(frameSegments) / sizeof(frameSegments[0])) {
+        return 0;
+    }
+    for (size_t i = 0; i < segmentCount; i++) {
+        frameSegments[frameSegmentCount++] = segments[i];
+    }
+    
+    msgId = (msgId + 1) & 0xFF;
+    return buildMessageSegments(txBuffer, sizeof(txBuffer),
+                                0, msgId, service, 0, FLAG_ACK,
+                                frameSegments, frameSegmentCount);
+}
+
+// Token requirement, payload size and timeout ceiling come from the
+// command descriptor table; pass timeout to override the learned timeout.
+// The response, when the caller needs it, comes back in reply.
+bool sendBleCommandSegments(uint8_t service, const PayloadSegment* segments, size_t segmentCount,
+                            BleReply* reply = nullptr, uint32_t timeout = 0) {
     if (!bleConnected || pRxChar == nullptr) return false;
     
-    uint8_t cmdPayload[256];
-    size_t cmdPayloadLen = 0;
+    const CommandDescriptor& desc = commandDescriptor(service);
+    size_t payloadLen = 0;
+    for (size_t i = 0; i < segmentCount; i++) {
+        payloadLen += segments[i].len;
+    }
+    if (desc.requestSize != CMD_REQ_VARIABLE && payloadLen != desc.requestSize) {
+        logf("[BLE] %s expects %u payload bytes, got %u", desc.name, desc.requestSize, payloadLen);
+        return false;
+    }
+    
+    // Cache and coalescing key: the request payload without the token
+    uint8_t key[RESPONSE_CACHE_KEY_MAX];
+    size_t keyLen = 0;
+    bool keyed = payloadLen <= sizeof(key);
+    for (size_t i = 0; keyed && i < segmentCount; i++) {
+        if (segments[i].len == 0) continue;
+        memcpy(key + keyLen, segments[i].data, segments[i].len);
+        keyLen += segments[i].len;
+    }
+    
+    bool result;
+    if (!beginBleTransaction(service, key, keyLen, keyed && commandIsRead(desc), &result, reply)) {
+        return result;
+    }
     
-    if (useToken) {
-        cmdPayload[0] = currentToken;
-        cmdPayloadLen = 1;
-        if (payload != nullptr && payloadLen > 0) {
-            memcpy(cmdPayload + 1, payload, payloadLen);
-            cmdPayloadLen += payloadLen;
+    bool cacheable = desc.cacheTtlMs > 0 && keyed;
+    if (cacheable) {
+        size_t cachedLen;
+        const uint8_t* cached = cacheLookup(&responseCache, service, key, keyLen, millis(), &cachedLen);
+        if (cached != nullptr) {
+            memcpy(responseBuffer, cached, cachedLen);
+            responseLength = cachedLen;
+            responseExpected = cachedLen;
+            endBleTransaction(true, false, reply);
+            return true;
         }
-    } else if (payload != nullptr && payloadLen > 0) {
-        memcpy(cmdPayload, payload, payloadLen);
-        cmdPayloadLen = payloadLen;
+    } else if (desc.cacheTtlMs == 0 && desc.cacheGroup != CACHE_NONE) {
+        // A write: whatever it changes must be read again
+        cacheInvalidate(&responseCache, desc.cacheGroup);
+    }
+    // So must the shadow after a write that did not come through it
+    // (ble_command, rule actions); writeShadowSlot stores its slot again
+    if (!commandIsRead(desc)) shadowInvalidate(&shadow);
+    
+    size_t msgLen = buildCommandFrame(service, desc, segments, segmentCount);
+    if (msgLen == 0) {
+        logf("[BLE] %s frame not built (%u bytes, %u segments)", desc.name, payloadLen, (unsigned)segmentCount);
+        endBleTransaction(false, false, reply);
+        return false;
+    }
+    
+    bool received = transmitFrame(txBuffer, msgLen, desc, timeout);
+    BLEResponse resp;
+    if (received && cacheable && parseResponse(responseBuffer, responseLength, &resp) && resp.success) {
+        cacheStore(&responseCache, service, key, keyLen, responseBuffer, responseLength, millis());
     }
+    endBleTransaction(received, true, reply);
+    return received;
+}
+
+bool sendBleCommand(uint8_t service, const uint8_t* payload = nullptr, size_t payloadLen = 0,
+                    BleReply* reply = nullptr, uint32_t timeout = 0) {
+    PayloadSegment segment = {payload, payload != nullptr ? payloadLen : 0};
+    return sendBleCommandSegments(service, &segment, 1, reply, timeout);
+}
+
+// Hot-path variant for fixed commands: patches msgId/token into a
+// prebuilt template and writes it as-is
+bool sendBleFrame(FrameTemplate& frame, BleReply* reply = nullptr, uint32_t timeout = 0) {
+    if (!bleConnected || pRxChar == nullptr) return false;
+    
+    uint8_t service = frame.bytes[2];
+    const CommandDescriptor& desc = commandDescriptor(service);
+    bool result;
+    if (!beginBleTransaction(service, nullptr, 0, commandIsRead(desc), &result, reply)) return result;
     
-    uint8_t message[280];
     msgId = (msgId + 1) & 0xFF;
+    patchFrameTemplate(frame, msgId, currentToken);
+    
+    result = transmitFrame(frame.bytes, frame.length, desc, timeout);
+    endBleTransaction(result, true, reply);
+    return result;
+}
+
+// ============ Pipelined Transport ============
+struct PipelineRequest {
+    uint8_t service;
+    const uint8_t* payload;
+    size_t len;
+};
+
+// Sends a batch of commands with up to window of them awaiting a response
+// (see pipeline.h); results[i] is set when request i was acknowledged.
+// Responses are only checked for success, so batches are meant for writes
+// (configuration, OTA data). Dropped requests are resent up to
+// PIPELINE_MAX_ATTEMPTS times, possibly after later ones, if the command
+// table marks them idempotent; any other dropped request has failed.
+bool sendBlePipelined(const PipelineRequest* requests, uint16_t count, bool* results, uint8_t window,
+                      PipelineStats* stats = nullptr) {
+    if (!bleConnected || pRxChar == nullptr || count == 0) return false;
+    
+    // Validate the whole batch before anything is sent; the longest
+    // learned timeout of its commands applies to each of them
+    uint32_t timeout = 0;
+    bool writes = false;
+    for (uint16_t i = 0; i < count; i++) {
+        const CommandDescriptor& desc = commandDescriptor(requests[i].service);
+        if (desc.requestSize != CMD_REQ_VARIABLE && requests[i].len != desc.requestSize) {
+            logf("[BLE] %s expects %u payload bytes, got %u", desc.name, desc.requestSize, requests[i].len);
+            return false;
+        }
+        timeout = max(timeout, rttTimeout(rttEstimators[commandTimeoutClass(desc)], desc.timeoutMs));
+        writes = writes || !commandIsRead(desc);
+        results[i] = false;
+    }
     
-    size_t msgLen = buildMessage(message, sizeof(message), 
-                                  0, msgId, service, 0, FLAG_ACK,
-                                  cmdPayload, cmdPayloadLen);
+    bool unused;
+    beginBleTransaction(requests[0].service, nullptr, 0, false, &unused, nullptr);
+    for (uint16_t i = 0; i < count; i++) {
+        const CommandDescriptor& desc = commandDescriptor(requests[i].service);
+        if (desc.cacheTtlMs == 0 && desc.cacheGroup != CACHE_NONE) cacheInvalidate(&responseCache, desc.cacheGroup);
+    }
+    // Batched writes bypass the shadow; its slots are read again before use
+    if (writes) shadowInvalidate(&shadow);
     
-    if (msgLen == 0) return false;
+    Pipeline pipe;
+    initPipeline(&pipe, window, millis());
+    PipelineSlot retries[PIPELINE_MAX_WINDOW];
+    uint8_t retryCount = 0;
+    uint16_t next = 0;
+    uint16_t done = 0;
+    bool allOk = true;
     
-    responseReceived = false;
+    xQueueReset(pipelineResponses);
     responseLength = 0;
+    responseExpected = 0;
+    responsePipelined = true;
     
-    if (!pRxChar->writeValue(message, msgLen, false)) {
-        log("[BLE] Write failed");
-        return false;
+    while (done < count && bleConnected) {
+        // Spend the credits: dropped requests first, then new ones
+        while (pipelineCredits(pipe) > 0 && (retryCount > 0 || next < count)) {
+            uint16_t req;
+            uint8_t attempts = 1;
+            if (retryCount > 0) {
+                req = retries[0].request;
+                attempts = retries[0].attempts + 1;
+                memmove(retries, retries + 1, --retryCount * sizeof(PipelineSlot));
+            } else {
+                req = next++;
+            }
+            
+            const PipelineRequest& request = requests[req];
+            PayloadSegment segment = {request.payload, request.len};
+            size_t frameLen = buildCommandFrame(request.service, commandDescriptor(request.service), &segment, 1);
+            if (frameLen == 0 || !writeFragmented(txBuffer, frameLen)) {
+                recordWriteError(&linkMetrics, request.service);
+                allOk = false;
+                done++;
+                continue;
+            }
+            pipelineSent(&pipe, msgId, req, attempts, millis());
+            bleStats.transactions++;
+        }
+        
+        PipelineResponse response;
+        PipelineSlot slot;
+        if (xQueueReceive(pipelineResponses, &response, pdMS_TO_TICKS(RTO_GRANULARITY_MS)) == pdTRUE) {
+            if (pipelineComplete(&pipe, response.msgId, response.ok, millis(), &slot)) {
+                uint8_t service = requests[slot.request].service;
+                uint32_t rttMs = millis() - slot.sentMs;
+                recordLatency(&linkMetrics, service, rttMs);
+                // Round trips of pipelined requests include queueing at the
+                // charger; only stop-and-wait ones are clean RTT samples
+                if (pipe.stopAndWait) {
+                    rttSample(&rttEstimators[commandTimeoutClass(commandDescriptor(service))], rttMs);
+                }
+                results[slot.request] = response.ok;
+                allOk = allOk && response.ok;
+                done++;
+            }
+        } else if (pipelineExpire(&pipe, timeout, millis(), &slot)) {
+            uint8_t service = requests[slot.request].service;
+            recordTimeout(&linkMetrics, service);
+            if (slot.attempts < PIPELINE_MAX_ATTEMPTS && commandIsIdempotent(commandDescriptor(service))) {
+                retries[retryCount++] = slot;
+            } else {
+                allOk = false;
+                done++;
+            }
+        }
     }
     
-    uint32_t startTime = millis();
-    while (!responseReceived && (millis() - startTime) < timeout) {
-        delay(10);
+    responsePipelined = false;
+    if (pipe.stats.fallbacks > 0) {
+        logf("[BLE] Batch fell back to stop-and-wait (%u NAK, %u dropped, %u unmatched)",
+             pipe.stats.naks, pipe.stats.drops, pipe.stats.mismatches);
     }
     
-    return responseReceived;
+    pipelineTotals.sent += pipe.stats.sent;
+    pipelineTotals.completed += pipe.stats.completed;
+    pipelineTotals.naks += pipe.stats.naks;
+    pipelineTotals.drops += pipe.stats.drops;
+    pipelineTotals.mismatches += pipe.stats.mismatches;
+    pipelineTotals.late += pipe.stats.late;
+    pipelineTotals.fallbacks += pipe.stats.fallbacks;
+    if (stats != nullptr) *stats = pipe.stats;
+    
+    // Frames were counted as they went out
+    allOk = allOk && done == count;
+    endBleTransaction(allOk, false, nullptr);
+    return allOk;
+}
+
+void writePipelineStatsJson(const PipelineStats& stats, JsonObject out) {
+    out["sent"] = stats.sent;
+    out["completed"] = stats.completed;
+    out["naks"] = stats.naks;
+    out["drops"] = stats.drops;
+    out["mismatches"] = stats.mismatches;
+    out["late"] = stats.late;
+    out["fallbacks"] = stats.fallbacks;
+}
+
+// ============ Connection Profiles ============
+// Requests the connection parameters of a profile; the charger may adjust
+// them, getConnInfo() has what was agreed
+void applyLinkProfile(uint8_t profile) {
+    if (!bleConnected || pBleClient == nullptr || profile == linkProfile.current) return;
+    
+    const ConnParams& params = linkProfileParams(profile);
+    pBleClient->updateConnParams(params.minInterval, params.maxInterval, params.latency, params.timeout);
+    setLinkProfile(&linkProfile, profile, millis());
+#if DEBUG_BLE
+    logf("[BLE] Link profile: %s", getLinkProfileName(profile));
+#endif
+}
+
+void updateLinkProfile() {
+    addLinkBytes(&linkProfile, 0, millis());
+    bool ota = otaInProgress || gatewayOtaActive(gatewayOta);
+    applyLinkProfile(chooseLinkProfile(linkProfile, pollScheduler.intervalMs, ota, millis()));
+}
+
+// A command from the server: switch to burst before its BLE requests go out
+void noteLinkActivity() {
+    uint32_t now = millis();
+    linkProfile.lastActivityMs = now ? now : 1;
+    updateLinkProfile();
+}
+
+// Keeps the link in burst for a transfer (burst capture, log streaming)
+void setLinkHold(bool hold) {
+    if (hold) {
+        linkProfile.holds++;
+    } else if (linkProfile.holds > 0) {
+        linkProfile.holds--;
+    }
+    updateLinkProfile();
+}
+
+void writeLinkProfileJson(JsonObject out) {
+    out["profile"] = getLinkProfileName(linkProfile.current);
+    out["pinned"] = getLinkProfileName(linkProfile.pinned);
+    out["switches"] = linkProfile.switches;
+    out["throughput_bps"] = linkProfile.lastBps;
+    JsonObject peak = out.createNestedObject("peak_bps");
+    for (uint8_t i = 0; i < LINK_PROFILE_COUNT; i++) {
+        peak[getLinkProfileName(i)] = linkProfile.peakBps[i];
+    }
+    
+    const ConnParams& params = linkProfileParams(linkProfile.current);
+    JsonObject requested = out.createNestedObject("requested");
+    requested["interval_min_ms"] = params.minInterval * 1.25f;
+    requested["interval_max_ms"] = params.maxInterval * 1.25f;
+    requested["latency"] = params.latency;
+    requested["timeout_ms"] = params.timeout * 10;
+    
+    if (bleConnected && pBleClient != nullptr) {
+        NimBLEConnInfo info = pBleClient->getConnInfo();
+        JsonObject actual = out.createNestedObject("actual");
+        actual["interval_ms"] = info.getConnInterval() * 1.25f;
+        actual["latency"] = info.getConnLatency();
+        actual["timeout_ms"] = info.getConnTimeout() * 10;
+    }
 }
 
 // ============ Token Bruteforce ============
 bool bruteforceToken() {
     log("[TOKEN] Starting bruteforce...");
     
+    // Silence is the expected answer to a wrong token, so the test timeout
+    // follows the learned read RTO without backing it off
+    uint32_t testTimeout = rttTimeout(rttEstimators[TIMEOUT_CLASS_READ], TOKEN_TEST_TIMEOUT);
+    
     for (int token = 0; token < 256; token++) {
         if (token % 32 == 0) {
             logf("[TOKEN] Testing 0x%02X - 0x%02X", token, min(token + 31, 255));
@@ -206,9 +894,10 @@ bool bruteforceToken() {
         
         currentToken = token;
         
-        if (sendBleCommand(CMD_GET_DEVICE_MODEL, nullptr, 0, true, TOKEN_TEST_TIMEOUT)) {
+        BleReply reply;
+        if (sendBleCommand(CMD_GET_DEVICE_MODEL, nullptr, 0, &reply, testTimeout)) {
             BLEResponse resp;
-            if (parseResponse(responseBuffer, responseLength, &resp)) {
+            if (parseResponse(reply.frame, reply.length, &resp)) {
                 if (resp.service < 0 && resp.payloadLen > 0) {
                     logf("[TOKEN] Found token: 0x%02X (%d)", token, token);
                     // Save token to preferences
@@ -226,52 +915,111 @@ bool bruteforceToken() {
 }
 
 // ============ Data Fetching ============
-void fetchPortData() {
-    if (!bleConnected) return;
+bool fetchPortData() {
+    if (!bleConnected) return false;
     
-    if (sendBleCommand(CMD_GET_ALL_POWER_STATISTICS)) {
+    BleReply reply;
+    if (sendBleFrame(framePortStats, &reply)) {
         BLEResponse resp;
-        if (parseResponse(responseBuffer, responseLength, &resp)) {
+        if (parseResponse(reply.frame, reply.length, &resp)) {
             if (resp.success && resp.payloadLen > 0) {
-                parsePortStatistics(resp.payload, resp.payloadLen, portData, 5);
+                int count = parsePortStatistics(resp.payload, resp.payloadLen, portData, CP02_PORT_COUNT);
+                captureSnapshot(portData, count, millis(), &portSnapshot);
+                integrateSnapshot(&energy, portSnapshot);
+                recordHistory(&historyRings, portSnapshot);
+                return true;
             }
         }
     }
+    return false;
+}
+
+// Pages a port's history into powerCurve. Each request carries
+// [port, offset LE] and the response echoes the offset it starts at;
+// paging stops on an empty page, a full curve, or a page that does not
+// start where it was asked to. Returns the number of pages fetched.
+int fetchPowerCurve(uint8_t portId) {
+    resetPowerCurve(&powerCurve, portId, millis());
+    if (!bleConnected) return 0;
+    
+    BleReply reply;
+    uint16_t offset = 0;
+    int pages = 0;
+    while (pages < HISTORY_MAX_PAGES && powerCurve.count < HISTORY_MAX_SAMPLES) {
+        uint8_t request[] = {portId, (uint8_t)(offset & 0xFF), (uint8_t)(offset >> 8)};
+        if (!sendBleCommand(CMD_GET_POWER_HISTORICAL_STATS, request, sizeof(request), &reply)) break;
+        
+        BLEResponse resp;
+        PowerHistoryView view;
+        if (!parseResponse(reply.frame, reply.length, &resp) || !resp.success ||
+            !decodePowerHistory(resp.payload, resp.payloadLen, &view)) break;
+        if (pages > 0 && view.offset() != offset) break;
+        
+        uint16_t count = view.count();
+        if (pages == 0) powerCurve.startOffset = view.offset();
+        pages++;
+        
+        for (uint16_t i = 0; i < count; i++) {
+            if (!appendCurveSample(&powerCurve, view.currentRaw(i), view.voltageRaw(i))) break;
+        }
+        if (count == 0) break;
+        offset = view.offset() + count;
+    }
+    
+#if DEBUG_BLE
+    logf("[BLE] Port %d history: %d samples in %d pages", portId, powerCurve.count, pages);
+#endif
+    return pages;
+}
+
+// The charger's own start time of a port's current session (Unix
+// seconds), or 0 if it does not report one
+uint32_t fetchChargeStartTimestamp(uint8_t portId) {
+    uint8_t request[] = {portId};
+    BleReply reply;
+    if (!sendBleCommand(CMD_GET_START_CHARGE_TIMESTAMP, request, sizeof(request), &reply)) return 0;
+    
+    BLEResponse resp;
+    StartChargeTimestampView view;
+    if (!parseResponse(reply.frame, reply.length, &resp) || !resp.success ||
+        !decodeStartChargeTimestamp(resp.payload, resp.payloadLen, &view)) return 0;
+    return view.timestamp();
 }
 
 void fetchDeviceInfo() {
     if (!bleConnected) return;
     
-    if (sendBleCommand(CMD_GET_DEVICE_MODEL)) {
+    BleReply reply;
+    if (sendBleFrame(frameDeviceModel, &reply)) {
         BLEResponse resp;
-        if (parseResponse(responseBuffer, responseLength, &resp)) {
+        if (parseResponse(reply.frame, reply.length, &resp)) {
             if (resp.success) {
                 parseDeviceModel(resp.payload, resp.payloadLen, deviceInfo.model, sizeof(deviceInfo.model));
             }
         }
     }
     
-    if (sendBleCommand(CMD_GET_DEVICE_SERIAL_NO)) {
+    if (sendBleFrame(frameDeviceSerial, &reply)) {
         BLEResponse resp;
-        if (parseResponse(responseBuffer, responseLength, &resp)) {
+        if (parseResponse(reply.frame, reply.length, &resp)) {
             if (resp.success) {
                 parseDeviceSerial(resp.payload, resp.payloadLen, deviceInfo.serial, sizeof(deviceInfo.serial));
             }
         }
     }
     
-    if (sendBleCommand(CMD_GET_AP_VERSION)) {
+    if (sendBleFrame(frameApVersion, &reply)) {
         BLEResponse resp;
-        if (parseResponse(responseBuffer, responseLength, &resp)) {
+        if (parseResponse(reply.frame, reply.length, &resp)) {
             if (resp.success) {
                 parseFirmwareVersion(resp.payload, resp.payloadLen, deviceInfo.firmware, sizeof(deviceInfo.firmware));
             }
         }
     }
     
-    if (sendBleCommand(CMD_GET_DEVICE_UPTIME)) {
+    if (sendBleFrame(frameDeviceUptime, &reply)) {
         BLEResponse resp;
-        if (parseResponse(responseBuffer, responseLength, &resp)) {
+        if (parseResponse(reply.frame, reply.length, &resp)) {
             if (resp.success) {
                 parseDeviceUptime(resp.payload, resp.payloadLen, &deviceInfo.uptime);
             }
@@ -279,39 +1027,62 @@ void fetchDeviceInfo() {
     }
 }
 
+// The MTU was exchanged during connect (NimBLEDevice::setMTU in setup());
+// the charger's own figure from GET_BLE_MTU is authoritative when it is
+// lower, since a write longer than it accepts would be rejected
+void negotiateMtu() {
+    uint16_t exchanged = pBleClient ? pBleClient->getMTU() : BLE_ATT_MTU_DEFAULT;
+    bleMtu = max(exchanged, (uint16_t)BLE_ATT_MTU_DEFAULT);
+    chargerMtu = 0;
+    
+    BleReply reply;
+    BLEResponse resp;
+    if (sendBleCommand(CMD_GET_BLE_MTU, nullptr, 0, &reply) && parseResponse(reply.frame, reply.length, &resp) &&
+        resp.success && resp.payloadLen > 0) {
+        uint16_t reported = resp.payloadLen >= 2 ? resp.payload[0] | (resp.payload[1] << 8) : resp.payload[0];
+        if (reported >= BLE_ATT_MTU_DEFAULT && reported <= BLE_ATT_MTU_MAX) {
+            chargerMtu = reported;
+            bleMtu = min(bleMtu, chargerMtu);
+        }
+    }
+    
+    logf("[BLE] ATT MTU %u (exchanged %u, charger %u)", bleMtu, exchanged, chargerMtu);
+    if (bleMtu == BLE_ATT_MTU_DEFAULT) {
+        log("[BLE] MTU exchange not accepted, frames over 20 bytes are fragmented");
+    }
+}
+
 // ============ MQTT Publishing ============
 void publishPortData() {
     if (!mqttConnected) return;
     
-    StaticJsonDocument<1024> doc;
+    StaticJsonDocument<1536> doc;
     doc["gateway_id"] = gatewayId;
     doc["charger_name"] = chargerDeviceName;
     doc["charger_addr"] = chargerAddress;
     doc["timestamp"] = millis();
     
     JsonArray ports = doc.createNestedArray("ports");
-    float totalPower = 0;
-    int activePorts = 0;
+    const PortSnapshot& snap = portSnapshot;
     
-    for (int i = 0; i < 5; i++) {
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
         JsonObject port = ports.createNestedObject();
-        port["port_id"] = portData[i].portId;
-        port["protocol"] = portData[i].protocol;
-        port["protocol_name"] = getProtocolName(portData[i].protocol);
-        port["voltage"] = round(portData[i].voltage * 100) / 100.0;
-        port["current"] = round(portData[i].current * 1000) / 1000.0;
-        port["power"] = round(portData[i].power * 100) / 100.0;
-        port["temperature"] = portData[i].temperature;
-        port["charging"] = portData[i].charging;
-        
-        totalPower += portData[i].power;
-        if (portData[i].charging) activePorts++;
+        port["port_id"] = i;
+        port["protocol"] = snap.protocol[i];
+        port["protocol_name"] = getProtocolName(snap.protocol[i]);
+        port["voltage"] = milliToUnit(snap.voltageMv[i], 2);
+        port["current"] = milliToUnit(snap.currentMa[i], 3);
+        port["power"] = milliToUnit(snap.powerMw[i], 2);
+        port["temperature"] = snap.temperature[i];
+        port["charging"] = (bool)(snap.chargingMask & (1 << i));
+        port["battery_last_full"] = snap.batteryLastFull[i];
+        port["battery_present"] = snap.batteryPresent[i];
     }
     
-    doc["total_power"] = round(totalPower * 100) / 100.0;
-    doc["active_ports"] = activePorts;
+    doc["total_power"] = milliToUnit(snapshotTotalPowerMw(snap), 2);
+    doc["active_ports"] = snapshotActivePorts(snap);
     
-    char payload[1024];
+    char payload[1536];
     serializeJson(doc, payload, sizeof(payload));
     
     String topic = buildMqttTopic(MQTT_TOPIC_PORTS);
@@ -334,6 +1105,8 @@ void publishDeviceInfo() {
     doc["serial"] = deviceInfo.serial;
     doc["firmware"] = deviceInfo.firmware;
     doc["uptime"] = deviceInfo.uptime;
+    doc["mtu"] = bleMtu;
+    if (chargerMtu != 0) doc["charger_mtu"] = chargerMtu;
     doc["timestamp"] = millis();
     
     char payload[512];
@@ -346,7 +1119,7 @@ void publishDeviceInfo() {
 void publishHeartbeat() {
     if (!mqttConnected) return;
     
-    StaticJsonDocument<256> doc;
+    StaticJsonDocument<512> doc;
     doc["gateway_id"] = gatewayId;
     doc["gateway_version"] = DEVICE_VERSION;
     doc["wifi_rssi"] = WiFi.RSSI();
@@ -355,30 +1128,1670 @@ void publishHeartbeat() {
     doc["free_heap"] = ESP.getFreeHeap();
     doc["uptime"] = millis() / 1000;
     doc["connected"] = bleConnected;  // Important for timeout detection
+    doc["poll_interval_ms"] = pollScheduler.intervalMs;
+    doc["cache_hit_rate"] = cacheHitRate(responseCache.stats);
+    doc["ble_transactions"] = bleStats.transactions;
+    doc["ble_saved"] = bleStats.saved;
+    doc["link_profile"] = getLinkProfileName(linkProfile.current);
+    
+    char payload[512];
+    serializeJson(doc, payload, sizeof(payload));
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_HEARTBEAT);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_TELEMETRY, false, payload);
+}
+
+void writeCacheStatsJson(JsonObject out) {
+    const CacheStats& stats = responseCache.stats;
+    uint8_t entries = 0;
+    for (const CacheEntry& entry : responseCache.entries) {
+        if (entry.used) entries++;
+    }
+    out["hits"] = stats.hits;
+    out["misses"] = stats.misses;
+    out["hit_rate"] = cacheHitRate(stats);
+    out["stores"] = stats.stores;
+    out["evictions"] = stats.evictions;
+    out["invalidations"] = stats.invalidations;
+    out["entries"] = entries;
+    out["capacity"] = RESPONSE_CACHE_ENTRIES;
+}
+
+void publishStatus(const char* status, const char* message = nullptr) {
+    if (!mqttConnected) return;
+    
+    StaticJsonDocument<256> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["status"] = status;
+    if (message) doc["message"] = message;
+    doc["ble_connected"] = bleConnected;
+    doc["charger_name"] = chargerDeviceName;
+    doc["timestamp"] = millis();
+    
+    char payload[256];
+    serializeJson(doc, payload, sizeof(payload));
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_STATUS);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_STATUS, true, payload);
+}
+
+// Publishes the current aggregate window: per-port energy (mJ) with
+// min/max/average power, plus gateway totals. Average power is energy
+// over covered time, not a mean of the samples.
+void publishAggregate() {
+    const EnergyWindow& window = energy.window;
+    if (!mqttConnected || window.samples == 0) return;
+    
+    StaticJsonDocument<1024> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["start_ms"] = window.startMs;
+    doc["duration_ms"] = millis() - window.startMs;
+    doc["covered_ms"] = window.coveredMs;
+    doc["samples"] = window.samples;
+    
+    uint64_t totalUj = 0;
+    JsonArray ports = doc.createNestedArray("ports");
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        JsonObject port = ports.createNestedObject();
+        port["port_id"] = i;
+        port["energy_mj"] = (uint32_t)(window.energyUj[i] / 1000);
+        port["min_power"] = milliToUnit(window.minPowerMw[i], 2);
+        port["max_power"] = milliToUnit(window.maxPowerMw[i], 2);
+        port["avg_power"] = milliToUnit(windowAvgPowerMw(window, window.energyUj[i]), 2);
+        port["lifetime_wh"] = milliToUnit((uint32_t)(energy.lifetimeUj[i] / 3600000), 3);
+        totalUj += window.energyUj[i];
+    }
+    doc["energy_mj"] = (uint32_t)(totalUj / 1000);
+    doc["min_power"] = milliToUnit(window.minTotalMw, 2);
+    doc["max_power"] = milliToUnit(window.maxTotalMw, 2);
+    doc["avg_power"] = milliToUnit(windowAvgPowerMw(window, totalUj), 2);
+    
+    char payload[1024];
+    serializeJson(doc, payload, sizeof(payload));
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_AGGREGATE);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_STATUS, false, payload);
+}
+
+void writeSessionRecordJson(const SessionRecord& record, JsonObject out) {
+    out["port_id"] = record.portId;
+    out["reason"] = getSessionEndReasonName(record.endReason);
+    out["start_ms"] = record.startMs;
+    out["duration_s"] = record.durationMs / 1000;
+    out["energy_wh"] = milliToUnit(record.energyMwh, 3);
+    out["peak_power"] = milliToUnit(record.peakPowerMw, 2);
+    out["start_protocol"] = getProtocolName(record.startProtocol);
+    out["end_protocol"] = getProtocolName(record.endProtocol);
+    out["protocol_changes"] = record.protocolChanges;
+    out["tapered"] = (bool)record.tapered;
+    out["battery_start"] = record.batteryStart;
+    out["battery_end"] = record.batteryEnd;
+    if (record.chargerStartTs) out["charger_start_ts"] = record.chargerStartTs;
+}
+
+// Publishes one session event of a port: start, protocol change, taper,
+// or the closed session record on end
+void publishSessionEvent(uint8_t port, SessionEvent event) {
+    if (!mqttConnected) return;
+    
+    const PortSession& s = sessions.ports[port];
+    StaticJsonDocument<512> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["timestamp"] = millis();
+    
+    switch (event) {
+        case SESSION_EVENT_START:
+            doc["event"] = "start";
+            doc["port_id"] = port;
+            doc["protocol"] = getProtocolName(s.protocol);
+            doc["start_ms"] = s.record.startMs;
+            doc["battery_start"] = s.record.batteryStart;
+            if (s.record.chargerStartTs) doc["charger_start_ts"] = s.record.chargerStartTs;
+            break;
+        case SESSION_EVENT_PROTOCOL:
+            doc["event"] = "protocol";
+            doc["port_id"] = port;
+            doc["from"] = getProtocolName(s.prevProtocol);
+            doc["to"] = getProtocolName(s.protocol);
+            break;
+        case SESSION_EVENT_TAPER:
+            doc["event"] = "taper";
+            doc["port_id"] = port;
+            doc["peak_power"] = milliToUnit(s.record.peakPowerMw, 2);
+            doc["power"] = milliToUnit(s.lastPowerMw, 2);
+            break;
+        case SESSION_EVENT_END:
+            doc["event"] = "end";
+            writeSessionRecordJson(s.record, doc.as<JsonObject>());
+            break;
+        default:
+            return;
+    }
+    
+    char payload[512];
+    serializeJson(doc, payload, sizeof(payload));
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_SESSION);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_STATUS, false, payload);
+}
+
+void markSessionPending(volatile uint8_t* mask, uint8_t port) {
+    portENTER_CRITICAL(&sessionMux);
+    *mask |= (uint8_t)(1 << port);
+    portEXIT_CRITICAL(&sessionMux);
+}
+
+// Clears a port's bit; true if it was set
+bool takeSessionPending(volatile uint8_t* mask, uint8_t port) {
+    portENTER_CRITICAL(&sessionMux);
+    bool pending = *mask & (1 << port);
+    *mask &= (uint8_t)~(1 << port);
+    portEXIT_CRITICAL(&sessionMux);
+    return pending;
+}
+
+// Feeds the latest snapshot to every port's session state machine. Start
+// events are left to serviceSessions(), which reads the charger's start
+// timestamp once the poll is done.
+void updateSessions() {
+    for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+        SessionEvent event = updatePortSession(&sessions, i, portSnapshot);
+        if (event == SESSION_EVENT_NONE) continue;
+        if (event == SESSION_EVENT_START) {
+            markSessionPending(&sessionStartPending, i);
+            continue;
+        }
+        // A start loop() has not reached yet goes out first, without the timestamp
+        if (takeSessionPending(&sessionStartPending, i)) publishSessionEvent(i, SESSION_EVENT_START);
+        publishSessionEvent(i, event);
+    }
+}
+
+// Called from loop(): completes pending session starts with the charger's
+// start timestamp and publishes sessions closed by a disconnect
+void serviceSessions() {
+    for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+        if (takeSessionPending(&sessionStartPending, i)) {
+            sessions.ports[i].record.chargerStartTs = bleConnected ? fetchChargeStartTimestamp(i) : 0;
+            publishSessionEvent(i, SESSION_EVENT_START);
+        }
+        if (takeSessionPending(&sessionEndPending, i)) {
+            publishSessionEvent(i, SESSION_EVENT_END);
+        }
+    }
+}
+
+// ============ Charger Shadow ============
+// GET service of a single-byte shadow slot; -1 if it cannot be read back
+int shadowGetService(uint8_t slot) {
+    switch (slot) {
+        case SHADOW_STRATEGY: return CMD_GET_CHARGING_STRATEGY;
+        case SHADOW_BRIGHTNESS: return CMD_GET_DISPLAY_INTENSITY;
+        case SHADOW_DISPLAY_MODE: return CMD_GET_DISPLAY_MODE;
+        case SHADOW_DISPLAY_FLIP: return CMD_GET_DISPLAY_FLIP;
+        default: return -1;
+    }
+}
+
+// SET service of a single-byte shadow slot; -1 if it cannot be written
+int shadowSetService(uint8_t slot) {
+    switch (slot) {
+        case SHADOW_STRATEGY: return CMD_SET_CHARGING_STRATEGY;
+        case SHADOW_BRIGHTNESS: return CMD_SET_DISPLAY_INTENSITY;
+        case SHADOW_DISPLAY_MODE: return CMD_SET_DISPLAY_MODE;
+        case SHADOW_DISPLAY_FLIP: return CMD_SET_DISPLAY_FLIP;
+        case SHADOW_TEMP_MODE: return CMD_SET_TEMPERATURE_MODE;
+        default: return -1;
+    }
+}
+
+bool parseReply(const BleReply& reply, BLEResponse* resp) {
+    return parseResponse(reply.frame, reply.length, resp) && resp->success && resp->payloadLen > 0;
+}
+
+// Reads a slot from the charger unless the shadow copy is still fresh;
+// returns whether the slot is fresh afterwards
+bool refreshShadowSlot(uint8_t slot) {
+    uint32_t now = millis();
+    if (shadowFresh(shadow, slot, now)) return true;
+    
+    BleReply reply;
+    BLEResponse resp;
+    if (slot == SHADOW_PRIORITIES) {
+        PortPriorityView view;
+        if (sendBleCommand(CMD_GET_PORT_PRIORITY, nullptr, 0, &reply) && parseReply(reply, &resp) &&
+            decodePortPriority(resp.payload, resp.payloadLen, &view) && view.count() >= CP02_PORT_COUNT) {
+            shadowStore(&shadow, slot, view.data, now);
+        }
+    } else if (slot >= SHADOW_PORT_CONFIG) {
+        uint8_t payload[] = {(uint8_t)(slot - SHADOW_PORT_CONFIG)};
+        PortConfigView view;
+        if (sendBleCommand(CMD_GET_PORT_CONFIG, payload, 1, &reply) && parseReply(reply, &resp) &&
+            decodePortConfig(resp.payload, resp.payloadLen, &view)) {
+            shadowStore(&shadow, slot, view.powerFeatures(), now);
+        }
+    } else if (shadowGetService(slot) >= 0) {
+        if (sendBleCommand(shadowGetService(slot), nullptr, 0, &reply) && parseReply(reply, &resp)) {
+            shadowStore(&shadow, slot, resp.payload, now);
+        }
+    }
+    return shadowFresh(shadow, slot, millis());
+}
+
+// Reads every stale slot, e.g. right after connecting
+void refreshShadow() {
+    for (uint8_t slot = 0; slot < SHADOW_SLOT_COUNT; slot++) {
+        refreshShadowSlot(slot);
+    }
+}
+
+// Read-modify-write of one slot: brings the shadow up to date and sends
+// value only if it differs. written reports whether a command went out.
+bool writeShadowSlot(uint8_t slot, const uint8_t* value, bool* written = nullptr) {
+    refreshShadowSlot(slot);
+    bool needed = shadowNeedsWrite(&shadow, slot, value, millis());
+    if (written) *written = needed;
+    if (!needed) return true;
+    
+    bool success;
+    if (slot == SHADOW_PRIORITIES) {
+        // Whole vector, same layout as GET_PORT_PRIORITY
+        success = sendBleCommand(CMD_SET_PORT_PRIORITY, value, CP02_PORT_COUNT);
+    } else if (slot >= SHADOW_PORT_CONFIG) {
+        // [port mask][version 0][3 feature bytes per port slot]: only the
+        // masked port is applied, the others carry their shadowed config
+        uint8_t port = slot - SHADOW_PORT_CONFIG;
+        uint8_t payload[2 + SHADOW_CONFIG_PORTS * SHADOW_FEATURE_BYTES] = {0};
+        payload[0] = 1 << port;
+        memcpy(payload + 2, shadow.portFeatures, sizeof(shadow.portFeatures));
+        memcpy(payload + 2 + port * SHADOW_FEATURE_BYTES, value, SHADOW_FEATURE_BYTES);
+        success = sendBleCommand(CMD_SET_PORT_CONFIG, payload, sizeof(payload));
+    } else if (shadowSetService(slot) >= 0) {
+        success = sendBleCommand(shadowSetService(slot), value, 1);
+    } else {
+        if (written) *written = false;
+        return false;
+    }
+    if (success) shadowStore(&shadow, slot, value, millis());
+    return success;
+}
+
+// Changes one port's priority; the charger takes the whole vector, so the
+// other ports keep their shadowed values
+bool writePortPriority(uint8_t port, uint8_t priority, bool* written = nullptr) {
+    if (port >= CP02_PORT_COUNT || !refreshShadowSlot(SHADOW_PRIORITIES)) return false;
+    uint8_t priorities[CP02_PORT_COUNT];
+    memcpy(priorities, shadow.priorities, sizeof(priorities));
+    priorities[port] = priority;
+    return writeShadowSlot(SHADOW_PRIORITIES, priorities, written);
+}
+
+void writeShadowPrioritiesJson(JsonObject out) {
+    PortPriorityView view;
+    if (decodePortPriority(shadow.priorities, CP02_PORT_COUNT, &view)) {
+        writePortPriorityJson(view, out);
+    }
+}
+
+void writeShadowPortConfigJson(uint8_t port, JsonObject out) {
+    uint8_t config[1 + SHADOW_FEATURE_BYTES] = {port};
+    memcpy(config + 1, shadow.portFeatures[port], SHADOW_FEATURE_BYTES);
+    PortConfigView view;
+    if (decodePortConfig(config, sizeof(config), &view)) {
+        writePortConfigJson(view, out);
+    }
+}
+
+// Known slots only; anything never read or written is left out
+void writeShadowJson(JsonObject out) {
+    out["version"] = shadow.version;
+    out["ttl_ms"] = SHADOW_TTL_MS;
+    if (shadowKnown(shadow, SHADOW_PRIORITIES)) writeShadowPrioritiesJson(out);
+    if (shadowKnown(shadow, SHADOW_STRATEGY)) {
+        ChargingStrategyView view;
+        if (decodeChargingStrategy(&shadow.values[SHADOW_STRATEGY], 1, &view)) {
+            writeChargingStrategyJson(view, out);
+        }
+    }
+    if (shadowKnown(shadow, SHADOW_TEMP_MODE)) out["temperature_mode"] = shadow.values[SHADOW_TEMP_MODE];
+    
+    JsonObject display = out.createNestedObject("display");
+    if (shadowKnown(shadow, SHADOW_BRIGHTNESS)) display["brightness"] = shadow.values[SHADOW_BRIGHTNESS];
+    if (shadowKnown(shadow, SHADOW_DISPLAY_MODE)) display["mode"] = shadow.values[SHADOW_DISPLAY_MODE];
+    if (shadowKnown(shadow, SHADOW_DISPLAY_FLIP)) display["flipped"] = shadow.values[SHADOW_DISPLAY_FLIP] != 0;
+    
+    JsonArray ports = out.createNestedArray("ports");
+    for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+        if (shadowKnown(shadow, SHADOW_PORT_CONFIG + i)) writeShadowPortConfigJson(i, ports.createNestedObject());
+    }
+}
+
+// Publishes the shadow as a retained document on MQTT_TOPIC_SHADOW when it
+// has changed since the last publish
+void publishShadow(bool force = false) {
+    if (!mqttConnected || (!force && shadow.version == shadow.publishedVersion)) return;
+    
+    DynamicJsonDocument doc(2048);
+    doc["gateway_id"] = gatewayId;
+    writeShadowJson(doc.as<JsonObject>());
+    doc["timestamp"] = millis();
+    
+    size_t len = measureJson(doc);
+    char* payload = (char*)malloc(len + 1);
+    if (payload == nullptr) {
+        log("[MQTT] Shadow publish: out of memory");
+        return;
+    }
+    serializeJson(doc, payload, len + 1);
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_SHADOW);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_STATUS, true, payload, len);
+    free(payload);
+    shadow.publishedVersion = shadow.version;
+}
+
+// Runs the charger command of each rule that fired and reports it on
+// MQTT_TOPIC_RULE
+void runRuleActions(const RuleFiring* firings, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        const RuleFiring& f = firings[i];
+        bool success = true;
+        switch (f.action) {
+            case RULE_ACTION_OFF: {
+                uint8_t payload[] = {f.actionPort};
+                success = sendBleCommand(CMD_TURN_OFF_PORT, payload, 1);
+                break;
+            }
+            case RULE_ACTION_ON: {
+                uint8_t payload[] = {f.actionPort};
+                success = sendBleCommand(CMD_TURN_ON_PORT, payload, 1);
+                break;
+            }
+            case RULE_ACTION_PRIORITY:
+                success = writePortPriority(f.actionPort, f.actionArg);
+                break;
+            case RULE_ACTION_STRATEGY:
+                success = writeShadowSlot(SHADOW_STRATEGY, &f.actionArg);
+                break;
+            default:
+                break;
+        }
+        
+        char text[RULE_TEXT_MAX];
+        formatRule(ruleEngine.rules[f.rule], text, sizeof(text));
+        logf("[RULE] %s fired (value %ld)%s", text, (long)f.value, success ? "" : ", command failed");
+        if (!mqttConnected) continue;
+        
+        StaticJsonDocument<256> doc;
+        doc["gateway_id"] = gatewayId;
+        doc["rule"] = f.rule;
+        doc["text"] = text;
+        if (f.port == RULE_TARGET_TOTAL) {
+            doc["port_id"] = "total";
+        } else {
+            doc["port_id"] = f.port;
+        }
+        doc["value"] = f.value;
+        doc["action"] = getRuleActionName(f.action);
+        doc["success"] = success;
+        doc["timestamp"] = millis();
+        
+        char payload[256];
+        serializeJson(doc, payload, sizeof(payload));
+        String topic = buildMqttTopic(MQTT_TOPIC_RULE);
+        mqttClient.publish(topic.c_str(), MQTT_QOS_STATUS, false, payload);
+    }
+}
+
+void writeAllocatorMetricsJson(JsonObject out) {
+    out["budget"] = milliToUnit(allocator.budgetMw, 1);
+    out["hysteresis"] = milliToUnit(allocator.hysteresisMw, 1);
+    out["changes"] = allocator.changes;
+    out["latency_ms"] = allocator.lastLatencyMs;
+    out["max_latency_ms"] = allocator.maxLatencyMs;
+}
+
+// Carries out one allocation decision and publishes it with the
+// controller metrics on MQTT_TOPIC_ALLOCATOR
+void runAllocator() {
+    AllocDecision decision;
+    if (!decideAllocation(&allocator, portSnapshot, &decision)) return;
+    
+    bool success = false;
+    switch (decision.action) {
+        case ALLOC_ACTION_PRIORITIES:
+            // Same layout as GET_PORT_PRIORITY: one byte per port
+            success = sendBleCommand(CMD_SET_PORT_PRIORITY, decision.priorities, CP02_PORT_COUNT);
+            break;
+        case ALLOC_ACTION_SHED: {
+            uint8_t payload[] = {decision.port};
+            success = sendBleCommand(CMD_TURN_OFF_PORT, payload, 1);
+            break;
+        }
+        case ALLOC_ACTION_RESTORE: {
+            uint8_t payload[] = {decision.port};
+            success = sendBleCommand(CMD_TURN_ON_PORT, payload, 1);
+            break;
+        }
+    }
+    applyAllocation(&allocator, decision, success, millis());
+    if (success && decision.action == ALLOC_ACTION_PRIORITIES) {
+        shadowStore(&shadow, SHADOW_PRIORITIES, decision.priorities, millis());
+    }
+    
+    logf("[ALLOC] %s port %d at %u mW: %s", getAllocActionName(decision.action), decision.port,
+         decision.totalMw, success ? "ok" : "failed");
+    if (!mqttConnected) return;
+    
+    StaticJsonDocument<512> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["action"] = getAllocActionName(decision.action);
+    doc["success"] = success;
+    if (decision.action != ALLOC_ACTION_PRIORITIES) doc["port_id"] = decision.port;
+    JsonArray priorities = doc.createNestedArray("priorities");
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        priorities.add(decision.priorities[i]);
+    }
+    doc["total_power"] = milliToUnit(decision.totalMw, 2);
+    writeAllocatorMetricsJson(doc.as<JsonObject>());
+    doc["timestamp"] = millis();
+    
+    char payload[512];
+    serializeJson(doc, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_ALLOCATOR);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_STATUS, false, payload);
+}
+
+// Appends one curve channel as ,"name":[d0,d1,...] where d0 is absolute
+// and di = raw[i] - raw[i-1]; returns the new length
+static size_t appendCurveDeltas(char* out, size_t len, size_t size, const char* name,
+                                const uint8_t* raw, uint16_t count) {
+    len += snprintf(out + len, size - len, ",\"%s\":[", name);
+    int prev = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        len += snprintf(out + len, size - len, i == 0 ? "%d" : ",%d", (int)raw[i] - prev);
+        prev = raw[i];
+    }
+    out[len++] = ']';
+    return len;
+}
+
+// Publishes powerCurve with both channels delta-encoded in raw charger
+// steps: element 0 is absolute, element i is raw[i] - raw[i-1]. A steady
+// charge becomes runs of 0 instead of repeated 3-digit values.
+// The arrays are written straight into a static buffer sized for the
+// worst case ("-255," per sample) rather than through a JSON document,
+// which would take ~23 KB of heap for a full curve.
+void publishPowerCurve() {
+    if (!mqttConnected) return;
+    
+    static char payload[POWER_CURVE_HEADER_SIZE + 2 * (HISTORY_MAX_SAMPLES * 5 + 16)];
+    const uint16_t count = min(powerCurve.count, (uint16_t)HISTORY_MAX_SAMPLES);
+    StaticJsonDocument<POWER_CURVE_HEADER_SIZE> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["port_id"] = powerCurve.portId;
+    doc["offset"] = powerCurve.startOffset;
+    doc["count"] = count;
+    doc["encoding"] = "delta";
+    doc["current_step_ua"] = CURVE_CURRENT_STEP_UA;
+    doc["voltage_step_mv"] = CURVE_VOLTAGE_STEP_MV;
+    doc["timestamp"] = powerCurve.fetchedMs;
+    
+    // Reopen the header object and append the two arrays to it
+    size_t len = serializeJson(doc, payload, POWER_CURVE_HEADER_SIZE);
+    if (len < 2 || len >= POWER_CURVE_HEADER_SIZE - 1) {
+        log("[MQTT] Power curve publish: header too large");
+        return;
+    }
+    len--;
+    len = appendCurveDeltas(payload, len, sizeof(payload), "current", powerCurve.currentRaw, count);
+    len = appendCurveDeltas(payload, len, sizeof(payload), "voltage", powerCurve.voltageRaw, count);
+    payload[len++] = '}';
+    payload[len] = '\0';
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_POWER_CURVE);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_TELEMETRY, false, payload, len);
+}
+
+// Returns false when the MQTT client did not accept the chunk
+bool publishDebugLogChunk(uint16_t seq, const uint8_t* data, size_t len) {
+    // Log bytes are not guaranteed UTF-8, so chunks travel as base64
+    unsigned char encoded[((DEBUG_LOG_CHUNK_SIZE + 2) / 3) * 4 + 1];
+    size_t encodedLen = 0;
+    mbedtls_base64_encode(encoded, sizeof(encoded), &encodedLen, data, len);
+    encoded[encodedLen] = '\0';
+    
+    StaticJsonDocument<256> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["cmd_id"] = debugLogCmdId;
+    doc["seq"] = seq;
+    doc["data"] = (const char*)encoded;
+    
+    char payload[sizeof(encoded) + 160];
+    size_t payloadLen = serializeJson(doc, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_DEBUG_LOG);
+    return mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload, payloadLen) != 0;
+}
+
+// Retrieves the charger debug log and publishes it on MQTT_TOPIC_DEBUG_LOG
+// as numbered chunks, followed by a final message carrying the totals so
+// the backend can detect gaps. The log ends on a FIN frame, after
+// DEBUG_LOG_GAP_TIMEOUT of silence, or at DEBUG_LOG_MAX_BYTES. Chunks the
+// MQTT client refuses are counted as dropped; polling is resumed only if
+// it was running before.
+void streamDebugLog() {
+    if (debugLogStream == nullptr) {
+        debugLogStream = xStreamBufferCreateStatic(DEBUG_LOG_STREAM_BUFFER, 1, debugLogStreamStorage,
+                                                   &debugLogStreamStruct);
+    }
+    xStreamBufferReset(debugLogStream);
+    streamFinReceived = false;
+    streamDroppedBytes = 0;
+    
+    bool wasPolling = pollingActive;
+    stopDataPolling();
+    responseStreaming = true;
+    bool started = sendBleCommand(CMD_GET_DEBUG_LOG);
+    
+    uint8_t chunk[DEBUG_LOG_CHUNK_SIZE];
+    size_t chunkLen = 0;
+    uint16_t seq = 0;
+    uint32_t totalBytes = 0;
+    uint32_t unpublishedBytes = 0;
+    uint32_t startMs = millis();
+    
+    while (started) {
+        size_t n = xStreamBufferReceive(debugLogStream, chunk + chunkLen, sizeof(chunk) - chunkLen,
+                                        pdMS_TO_TICKS(20));
+        chunkLen += n;
+        totalBytes += n;
+        
+        bool drained = xStreamBufferIsEmpty(debugLogStream);
+        bool done = !bleConnected || totalBytes >= DEBUG_LOG_MAX_BYTES ||
+                    (drained && (streamFinReceived || millis() - streamLastRxMs > DEBUG_LOG_GAP_TIMEOUT));
+        
+        if (chunkLen == sizeof(chunk) || (done && chunkLen > 0)) {
+            if (!publishDebugLogChunk(seq++, chunk, chunkLen)) {
+                unpublishedBytes += chunkLen;
+            }
+            chunkLen = 0;
+        }
+        if (done) break;
+    }
+    responseStreaming = false;
+    if (wasPolling) startDataPolling();
+    
+    StaticJsonDocument<256> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["cmd_id"] = debugLogCmdId;
+    doc["final"] = true;
+    doc["success"] = started;
+    doc["chunks"] = seq;
+    doc["bytes"] = totalBytes;
+    doc["dropped"] = (uint32_t)streamDroppedBytes + unpublishedBytes;
+    doc["duration_ms"] = millis() - startMs;
+    
+    char payload[256];
+    serializeJson(doc, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_DEBUG_LOG);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload);
+    
+    logf("[BLE] Debug log: %u bytes in %u chunks, %u dropped", totalBytes, seq,
+         (uint32_t)streamDroppedBytes + unpublishedBytes);
+}
+
+// Publishes n samples of a history tier, starting at stored index first,
+// as one chunk with per-field arrays in fixed-point units
+bool publishHistoryChunk(const HistoryTier& tier, uint16_t first, uint16_t n, uint16_t seq) {
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(10) + 2 * JSON_ARRAY_SIZE(n) + JSON_ARRAY_SIZE(CP02_PORT_COUNT) +
+                            CP02_PORT_COUNT * (JSON_OBJECT_SIZE(6) + 5 * JSON_ARRAY_SIZE(n)) + 64);
+    doc["gateway_id"] = gatewayId;
+    doc["cmd_id"] = historyCmdId;
+    doc["seq"] = seq;
+    doc["tier"] = historyTier;
+    doc["period_s"] = tier.periodS;
+    doc["now_s"] = millis() / 1000;
+    doc["count"] = n;
+    
+    JsonArray times = doc.createNestedArray("t");
+    JsonArray charging = doc.createNestedArray("charging");
+    for (uint16_t k = 0; k < n; k++) {
+        uint16_t slot = historySlot(tier, first + k);
+        times.add(tier.timeS[slot]);
+        charging.add(tier.chargingMask[slot]);
+    }
+    
+    JsonArray ports = doc.createNestedArray("ports");
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        JsonObject port = ports.createNestedObject();
+        port["port_id"] = i;
+        JsonArray voltage = port.createNestedArray("voltage_mv");
+        JsonArray current = port.createNestedArray("current_ma");
+        JsonArray power = port.createNestedArray("power_cw");
+        JsonArray temperature = port.createNestedArray("temperature");
+        JsonArray protocol = port.createNestedArray("protocol");
+        for (uint16_t k = 0; k < n; k++) {
+            size_t f = (size_t)historySlot(tier, first + k) * CP02_PORT_COUNT + i;
+            voltage.add(tier.voltageMv[f]);
+            current.add(tier.currentMa[f]);
+            power.add(tier.powerCw[f]);
+            temperature.add(tier.temperature[f]);
+            protocol.add(tier.protocol[f]);
+        }
+    }
+    
+    size_t len = measureJson(doc);
+    char* payload = (char*)malloc(len + 1);
+    if (payload == nullptr) {
+        log("[MQTT] History chunk publish: out of memory");
+        return false;
+    }
+    serializeJson(doc, payload, len + 1);
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_HISTORY);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload, len);
+    free(payload);
+    return true;
+}
+
+// Streams [historyFromS, historyToS] of the requested tier in chunks of
+// HISTORY_CHUNK_SAMPLES, then a final summary. Polling keeps writing the
+// rings meanwhile, so the position is carried as the last time sent and
+// looked up again for each chunk.
+void streamHistory() {
+    const HistoryTier& tier = historyRings.tiers[historyTier];
+    uint16_t seq = 0;
+    uint32_t samples = 0;
+    uint16_t index = historyFromS > 0 ? findHistoryIndex(tier, historyFromS - 1) : 0;
+    
+    while (mqttConnected && index < tier.count && tier.timeS[historySlot(tier, index)] <= historyToS) {
+        uint16_t n = 0;
+        while (n < HISTORY_CHUNK_SAMPLES && index + n < tier.count &&
+               tier.timeS[historySlot(tier, index + n)] <= historyToS) {
+            n++;
+        }
+        uint32_t lastS = tier.timeS[historySlot(tier, index + n - 1)];
+        if (!publishHistoryChunk(tier, index, n, seq)) break;
+        seq++;
+        samples += n;
+        index = findHistoryIndex(tier, lastS);
+    }
+    
+    StaticJsonDocument<256> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["cmd_id"] = historyCmdId;
+    doc["final"] = true;
+    doc["tier"] = historyTier;
+    doc["period_s"] = tier.periodS;
+    doc["now_s"] = millis() / 1000;
+    doc["chunks"] = seq;
+    doc["samples"] = samples;
+    
+    char payload[256];
+    serializeJson(doc, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_HISTORY);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload);
+    
+    logf("[HIST] Sent %u samples of tier %d in %u chunks", samples, historyTier, seq);
+}
+
+// Publishes a burst blob on MQTT_TOPIC_BURST_DATA in BURST_CHUNK_SIZE
+// slices (chunk prefix in burst_capture.h). A chunk the MQTT client refuses
+// is retried while its send buffer drains; the first chunk that still does
+// not go out ends the transfer. Returns the number of chunks accepted.
+uint16_t publishBurstBlob(const uint8_t* blob, size_t blobLen, uint16_t chunkCount) {
+    static uint8_t chunk[BURST_CHUNK_HEADER_MAX_SIZE + BURST_CHUNK_SIZE];
+    String topic = buildMqttTopic(MQTT_TOPIC_BURST_DATA);
+    
+    for (uint16_t i = 0; i < chunkCount; i++) {
+        size_t offset = (size_t)i * BURST_CHUNK_SIZE;
+        size_t len = min((size_t)BURST_CHUNK_SIZE, blobLen - offset);
+        size_t headerLen = encodeBurstChunkHeader(i, chunkCount, burstCmdId, chunk, sizeof(chunk));
+        memcpy(chunk + headerLen, blob + offset, len);
+        
+        bool accepted = false;
+        for (int attempt = 0; attempt < BURST_CHUNK_RETRIES && mqttConnected; attempt++) {
+            if (mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, (const char*)chunk,
+                                   headerLen + len) != 0) {
+                accepted = true;
+                break;
+            }
+            delay(BURST_CHUNK_RETRY_MS);
+        }
+        if (!accepted) {
+            logf("[BURST] Chunk %u/%u not accepted by MQTT client", i + 1, chunkCount);
+            return i;
+        }
+    }
+    return chunkCount;
+}
+
+// Polls port statistics (and optionally one port's PD status) back to back
+// for burstDurationMs, recording into a PSRAM buffer; then publishes the
+// packed samples as a chunked binary blob and a JSON report with the
+// achieved sample rate. Both buffers are freed before returning.
+void runBurstCapture() {
+    bool psram = psramFound();
+    uint32_t capacity = psram ? BURST_MAX_SAMPLES : BURST_MAX_SAMPLES_DRAM;
+    size_t blobCapacity = BURST_HEADER_MAX_SIZE + (size_t)capacity * BURST_SAMPLE_MAX_SIZE;
+    BurstSample* samples = (BurstSample*)(psram ? ps_malloc(capacity * sizeof(BurstSample))
+                                                : malloc(capacity * sizeof(BurstSample)));
+    
+    StaticJsonDocument<512> report;
+    report["gateway_id"] = gatewayId;
+    report["cmd_id"] = burstCmdId;
+    report["include_pd"] = burstIncludePd;
+    report["psram"] = psram;
+    
+    uint32_t count = 0;
+    uint32_t failures = 0;
+    uint32_t elapsedUs = 0;
+    size_t blobLen = 0;
+    uint16_t chunkCount = 0;
+    uint16_t chunksSent = 0;
+    
+    if (samples != nullptr) {
+        bool wasPolling = pollingActive;
+        stopDataPolling();
+        PortInfo ports[CP02_PORT_COUNT];
+        uint8_t pdRequest[] = {burstPdPort};
+        uint32_t startUs = micros();
+        uint32_t startMs = millis();
+        
+        BleReply reply;
+        while (bleConnected && count < capacity && millis() - startMs < burstDurationMs) {
+            BLEResponse resp;
+            if (!sendBleFrame(framePortStats, &reply) || !parseResponse(reply.frame, reply.length, &resp) ||
+                !resp.success) {
+                failures++;
+                continue;
+            }
+            int portCount = parsePortStatistics(resp.payload, resp.payloadLen, ports, CP02_PORT_COUNT);
+            BurstSample& sample = samples[count];
+            recordBurstSample(ports, portCount, micros() - startUs, &sample);
+            
+            if (burstIncludePd) {
+                PdStatusView view;
+                if (sendBleCommand(CMD_GET_PORT_PD_STATUS, pdRequest, 1, &reply) &&
+                    parseResponse(reply.frame, reply.length, &resp) && resp.success &&
+                    decodePdStatus(resp.payload, resp.payloadLen, &view)) {
+                    sample.pdOperating = view.dwordAt(28);
+                } else {
+                    failures++;
+                }
+            }
+            count++;
+        }
+        elapsedUs = micros() - startUs;
+        if (wasPolling) startDataPolling();
+        
+        uint8_t* blob = (uint8_t*)(psram ? ps_malloc(blobCapacity) : malloc(blobCapacity));
+        if (blob != nullptr) {
+            uint8_t flags = burstIncludePd ? BURST_FLAG_PD : 0;
+            blobLen = encodeBurst(samples, count, elapsedUs, flags, burstPdPort, burstCmdId,
+                                  blob, blobCapacity);
+            chunkCount = (blobLen + BURST_CHUNK_SIZE - 1) / BURST_CHUNK_SIZE;
+            if (blobLen > 0 && mqttConnected) {
+                chunksSent = publishBurstBlob(blob, blobLen, chunkCount);
+            }
+            free(blob);
+        }
+        free(samples);
+    }
+    
+    report["success"] = blobLen > 0 && chunksSent == chunkCount;
+    report["samples"] = count;
+    report["failures"] = failures;
+    report["duration_ms"] = elapsedUs / 1000;
+    report["sample_rate_hz"] = elapsedUs > 0 ? (float)count * 1000000.0f / elapsedUs : 0.0f;
+    report["raw_bytes"] = count * sizeof(BurstSample);
+    report["blob_bytes"] = blobLen;
+    report["chunks"] = chunkCount;
+    report["chunks_sent"] = chunksSent;
+    if (samples == nullptr) report["error"] = "Out of memory";
+    
+    char payload[512];
+    serializeJson(report, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_BURST_REPORT);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload);
+    
+    logf("[BURST] %u samples in %u ms, blob %u bytes in %u/%u chunks", count, elapsedUs / 1000, blobLen,
+         chunksSent, chunkCount);
+}
+
+// ============ Link Metrics ============
+void sampleLinkRssi() {
+    if (!bleConnected || pBleClient == nullptr) return;
+    int rssi = pBleClient->getRssi();
+    if (rssi != 0) recordRssi(&linkMetrics, rssi);
+}
+
+void writeServiceMetricsJson(const ServiceMetrics& slot, JsonObject out) {
+    const LatencyHistogram& hist = slot.latency;
+    out["service"] = slot.service;
+    out["name"] = slot.service == LINK_SERVICE_OTHER ? "other" : commandDescriptor(slot.service).name;
+    out["count"] = hist.count;
+    out["timeouts"] = slot.timeouts;
+    out["write_errors"] = slot.writeErrors;
+    if (hist.count > 0) {
+        out["min_ms"] = hist.minMs;
+        out["avg_ms"] = hist.sumMs / hist.count;
+        out["max_ms"] = hist.maxMs;
+        out["p50_ms"] = latencyPercentile(hist, 50);
+        out["p95_ms"] = latencyPercentile(hist, 95);
+        out["p99_ms"] = latencyPercentile(hist, 99);
+    }
+    JsonArray buckets = out.createNestedArray("buckets");
+    for (uint32_t count : hist.buckets) {
+        buckets.add(count);
+    }
+}
+
+// Learned timeout per command class; ceiling_ms is the largest ceiling
+// in the class
+void writeRttEstimatesJson(JsonArray out) {
+    uint16_t ceilings[TIMEOUT_CLASS_COUNT] = {};
+    for (uint16_t service = 0; service < 256; service++) {
+        const CommandDescriptor& desc = commandDescriptor(service);
+        uint8_t cls = commandTimeoutClass(desc);
+        ceilings[cls] = max(ceilings[cls], desc.timeoutMs);
+    }
+    
+    for (uint8_t cls = 0; cls < TIMEOUT_CLASS_COUNT; cls++) {
+        const RttEstimator& est = rttEstimators[cls];
+        JsonObject entry = out.createNestedObject();
+        entry["class"] = getTimeoutClassName(cls);
+        entry["samples"] = est.samples;
+        entry["srtt_ms"] = rttSmoothedMs(est);
+        entry["rttvar_ms"] = rttVarianceMs(est);
+        entry["rto_ms"] = rttTimeout(est, ceilings[cls]);
+        entry["backoff"] = est.backoff;
+        entry["ceiling_ms"] = ceilings[cls];
+    }
+}
+
+void writeLinkMetricsJson(JsonObject out, int chargerRssi) {
+    out["period_ms"] = millis() - linkMetrics.sinceMs;
+    
+    JsonObject link = out.createNestedObject("link");
+    link["connected"] = bleConnected;
+    link["mtu"] = bleConnected ? bleMtu : 0;
+    link["profile"] = getLinkProfileName(linkProfile.current);
+    link["throughput_bps"] = linkProfile.lastBps;
+    link["transactions"] = bleStats.transactions;
+    link["coalesced"] = bleStats.coalesced;
+    link["cache_hit_rate"] = cacheHitRate(responseCache.stats);
+    if (chargerRssi != 0) link["charger_rssi"] = chargerRssi;
+    
+    uint16_t samples = linkMetrics.rssiCount;
+    if (samples > 0) {
+        JsonObject rssi = link.createNestedObject("rssi");
+        int sum = 0, lo = 127, hi = -128;
+        for (uint16_t i = 0; i < samples; i++) {
+            int8_t v = linkMetrics.rssi[i];
+            sum += v;
+            lo = min(lo, (int)v);
+            hi = max(hi, (int)v);
+        }
+        rssi["last"] = linkMetrics.rssi[(linkMetrics.rssiHead + LINK_RSSI_SAMPLES - 1) % LINK_RSSI_SAMPLES];
+        rssi["min"] = lo;
+        rssi["avg"] = sum / samples;
+        rssi["max"] = hi;
+        rssi["samples"] = samples;
+    }
+    
+    JsonObject notify = out.createNestedObject("notifications");
+    notify["count"] = linkMetrics.notifications;
+    notify["bytes"] = linkMetrics.notifyBytes;
+    JsonArray sizes = notify.createNestedArray("size_buckets");
+    for (uint32_t count : linkMetrics.sizeBuckets) {
+        sizes.add(count);
+    }
+    
+    writeRttEstimatesJson(out.createNestedArray("timeouts"));
+    
+    JsonArray services = out.createNestedArray("services");
+    for (const ServiceMetrics& slot : linkMetrics.services) {
+        if (!slot.used || (slot.latency.count == 0 && slot.timeouts == 0 && slot.writeErrors == 0)) continue;
+        writeServiceMetricsJson(slot, services.createNestedObject());
+    }
+}
+
+// Publishes the link metrics on MQTT_TOPIC_METRICS. Counters run from boot
+// or the last reset, so consecutive documents can be differenced.
+void publishMetrics() {
+    if (!mqttConnected) return;
+    
+    // The charger's own view of the link, one extra read per publish
+    int chargerRssi = 0;
+    BleReply reply;
+    BLEResponse resp;
+    if (bleConnected && sendBleCommand(CMD_GET_BLE_RSSI, nullptr, 0, &reply) && parseReply(reply, &resp)) {
+        chargerRssi = (int8_t)resp.payload[0];
+    }
+    
+    uint8_t used = 0;
+    for (const ServiceMetrics& slot : linkMetrics.services) {
+        if (slot.used) used++;
+    }
+    DynamicJsonDocument doc(1536 + used * (JSON_OBJECT_SIZE(12) + JSON_ARRAY_SIZE(LINK_LATENCY_BUCKETS)));
+    doc["gateway_id"] = gatewayId;
+    doc["gateway_version"] = DEVICE_VERSION;
+    doc["charger_name"] = chargerDeviceName;
+    doc["uptime"] = millis() / 1000;
+    writeLinkMetricsJson(doc.as<JsonObject>(), chargerRssi);
+    
+    size_t len = measureJson(doc);
+    char* payload = (char*)malloc(len + 1);
+    if (payload == nullptr) {
+        log("[MQTT] Metrics publish: out of memory");
+        return;
+    }
+    serializeJson(doc, payload, len + 1);
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_METRICS);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_TELEMETRY, false, payload, len);
+    free(payload);
+}
+
+// ============ Refresh Coalescing ============
+// Adds a refresh request to the next fetch; false if too many are waiting
+bool joinRefresh(const char* cmdId, const char* action) {
+    bool joined = false;
+    portENTER_CRITICAL(&refreshMux);
+    if (refreshRequestCount < REFRESH_MAX_WAITERS) {
+        RefreshRequest& req = refreshRequests[refreshRequestCount++];
+        strlcpy(req.cmdId, cmdId ? cmdId : "", sizeof(req.cmdId));
+        strlcpy(req.action, action, sizeof(req.action));
+        refreshPending = true;
+        joined = true;
+    }
+    portEXIT_CRITICAL(&refreshMux);
+    return joined;
+}
+
+// Fetches and publishes port data and device info once, then answers
+// every request that joined before the fetch completed
+void serveRefresh() {
+    uint32_t before = bleStats.transactions;
+    bool fetched = fetchPortData();
+    fetchDeviceInfo();
+    publishPortData();
+    publishDeviceInfo();
+    uint32_t cost = bleStats.transactions - before;
+    
+    RefreshRequest requests[REFRESH_MAX_WAITERS];
+    portENTER_CRITICAL(&refreshMux);
+    uint8_t count = refreshRequestCount;
+    memcpy(requests, refreshRequests, count * sizeof(RefreshRequest));
+    refreshRequestCount = 0;
+    refreshPending = false;
+    portEXIT_CRITICAL(&refreshMux);
+    
+    if (count > 1) {
+        bleStats.coalesced += count - 1;
+        bleStats.saved += (count - 1) * cost;
+    }
+    if (!mqttConnected) return;
+    
+    String topic = buildMqttTopic(MQTT_TOPIC_CMD_RESPONSE);
+    for (uint8_t i = 0; i < count; i++) {
+        StaticJsonDocument<256> doc;
+        doc["gateway_id"] = gatewayId;
+        doc["action"] = requests[i].action;
+        if (requests[i].cmdId[0]) doc["cmd_id"] = requests[i].cmdId;
+        doc["success"] = bleConnected;
+        doc["ports_fetched"] = fetched;
+        doc["coalesced"] = count;
+        doc["timestamp"] = millis();
+        
+        char payload[256];
+        serializeJson(doc, payload, sizeof(payload));
+        mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload);
+    }
+}
+
+// ============ Power Curve ============
+// Fetches the queued port's curve, publishes it and answers the request
+// on MQTT_TOPIC_CMD_RESPONSE with a summary
+void servePowerCurve() {
+    int pages = fetchPowerCurve(powerCurvePort);
+    if (pages > 0) publishPowerCurve();
+    
+    StaticJsonDocument<256> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["action"] = powerCurveAction;
+    if (powerCurveCmdId[0]) doc["cmd_id"] = powerCurveCmdId;
+    if (pages > 0) {
+        doc["port_id"] = powerCurvePort;
+        doc["offset"] = powerCurve.startOffset;
+        doc["count"] = powerCurve.count;
+        doc["pages"] = pages;
+    }
+    doc["success"] = pages > 0;
+    doc["timestamp"] = millis();
+    
+    if (!mqttConnected) return;
+    char payload[256];
+    serializeJson(doc, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_CMD_RESPONSE);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload);
+}
+
+// ============ Batched Commands ============
+// Sends the queued ble_batch and answers it on MQTT_TOPIC_CMD_RESPONSE
+void runBleBatch() {
+    PipelineRequest requests[PIPELINE_MAX_BATCH];
+    bool results[PIPELINE_MAX_BATCH];
+    size_t offset = 0;
+    for (uint16_t i = 0; i < batchCount; i++) {
+        requests[i] = {batchServices[i], batchData + offset, batchLens[i]};
+        offset += batchLens[i];
+    }
+    
+    PipelineStats stats = {};
+    uint32_t startMs = millis();
+    bool success = sendBlePipelined(requests, batchCount, results, batchWindow, &stats);
+    
+    StaticJsonDocument<1024> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["action"] = "ble_batch";
+    if (batchCmdId[0]) doc["cmd_id"] = batchCmdId;
+    doc["elapsed_ms"] = millis() - startMs;
+    doc["mode"] = stats.fallbacks > 0 || batchWindow <= 1 ? "stop_and_wait" : "pipelined";
+    JsonArray acked = doc.createNestedArray("results");
+    for (uint16_t i = 0; i < batchCount; i++) {
+        acked.add(results[i]);
+    }
+    writePipelineStatsJson(stats, doc.createNestedObject("stats"));
+    doc["success"] = success;
+    doc["timestamp"] = millis();
+    
+    if (mqttConnected) {
+        char payload[1024];
+        serializeJson(doc, payload, sizeof(payload));
+        String topic = buildMqttTopic(MQTT_TOPIC_CMD_RESPONSE);
+        mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload);
+    }
+    publishShadow();
+}
+
+// ============ Firmware Download ============
+// Opens a firmware download positioned at offset: with a Range request,
+// or, when the server ignores it and sends the whole image, by reading
+// the first offset bytes into scratch and discarding them. total is the
+// size of the whole image, 0 if the server did not send one. Reads time
+// out after OTA_HTTP_TIMEOUT.
+bool openFirmwareStream(HTTPClient& http, const char* url, uint32_t offset,
+                        uint8_t* scratch, size_t scratchSize, uint32_t* total) {
+    http.setReuse(false);
+    if (!http.begin(url)) return false;
+    
+    if (offset > 0) {
+        char range[24];
+        snprintf(range, sizeof(range), "bytes=%u-", offset);
+        http.addHeader("Range", range);
+    }
+    int code = http.GET();
+    WiFiClient* stream = http.getStreamPtr();
+    if ((code != HTTP_CODE_OK && code != HTTP_CODE_PARTIAL_CONTENT) || stream == nullptr) {
+        logf("[OTA] Download failed: HTTP %d", code);
+        http.end();
+        return false;
+    }
+    
+    uint32_t at = code == HTTP_CODE_PARTIAL_CONTENT ? offset : 0;
+    int length = http.getSize();
+    *total = length > 0 ? at + length : 0;
+    
+    stream->setTimeout(OTA_HTTP_TIMEOUT);
+    while (at < offset) {
+        size_t n = min((uint32_t)scratchSize, offset - at);
+        if (stream->readBytes(scratch, n) != n) {
+            http.end();
+            return false;
+        }
+        at += n;
+    }
+    return true;
+}
+
+// ============ Charger Firmware Pass-Through ============
+void writeChargerOtaJson(JsonObject out) {
+    uint32_t now = millis();
+    out["phase"] = getChargerOtaPhaseName(chargerOta.phase);
+    out["offset"] = chargerOta.offset;
+    out["size"] = chargerOta.size;
+    out["percent"] = chargerOtaPercent(chargerOta);
+    out["bytes_per_s"] = chargerOtaRate(chargerOta, now);
+    out["chunk"] = chargerOta.chunkSize;
+    out["window"] = chargerOta.window;
+    out["resumes"] = chargerOta.resumes;
+    out["restarts"] = chargerOta.restarts;
+    out["elapsed_ms"] = now - chargerOta.startMs;
+    if (chargerOta.error) out["error"] = chargerOta.error;
+}
+
+void publishChargerOta(const char* event) {
+    chargerOta.lastReportMs = millis();
+    if (!mqttConnected) return;
+    
+    StaticJsonDocument<512> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["cmd_id"] = chargerOtaCmdId;
+    doc["event"] = event;
+    writeChargerOtaJson(doc.as<JsonObject>());
+    doc["timestamp"] = millis();
+    
+    char payload[512];
+    size_t payloadLen = serializeJson(doc, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_CHARGER_OTA);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload, payloadLen);
+}
+
+void closeChargerOtaStream() {
+    if (!chargerOtaStreamOpen) return;
+    chargerOtaHttp.end();
+    chargerOtaStreamOpen = false;
+}
+
+// Reads exactly len bytes of the download; false if it stalls for
+// OTA_HTTP_TIMEOUT or drops
+bool readChargerOtaStream(uint8_t* buf, size_t len) {
+    WiFiClient* stream = chargerOtaHttp.getStreamPtr();
+    if (stream == nullptr) return false;
+    
+    size_t got = stream->readBytes(buf, len);
+    chargerOtaStreamOffset += got;
+    return got == len;
+}
+
+// Requests the image from the acknowledged offset on; fails the transfer
+// if the image size is unknown or differs from the one being sent
+bool openChargerOtaStream() {
+    closeChargerOtaStream();
+    uint32_t total;
+    if (!openFirmwareStream(chargerOtaHttp, chargerOtaUrl, chargerOta.offset, chargerOtaBuffer,
+                            sizeof(chargerOtaBuffer), &total)) {
+        return false;
+    }
+    chargerOtaStreamOpen = true;
+    chargerOtaStreamOffset = chargerOta.offset;
+    
+    if (chargerOta.size == 0) chargerOta.size = total;
+    if (chargerOta.size == 0 || (total != 0 && total != chargerOta.size)) {
+        chargerOtaFail(&chargerOta, chargerOta.size == 0 ? "image size unknown" : "image changed");
+        closeChargerOtaStream();
+        return false;
+    }
+    return true;
+}
+
+// Sends a command and checks that the charger accepted it
+bool sendChargerOtaCommand(uint8_t service, const uint8_t* payload = nullptr, size_t payloadLen = 0) {
+    BleReply reply;
+    BLEResponse resp;
+    return sendBleCommand(service, payload, payloadLen, &reply) &&
+           parseResponse(reply.frame, reply.length, &resp) && resp.success;
+}
+
+// START_OTA at the acknowledged offset. A charger that no longer has the
+// partial image (rebooted, or keeps no state across connections) refuses
+// the resume; the image then starts over from 0.
+bool beginChargerOta() {
+    uint8_t payload[8];
+    writeU32LE(payload, chargerOta.size);
+    writeU32LE(payload + 4, chargerOta.offset);
+    if (sendChargerOtaCommand(CMD_START_OTA, payload, sizeof(payload))) return true;
+    if (chargerOta.offset == 0 || !bleConnected) return false;
+    
+    logf("[OTA] Charger refused resume at %u, starting over", chargerOta.offset);
+    chargerOta.offset = 0;
+    chargerOta.restarts++;
+    chargerOtaRun(&chargerOta, millis());
+    writeU32LE(payload + 4, 0);
+    return sendChargerOtaCommand(CMD_START_OTA, payload, sizeof(payload));
+}
+
+// Reads the next buffer of the image and sends it as one pipelined batch
+// of PERFORM_BLE_OTA chunks. Only the acknowledged prefix advances the
+// offset; returns why the transfer has to pause, nullptr if it need not.
+const char* sendChargerOtaBatch() {
+    static const uint16_t MAX_CHUNKS = CHARGER_OTA_BUFFER / (CHARGER_OTA_CHUNK_MIN + CHARGER_OTA_OFFSET_SIZE);
+    PipelineRequest requests[MAX_CHUNKS];
+    bool results[MAX_CHUNKS];
+    uint16_t slotSize = chargerOta.chunkSize + CHARGER_OTA_OFFSET_SIZE;
+    uint16_t maxChunks = chargerOtaChunksPerBuffer(chargerOta.chunkSize, sizeof(chargerOtaBuffer));
+    uint16_t count = 0;
+    
+    while (count < maxChunks && chargerOtaStreamOffset < chargerOta.size) {
+        uint8_t* chunk = chargerOtaBuffer + count * slotSize;
+        size_t len = min((uint32_t)chargerOta.chunkSize, chargerOta.size - chargerOtaStreamOffset);
+        writeU32LE(chunk, chargerOtaStreamOffset);
+        if (!readChargerOtaStream(chunk + CHARGER_OTA_OFFSET_SIZE, len)) return "download interrupted";
+        requests[count++] = {CMD_PERFORM_BLE_OTA, chunk, len + CHARGER_OTA_OFFSET_SIZE};
+    }
+    
+    sendBlePipelined(requests, count, results, chargerOta.window);
+    for (uint16_t i = 0; i < count && results[i]; i++) {
+        chargerOta.offset += requests[i].len - CHARGER_OTA_OFFSET_SIZE;
+    }
+    if (chargerOta.offset == chargerOtaStreamOffset) return nullptr;
+    return bleConnected ? "chunk not acknowledged" : "BLE disconnected";
+}
+
+void finishChargerOta() {
+    closeChargerOtaStream();
+    setLinkHold(false);
+    logf("[OTA] Charger update %s at %u/%u bytes%s%s", getChargerOtaPhaseName(chargerOta.phase),
+         chargerOta.offset, chargerOta.size, chargerOta.error ? ": " : "", chargerOta.error ? chargerOta.error : "");
+    publishChargerOta(getChargerOtaPhaseName(chargerOta.phase));
+}
+
+void pauseChargerOta(const char* reason) {
+    closeChargerOtaStream();
+    if (chargerOta.phase == CHARGER_OTA_FAILED) {
+        finishChargerOta();
+        return;
+    }
+    chargerOtaPause(&chargerOta, reason, millis());
+    logf("[OTA] Charger update paused at %u/%u bytes: %s", chargerOta.offset, chargerOta.size, reason);
+    publishChargerOta("paused");
+}
+
+void startChargerOta() {
+    initChargerOta(&chargerOta, chargerOtaRequestSize, chargerOtaRequestWindow, chargerOtaRequestConfirm, millis());
+    chargerOta.chunkSize = chargerOtaChunkSize(bleMtu);
+    chargerOtaCancel = false;
+    setLinkHold(true);
+    logf("[OTA] Charger update from %s", chargerOtaUrl);
+    publishChargerOta("start");
+}
+
+// Advances the transfer for up to OTA_SLICE_MS per call, so loop()
+// keeps serving gateway OTA, metrics and other requests in between. Port
+// polling and heartbeats continue and interleave between batches.
+void serviceChargerOta() {
+    if (!chargerOtaActive(chargerOta)) return;
+    
+    uint32_t now = millis();
+    if (chargerOtaCancel) {
+        chargerOtaFail(&chargerOta, "cancelled");
+        finishChargerOta();
+        return;
+    }
+    
+    if (chargerOta.phase == CHARGER_OTA_PAUSED) {
+        // BLE setup after a reconnect is complete once polling restarts
+        bool linkUp = bleConnected && pollingActive && wifiConnected;
+        if (!linkUp || now - chargerOta.pausedMs < OTA_RETRY_DELAY) {
+            if (now - chargerOta.pausedMs > OTA_RESUME_TIMEOUT) {
+                chargerOtaFail(&chargerOta, "link down too long");
+                finishChargerOta();
+            }
+            return;
+        }
+        if (chargerOta.resumes >= OTA_MAX_RESUMES) {
+            chargerOtaFail(&chargerOta, "too many interruptions");
+            finishChargerOta();
+            return;
+        }
+        chargerOta.resumes++;
+        chargerOta.chunkSize = chargerOtaChunkSize(bleMtu);
+        chargerOtaRun(&chargerOta, now);
+        publishChargerOta("resumed");
+    }
+    
+    if (chargerOta.phase == CHARGER_OTA_TRANSFER) {
+        if (!chargerOtaStreamOpen && !openChargerOtaStream()) {
+            pauseChargerOta("download failed");
+            return;
+        }
+        if (!chargerOta.started) {
+            uint32_t resumeAt = chargerOta.offset;
+            if (!beginChargerOta()) {
+                if (bleConnected) chargerOtaFail(&chargerOta, "START_OTA refused");
+                pauseChargerOta("BLE disconnected");
+                return;
+            }
+            chargerOta.started = true;
+            if (chargerOta.offset != resumeAt && !openChargerOtaStream()) {
+                pauseChargerOta("download failed");
+                return;
+            }
+        }
+        
+        uint32_t sliceStart = millis();
+        while (chargerOta.offset < chargerOta.size && millis() - sliceStart < OTA_SLICE_MS) {
+            const char* reason = sendChargerOtaBatch();
+            if (reason != nullptr) {
+                pauseChargerOta(reason);
+                return;
+            }
+        }
+        
+        if (chargerOta.offset < chargerOta.size) {
+            if (millis() - chargerOta.lastReportMs >= OTA_PROGRESS_INTERVAL) publishChargerOta("progress");
+            return;
+        }
+        closeChargerOtaStream();
+        chargerOta.phase = chargerOta.confirm ? CHARGER_OTA_CONFIRM : CHARGER_OTA_DONE;
+    }
+    
+    if (chargerOta.phase == CHARGER_OTA_CONFIRM) {
+        if (sendChargerOtaCommand(CMD_CONFIRM_OTA)) {
+            chargerOta.phase = CHARGER_OTA_DONE;
+        } else {
+            chargerOtaFail(&chargerOta, "CONFIRM_OTA not acknowledged");
+        }
+    }
+    finishChargerOta();
+}
+
+// ============ Gateway Pull OTA ============
+void writeGatewayOtaJson(JsonObject out) {
+    uint32_t now = millis();
+    out["phase"] = getGatewayOtaPhaseName(gatewayOta.phase);
+    out["offset"] = gatewayOta.offset;
+    out["size"] = gatewayOta.size;
+    out["percent"] = gatewayOtaPercent(gatewayOta);
+    out["bytes_per_s"] = gatewayOtaRate(gatewayOta, now);
+    out["resumes"] = gatewayOta.resumes;
+    out["verify"] = gatewayOta.verify;
+    out["elapsed_ms"] = now - gatewayOta.startMs;
+    if (gatewayOta.error) out["error"] = gatewayOta.error;
+}
+
+#if OTA_ENABLED
+void publishGatewayOta(const char* event) {
+    gatewayOta.lastReportMs = millis();
+    if (!mqttConnected) return;
+    
+    StaticJsonDocument<512> doc;
+    doc["gateway_id"] = gatewayId;
+    doc["cmd_id"] = gatewayOtaCmdId;
+    doc["event"] = event;
+    doc["version"] = DEVICE_VERSION;
+    writeGatewayOtaJson(doc.as<JsonObject>());
+    doc["timestamp"] = millis();
+    
+    char payload[512];
+    size_t payloadLen = serializeJson(doc, payload, sizeof(payload));
+    String topic = buildMqttTopic(MQTT_TOPIC_OTA);
+    mqttClient.publish(topic.c_str(), MQTT_QOS_COMMAND, false, payload, payloadLen);
+}
+
+void closeGatewayOtaStream() {
+    if (!gatewayOtaStreamOpen) return;
+    gatewayOtaHttp.end();
+    gatewayOtaStreamOpen = false;
+}
+
+// Requests the image from the bytes already written on; fails the update
+// if the image size is unknown or differs from the one being written
+bool openGatewayOtaStream() {
+    closeGatewayOtaStream();
+    uint32_t total;
+    if (!openFirmwareStream(gatewayOtaHttp, gatewayOtaUrl, gatewayOta.offset, gatewayOtaBuffer,
+                            sizeof(gatewayOtaBuffer), &total)) {
+        return false;
+    }
+    gatewayOtaStreamOpen = true;
+    
+    if (gatewayOta.size == 0) gatewayOta.size = total;
+    if (gatewayOta.size == 0 || (total != 0 && total != gatewayOta.size)) {
+        gatewayOtaFail(&gatewayOta, gatewayOta.size == 0 ? "image size unknown" : "image changed");
+        closeGatewayOtaStream();
+        return false;
+    }
+    return true;
+}
+
+void finishGatewayOta() {
+    closeGatewayOtaStream();
+    if (gatewayOta.phase == GATEWAY_OTA_FAILED && Update.isRunning()) Update.abort();
+    mbedtls_sha256_free(&gatewayOtaSha);
+    logf("[OTA] Pull update %s at %u/%u bytes%s%s", getGatewayOtaPhaseName(gatewayOta.phase),
+         gatewayOta.offset, gatewayOta.size, gatewayOta.error ? ": " : "", gatewayOta.error ? gatewayOta.error : "");
+    publishGatewayOta(getGatewayOtaPhaseName(gatewayOta.phase));
+}
+
+void pauseGatewayOta(const char* reason) {
+    closeGatewayOtaStream();
+    if (gatewayOta.phase == GATEWAY_OTA_FAILED) {
+        finishGatewayOta();
+        return;
+    }
+    gatewayOtaPause(&gatewayOta, reason, millis());
+    logf("[OTA] Pull update paused at %u/%u bytes: %s", gatewayOta.offset, gatewayOta.size, reason);
+    publishGatewayOta("paused");
+}
+
+void startGatewayOta() {
+    initGatewayOta(&gatewayOta, gatewayOtaRequestSize, gatewayOtaRequestSha,
+                   millis());
+    gatewayOtaCancel = false;
+    mbedtls_sha256_init(&gatewayOtaSha);
+    mbedtls_sha256_starts(&gatewayOtaSha, 0);
+    logf("[OTA] Pull update from %s", gatewayOtaUrl);
+    publishGatewayOta("start");
+}
+
+// Update.end() checks the image and switches the boot partition. Flash
+// writes stall the other tasks, so this is the only step that pauses BLE
+// polling; the download itself runs alongside it.
+void commitGatewayOta() {
+    gatewayOta.phase = GATEWAY_OTA_COMMIT;
+    publishGatewayOta("commit");
+    
+    otaInProgress = true;
+    stopDataPolling();
+    bool committed = Update.end();
+    otaInProgress = false;
+    
+    if (!committed) {
+        gatewayOtaFail(&gatewayOta, Update.errorString());
+        if (bleConnected) startDataPolling();
+        finishGatewayOta();
+        return;
+    }
+    gatewayOta.phase = GATEWAY_OTA_DONE;
+    finishGatewayOta();
+    publishStatus("ota_complete", "OTA update complete, restarting");
+    delay(1000);    // Let MQTT deliver the last messages
+    ESP.restart();
+}
+
+// Streams up to OTA_SLICE_MS of the download into the Update partition
+// per call, hashing each chunk as it is written. A stalled or dropped
+// download pauses and resumes at the bytes written once WiFi is back.
+void serviceGatewayOta() {
+    if (!gatewayOtaActive(gatewayOta)) return;
+    
+    uint32_t now = millis();
+    if (gatewayOtaCancel) {
+        gatewayOtaFail(&gatewayOta, "cancelled");
+        finishGatewayOta();
+        return;
+    }
+    
+    if (gatewayOta.phase == GATEWAY_OTA_PAUSED) {
+        if (!wifiConnected || now - gatewayOta.pausedMs < OTA_RETRY_DELAY) {
+            if (now - gatewayOta.pausedMs > OTA_RESUME_TIMEOUT) {
+                gatewayOtaFail(&gatewayOta, "WiFi down too long");
+                finishGatewayOta();
+            }
+            return;
+        }
+        if (gatewayOta.resumes >= OTA_MAX_RESUMES) {
+            gatewayOtaFail(&gatewayOta, "too many interruptions");
+            finishGatewayOta();
+            return;
+        }
+        gatewayOta.resumes++;
+        gatewayOtaRun(&gatewayOta, now);
+        publishGatewayOta("resumed");
+    }
+    
+    if (!gatewayOtaStreamOpen && !openGatewayOtaStream()) {
+        pauseGatewayOta("download failed");
+        return;
+    }
+    if (!Update.isRunning() && !Update.begin(gatewayOta.size)) {
+        gatewayOtaFail(&gatewayOta, Update.errorString());
+        finishGatewayOta();
+        return;
+    }
     
-    char payload[256];
-    serializeJson(doc, payload, sizeof(payload));
+    WiFiClient* stream = gatewayOtaHttp.getStreamPtr();
+    uint32_t sliceStart = millis();
+    while (gatewayOta.offset < gatewayOta.size && millis() - sliceStart < OTA_SLICE_MS) {
+        size_t n = min((uint32_t)sizeof(gatewayOtaBuffer), gatewayOta.size - gatewayOta.offset);
+        size_t got = stream->readBytes(gatewayOtaBuffer, n);
+        if (got > 0 && Update.write(gatewayOtaBuffer, got) != got) {
+            gatewayOtaFail(&gatewayOta, Update.errorString());
+            finishGatewayOta();
+            return;
+        }
+        mbedtls_sha256_update(&gatewayOtaSha, gatewayOtaBuffer, got);
+        gatewayOta.offset += got;
+        if (got < n) {
+            pauseGatewayOta("download interrupted");
+            return;
+        }
+    }
     
-    String topic = buildMqttTopic(MQTT_TOPIC_HEARTBEAT);
-    mqttClient.publish(topic.c_str(), MQTT_QOS_TELEMETRY, false, payload);
+    if (gatewayOta.offset < gatewayOta.size) {
+        if (millis() - gatewayOta.lastReportMs >= OTA_PROGRESS_INTERVAL) publishGatewayOta("progress");
+        return;
+    }
+    closeGatewayOtaStream();
+    
+    uint8_t digest[SHA256_SIZE];
+    mbedtls_sha256_finish(&gatewayOtaSha, digest);
+    if (gatewayOta.verify && memcmp(digest, gatewayOta.sha256, SHA256_SIZE) != 0) {
+        gatewayOtaFail(&gatewayOta, "sha256 mismatch");
+        finishGatewayOta();
+        return;
+    }
+    commitGatewayOta();
 }
+#endif
 
-void publishStatus(const char* status, const char* message = nullptr) {
-    if (!mqttConnected) return;
-    
-    StaticJsonDocument<256> doc;
-    doc["gateway_id"] = gatewayId;
-    doc["status"] = status;
-    if (message) doc["message"] = message;
-    doc["ble_connected"] = bleConnected;
-    doc["charger_name"] = chargerDeviceName;
-    doc["timestamp"] = millis();
-    
-    char payload[256];
-    serializeJson(doc, payload, sizeof(payload));
+// ============ Response Decoding ============
+// Writes the payload of a response into doc, using the decoder declared
+// for the service in the command descriptor table
+void decodeResponse(uint8_t service, const BleReply& reply, JsonDocument& doc) {
+    BLEResponse resp;
+    if (reply.length == 0 || !parseResponse(reply.frame, reply.length, &resp)) return;
+    if (!resp.success || resp.payloadLen == 0) return;
     
-    String topic = buildMqttTopic(MQTT_TOPIC_STATUS);
-    mqttClient.publish(topic.c_str(), MQTT_QOS_STATUS, true, payload);
+    JsonObject root = doc.as<JsonObject>();
+    switch (commandDescriptor(service).decoder) {
+        case DECODE_NONE:
+            break;
+        case DECODE_U8:
+            doc["value"] = resp.payload[0];
+            break;
+        case DECODE_STRING: {
+            char text[64];
+            if (parseDeviceModel(resp.payload, resp.payloadLen, text, sizeof(text))) {
+                doc["value"] = text;
+            }
+            break;
+        }
+        case DECODE_UPTIME: {
+            uint32_t uptime = 0;
+            if (parseDeviceUptime(resp.payload, resp.payloadLen, &uptime)) {
+                doc["uptime"] = uptime;
+            }
+            break;
+        }
+        case DECODE_PORT_STATS: {
+            PortInfo ports[CP02_PORT_COUNT];
+            int count = parsePortStatistics(resp.payload, resp.payloadLen, ports, CP02_PORT_COUNT);
+            JsonArray arr = doc.createNestedArray("ports");
+            for (int i = 0; i < count; i++) {
+                JsonObject port = arr.createNestedObject();
+                port["port_id"] = ports[i].portId;
+                port["protocol"] = ports[i].protocol;
+                port["power"] = milliToUnit(ports[i].powerMw, 2);
+            }
+            break;
+        }
+        case DECODE_PD_STATUS: {
+            PdStatusView view;
+            if (decodePdStatus(resp.payload, resp.payloadLen, &view)) {
+                writePdStatusJson(view, doc.createNestedObject("pd_status"));
+            }
+            break;
+        }
+        case DECODE_POWER_SUPPLY: {
+            PowerSupplyStatusView view;
+            if (decodePowerSupplyStatus(resp.payload, resp.payloadLen, &view)) {
+                writePowerSupplyStatusJson(view, root);
+            }
+            break;
+        }
+        case DECODE_CHARGING_STATUS: {
+            ChargingStatusView view;
+            if (decodeChargingStatus(resp.payload, resp.payloadLen, &view)) {
+                writeChargingStatusJson(view, root);
+            }
+            break;
+        }
+        case DECODE_WIFI_STATUS: {
+            WifiStatusView view;
+            if (decodeWifiStatus(resp.payload, resp.payloadLen, &view)) {
+                writeWifiStatusJson(view, root);
+            }
+            break;
+        }
+        case DECODE_PORT_CONFIG: {
+            PortConfigView view;
+            if (decodePortConfig(resp.payload, resp.payloadLen, &view)) {
+                writePortConfigJson(view, root);
+            }
+            break;
+        }
+        case DECODE_STRATEGY: {
+            ChargingStrategyView view;
+            if (decodeChargingStrategy(resp.payload, resp.payloadLen, &view)) {
+                writeChargingStrategyJson(view, root);
+            }
+            break;
+        }
+        case DECODE_PORT_PRIORITY: {
+            PortPriorityView view;
+            if (decodePortPriority(resp.payload, resp.payloadLen, &view)) {
+                writePortPriorityJson(view, root);
+            }
+            break;
+        }
+        case DECODE_TIMESTAMP: {
+            StartChargeTimestampView view;
+            if (decodeStartChargeTimestamp(resp.payload, resp.payloadLen, &view)) {
+                doc["start_timestamp"] = view.timestamp();
+            }
+            break;
+        }
+        case DECODE_POWER_HISTORY: {
+            PowerHistoryView view;
+            if (decodePowerHistory(resp.payload, resp.payloadLen, &view)) {
+                doc["offset"] = view.offset();
+                doc["count"] = view.count();
+            }
+            break;
+        }
+        case DECODE_RAW:
+        default: {
+            JsonArray data = doc.createNestedArray("data");
+            for (size_t i = 0; i < resp.payloadLen && i < 32; i++) {
+                data.add(resp.payload[i]);
+            }
+            break;
+        }
+    }
 }
 
 // ============ MQTT Message Handler ============
@@ -403,12 +2816,15 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
     if (action == nullptr) return;
     
     logf("[MQTT] Command: %s", action);
+    noteLinkActivity();
     
-    StaticJsonDocument<512> respDoc;
+    StaticJsonDocument<1024> respDoc;
     respDoc["gateway_id"] = gatewayId;
     respDoc["action"] = action;
     if (cmdId) respDoc["cmd_id"] = cmdId;
     bool success = false;
+    int queryService = -1;  // Simple GET commands answered via decodeResponse()
+    BleReply reply;         // Response of the command sent for this action
     
     // --- Port Control ---
     if (strcmp(action, "turn_on_port") == 0) {
@@ -430,86 +2846,129 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
         success = sendBleCommand(CMD_RESET_DEVICE);
     }
     else if (strcmp(action, "refresh") == 0 || strcmp(action, "get_device_info") == 0) {
-        fetchPortData();
-        fetchDeviceInfo();
-        publishPortData();
-        publishDeviceInfo();
-        success = true;
+        // Answered from loop() by serveRefresh(), together with any other
+        // refresh that arrives before the fetch completes
+        if (joinRefresh(cmdId, action)) return;
+        respDoc["error"] = "Too many refresh requests pending";
+    }
+    else if (strcmp(action, "get_device_model") == 0) queryService = CMD_GET_DEVICE_MODEL;
+    else if (strcmp(action, "get_device_serial") == 0) queryService = CMD_GET_DEVICE_SERIAL_NO;
+    else if (strcmp(action, "get_ap_version") == 0) queryService = CMD_GET_AP_VERSION;
+    else if (strcmp(action, "get_ble_addr") == 0) queryService = CMD_GET_DEVICE_BLE_ADDR;
+    else if (strcmp(action, "get_device_uptime") == 0) queryService = CMD_GET_DEVICE_UPTIME;
+    else if (strcmp(action, "get_power_supply_status") == 0) queryService = CMD_GET_POWER_SUPPLY_STATUS;
+    else if (strcmp(action, "get_charging_status") == 0) queryService = CMD_GET_CHARGING_STATUS;
+    else if (strcmp(action, "get_port_priority") == 0) {
+        success = refreshShadowSlot(SHADOW_PRIORITIES);
+        if (success) writeShadowPrioritiesJson(respDoc.as<JsonObject>());
     }
-    else if (strcmp(action, "get_device_model") == 0) success = sendBleCommand(CMD_GET_DEVICE_MODEL);
-    else if (strcmp(action, "get_device_serial") == 0) success = sendBleCommand(CMD_GET_DEVICE_SERIAL_NO);
-    else if (strcmp(action, "get_ap_version") == 0) success = sendBleCommand(CMD_GET_AP_VERSION);
-    else if (strcmp(action, "get_ble_addr") == 0) success = sendBleCommand(CMD_GET_DEVICE_BLE_ADDR);
-    else if (strcmp(action, "get_device_uptime") == 0) success = sendBleCommand(CMD_GET_DEVICE_UPTIME);
     
     // --- Display Control ---
+    // Settings go through the shadow: unchanged values are not written and
+    // "written" in the response tells whether a command was sent
     else if (strcmp(action, "set_brightness") == 0 || strcmp(action, "set_display_brightness") == 0) {
-        int brightness = doc["params"]["brightness"] | 50;
-        uint8_t payload[] = {(uint8_t)brightness};
-        success = sendBleCommand(CMD_SET_DISPLAY_INTENSITY, payload, 1);
+        uint8_t brightness = doc["params"]["brightness"] | 50;
+        bool written;
+        success = writeShadowSlot(SHADOW_BRIGHTNESS, &brightness, &written);
+        respDoc["written"] = written;
     }
     else if (strcmp(action, "set_display_mode") == 0) {
-        int mode = doc["params"]["mode"] | 0;
-        uint8_t payload[] = {(uint8_t)mode};
-        success = sendBleCommand(CMD_SET_DISPLAY_MODE, payload, 1);
+        uint8_t mode = doc["params"]["mode"] | 0;
+        bool written;
+        success = writeShadowSlot(SHADOW_DISPLAY_MODE, &mode, &written);
+        respDoc["written"] = written;
     }
     else if (strcmp(action, "flip_display") == 0) {
-        uint8_t payload[] = {1}; // 1 to toggle? Protocol usually expects a value
-        success = sendBleCommand(CMD_SET_DISPLAY_FLIP, payload, 1);
+        // params.flipped sets the orientation; without it the current one is toggled
+        JsonVariant flipped = doc["params"]["flipped"];
+        uint8_t flip = 1;
+        if (!flipped.isNull()) {
+            flip = flipped.as<bool>() ? 1 : 0;
+        } else if (refreshShadowSlot(SHADOW_DISPLAY_FLIP)) {
+            flip = shadow.values[SHADOW_DISPLAY_FLIP] ? 0 : 1;
+        }
+        bool written;
+        success = writeShadowSlot(SHADOW_DISPLAY_FLIP, &flip, &written);
+        respDoc["written"] = written;
+        respDoc["flipped"] = flip != 0;
     }
     else if (strcmp(action, "get_display_settings") == 0) {
-        success = sendBleCommand(CMD_GET_DISPLAY_INTENSITY) && sendBleCommand(CMD_GET_DISPLAY_MODE);
+        success = refreshShadowSlot(SHADOW_BRIGHTNESS) && refreshShadowSlot(SHADOW_DISPLAY_MODE);
+        if (success) {
+            uint8_t settings[] = {shadow.values[SHADOW_BRIGHTNESS], shadow.values[SHADOW_DISPLAY_MODE]};
+            DisplaySettingsView view;
+            if (decodeDisplaySettings(settings, sizeof(settings), &view)) {
+                writeDisplaySettingsJson(view, respDoc.as<JsonObject>());
+            }
+            if (refreshShadowSlot(SHADOW_DISPLAY_FLIP)) respDoc["flipped"] = shadow.values[SHADOW_DISPLAY_FLIP] != 0;
+        }
     }
     
     // --- Strategy Control ---
     else if (strcmp(action, "set_power_mode") == 0 || strcmp(action, "set_charging_strategy") == 0) {
         // params: mode or strategy
-        int mode = doc["params"]["mode"] | doc["params"]["strategy"] | 0;
-        uint8_t payload[] = {(uint8_t)mode};
-        success = sendBleCommand(CMD_SET_CHARGING_STRATEGY, payload, 1);
+        uint8_t mode = doc["params"]["mode"] | doc["params"]["strategy"] | 0;
+        bool written;
+        success = writeShadowSlot(SHADOW_STRATEGY, &mode, &written);
+        respDoc["written"] = written;
     }
     else if (strcmp(action, "set_temp_mode") == 0 || strcmp(action, "set_temperature_mode") == 0) {
         int enabled = doc["params"]["enabled"] | doc["params"]["mode"] | 0;
-        uint8_t payload[] = {(uint8_t)(enabled ? 1 : 0)};
-        success = sendBleCommand(CMD_SET_TEMPERATURE_MODE, payload, 1);
+        uint8_t mode = enabled ? 1 : 0;
+        bool written;
+        success = writeShadowSlot(SHADOW_TEMP_MODE, &mode, &written);
+        respDoc["written"] = written;
     }
     else if (strcmp(action, "get_charging_strategy") == 0) {
-        success = sendBleCommand(CMD_GET_CHARGING_STRATEGY);
+        success = refreshShadowSlot(SHADOW_STRATEGY);
+        ChargingStrategyView view;
+        if (success && decodeChargingStrategy(&shadow.values[SHADOW_STRATEGY], 1, &view)) {
+            writeChargingStrategyJson(view, respDoc.as<JsonObject>());
+        }
     }
     
     // --- Port Priority ---
     else if (strcmp(action, "set_port_priority") == 0) {
-        int portId = doc["params"]["port_id"] | 0;
-        int priority = doc["params"]["priority"] | 0;
-        // Priority command usually takes [port0, port1, port2...] or [port, priority]
-        // Assuming [port_id, priority] based on standard practice, but protocol might differ.
-        // Checking protocol.py... CMD_SET_PORT_PRIORITY payload is list of priorities.
-        // We need to fetch current priorities first to update one? 
-        // For simplicity, let's assume we send [port, priority] or implement a smarter way later.
-        // Actually, if protocol expects all ports, we can't easily set just one without state.
-        // Let's try sending [portId, priority] and hope firmware handles it or we update protocol.h
-        uint8_t payload[] = {(uint8_t)portId, (uint8_t)priority};
-        success = sendBleCommand(CMD_SET_PORT_PRIORITY, payload, 2); 
+        // params.priorities replaces the whole vector; port_id + priority
+        // changes one port and keeps the others
+        JsonArray list = doc["params"]["priorities"];
+        int portId = doc["params"]["port_id"] | -1;
+        bool written = false;
+        if (!list.isNull()) {
+            uint8_t priorities[CP02_PORT_COUNT];
+            if (list.size() == CP02_PORT_COUNT) {
+                for (int i = 0; i < CP02_PORT_COUNT; i++) {
+                    priorities[i] = list[i] | 0;
+                }
+                success = writeShadowSlot(SHADOW_PRIORITIES, priorities, &written);
+            } else {
+                respDoc["error"] = "priorities needs one entry per port";
+            }
+        } else if (portId >= 0 && portId < CP02_PORT_COUNT) {
+            success = writePortPriority(portId, doc["params"]["priority"] | 0, &written);
+        } else {
+            respDoc["error"] = "Invalid port_id";
+        }
+        respDoc["written"] = written;
+        if (success) writeShadowPrioritiesJson(respDoc.as<JsonObject>());
     }
     
     // --- Advanced / Debug ---
     else if (strcmp(action, "get_port_pd_status") == 0) {
         int portId = doc["params"]["port_id"] | 0;
         uint8_t payload[] = {(uint8_t)portId};
-        success = sendBleCommand(CMD_GET_PORT_PD_STATUS, payload, 1);
-        if (success && responseLength > 0) {
-            BLEResponse resp;
-            if (parseResponse(responseBuffer, responseLength, &resp) && resp.payloadLen > 0) {
-                respDoc["pd_status"] = resp.payload[0];
-            }
+        success = sendBleCommand(CMD_GET_PORT_PD_STATUS, payload, 1, &reply);
+        if (success) {
+            respDoc["port_id"] = portId;
+            decodeResponse(CMD_GET_PORT_PD_STATUS, reply, respDoc);
         }
     }
     else if (strcmp(action, "ble_echo_test") == 0) {
         const char* text = doc["params"]["data"] | "echo";
-        success = sendBleCommand(CMD_BLE_ECHO_TEST, (const uint8_t*)text, strlen(text));
-        if (success && responseLength > 0) {
+        success = sendBleCommand(CMD_BLE_ECHO_TEST, (const uint8_t*)text, strlen(text), &reply);
+        if (success && reply.length > 0) {
             BLEResponse resp;
-            if (parseResponse(responseBuffer, responseLength, &resp) && resp.payloadLen > 0) {
+            if (parseResponse(reply.frame, reply.length, &resp) && resp.payloadLen > 0) {
                 char echoData[64];
                 size_t copyLen = min(resp.payloadLen, sizeof(echoData) - 1);
                 memcpy(echoData, resp.payload, copyLen);
@@ -519,33 +2978,203 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
         }
     }
     else if (strcmp(action, "get_debug_log") == 0) {
-        success = sendBleCommand(CMD_GET_DEBUG_LOG);
-        if (success && responseLength > 0) {
-            BLEResponse resp;
-            if (parseResponse(responseBuffer, responseLength, &resp) && resp.payloadLen > 0) {
-                char logData[256];
-                size_t copyLen = min(resp.payloadLen, sizeof(logData) - 1);
-                memcpy(logData, resp.payload, copyLen);
-                logData[copyLen] = '\0';
-                respDoc["log"] = logData;
-            }
+        // Log is streamed from loop() on MQTT_TOPIC_DEBUG_LOG, tagged with cmd_id
+        if (!bleConnected) {
+            respDoc["error"] = "BLE not connected";
+        } else if (debugLogPending || responseStreaming || burstPending) {
+            respDoc["error"] = "Debug log retrieval already running";
+        } else {
+            strlcpy(debugLogCmdId, cmdId ? cmdId : "", sizeof(debugLogCmdId));
+            debugLogPending = true;
+            success = true;
+            respDoc["topic"] = MQTT_TOPIC_DEBUG_LOG;
         }
     }
     else if (strcmp(action, "get_power_curve") == 0 || strcmp(action, "get_power_stats") == 0) {
-        success = sendBleCommand(CMD_GET_POWER_HISTORICAL_STATS);
-        if (success && responseLength > 0) {
-            BLEResponse resp;
-            if (parseResponse(responseBuffer, responseLength, &resp) && resp.payloadLen > 0) {
-                JsonArray curve = respDoc.createNestedArray("curve");
-                for (size_t i = 0; i < resp.payloadLen && i < 24; i++) {
-                    curve.add(resp.payload[i]);
+        // Paged in from loop() by servePowerCurve(), which publishes the full
+        // curve on MQTT_TOPIC_POWER_CURVE and a summary as the reply
+        if (powerCurvePending) {
+            respDoc["error"] = "Power curve fetch already running";
+        } else {
+            strlcpy(powerCurveCmdId, cmdId ? cmdId : "", sizeof(powerCurveCmdId));
+            strlcpy(powerCurveAction, action, sizeof(powerCurveAction));
+            powerCurvePort = doc["params"]["port_id"] | 0;
+            powerCurvePending = true;
+            return;
+        }
+    }
+    else if (strcmp(action, "ble_command") == 0) {
+        // Generic pass-through: {"service": 0x1c, "payload": [..]}, validated
+        // and decoded via the command descriptor table
+        int service = doc["params"]["service"] | -1;
+        JsonArray payload = doc["params"]["payload"];
+        uint8_t cmdData[64];
+        size_t cmdDataLen = 0;
+        for (JsonVariant v : payload) {
+            if (cmdDataLen >= sizeof(cmdData)) break;
+            cmdData[cmdDataLen++] = v.as<uint8_t>();
+        }
+        if (payload.size() > sizeof(cmdData)) {
+            respDoc["error"] = "payload longer than 64 bytes";
+        } else if (service >= 0 && service <= 0xFF) {
+            respDoc["command"] = getCommandName(service);
+            success = sendBleCommand(service, cmdData, cmdDataLen, &reply);
+            if (success) decodeResponse(service, reply, respDoc);
+        } else {
+            respDoc["error"] = "service required";
+        }
+    }
+    else if (strcmp(action, "ble_batch") == 0) {
+        // params.commands: [{"service": 0x1c, "payload": [..]}, ..] sent from
+        // loop() by runBleBatch() with up to params.window of them in flight
+        // (1 = stop-and-wait); it publishes the reply
+        JsonArray commands = doc["params"]["commands"];
+        bool valid = commands.size() > 0 && commands.size() <= PIPELINE_MAX_BATCH;
+        if (batchPending) {
+            respDoc["error"] = "Batch already running";
+        } else {
+            size_t dataLen = 0;
+            uint16_t count = 0;
+            for (JsonObject command : commands) {
+                if (!valid) break;
+                int service = command["service"] | -1;
+                JsonArray payload = command["payload"];
+                valid = service >= 0 && service <= 0xFF && dataLen + payload.size() <= sizeof(batchData);
+                if (!valid) break;
+                batchServices[count] = service;
+                batchLens[count] = payload.size();
+                for (JsonVariant v : payload) {
+                    batchData[dataLen++] = v.as<uint8_t>();
                 }
+                count++;
+            }
+            
+            if (valid) {
+                strlcpy(batchCmdId, cmdId ? cmdId : "", sizeof(batchCmdId));
+                batchCount = count;
+                batchWindow = doc["params"]["window"] | PIPELINE_WINDOW;
+                batchPending = true;
+                return;
             }
+            respDoc["error"] = "commands: 1-16 entries with service and at most 256 payload bytes in total";
+        }
+    }
+    else if (strcmp(action, "charger_ota") == 0) {
+        // Streams a charger image from params.url over BLE, run from loop();
+        // progress arrives on MQTT_TOPIC_CHARGER_OTA
+        const char* url = doc["params"]["url"] | "";
+        int window = doc["params"]["window"] | CHARGER_OTA_WINDOW;
+        if (!bleConnected) {
+            respDoc["error"] = "BLE not connected";
+        } else if (chargerOtaPending || chargerOtaActive(chargerOta) || otaInProgress ||
+                   gatewayOtaPending || gatewayOtaActive(gatewayOta)) {
+            respDoc["error"] = "Update already running";
+        } else if (strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0) {
+            respDoc["error"] = "url required";
+        } else if (strlen(url) >= sizeof(chargerOtaUrl) || window < 1 || window > PIPELINE_MAX_WINDOW) {
+            respDoc["error"] = "url too long or window out of range";
+        } else {
+            strlcpy(chargerOtaCmdId, cmdId ? cmdId : "", sizeof(chargerOtaCmdId));
+            strlcpy(chargerOtaUrl, url, sizeof(chargerOtaUrl));
+            chargerOtaRequestSize = doc["params"]["size"] | 0;
+            chargerOtaRequestWindow = window;
+            chargerOtaRequestConfirm = doc["params"]["confirm"] | true;
+            chargerOtaPending = true;
+            success = true;
+            respDoc["topic"] = MQTT_TOPIC_CHARGER_OTA;
+        }
+    }
+    else if (strcmp(action, "get_charger_ota") == 0) {
+        writeChargerOtaJson(respDoc.createNestedObject("charger_ota"));
+        success = true;
+    }
+    else if (strcmp(action, "cancel_charger_ota") == 0) {
+        success = chargerOtaActive(chargerOta);
+        if (success) {
+            chargerOtaCancel = true;
+        } else {
+            respDoc["error"] = "No update running";
+        }
+    }
+    else if (strcmp(action, "burst_capture") == 0) {
+        // Runs from loop(); results arrive on MQTT_TOPIC_BURST_DATA / _REPORT
+        int duration = doc["params"]["duration_s"] | 10;
+        if (!bleConnected) {
+            respDoc["error"] = "BLE not connected";
+        } else if (burstPending || debugLogPending) {
+            respDoc["error"] = "Another capture is running";
+        } else if (duration < 1 || duration > BURST_MAX_DURATION_S) {
+            respDoc["error"] = "duration_s out of range";
+        } else {
+            strlcpy(burstCmdId, cmdId ? cmdId : "", sizeof(burstCmdId));
+            burstDurationMs = (uint32_t)duration * 1000;
+            burstIncludePd = doc["params"]["include_pd"] | false;
+            burstPdPort = doc["params"]["port_id"] | 0;
+            burstPending = true;
+            success = true;
+            respDoc["duration_s"] = duration;
+        }
+    }
+    else if (strcmp(action, "get_history") == 0) {
+        // Range in gateway uptime seconds (from_s/to_s), or the last last_s
+        // seconds; chunks are streamed from loop() on MQTT_TOPIC_HISTORY
+        uint32_t nowS = millis() / 1000;
+        uint32_t lastS = doc["params"]["last_s"] | 0;
+        uint32_t fromS = lastS > 0 ? (lastS < nowS ? nowS - lastS : 0) : (doc["params"]["from_s"] | 0);
+        uint32_t toS = doc["params"]["to_s"] | nowS;
+        int tier = doc["params"]["tier"] | -1;
+        
+        if (historyPending) {
+            respDoc["error"] = "History retrieval already running";
+        } else if (fromS > toS || tier >= HISTORY_TIER_COUNT) {
+            respDoc["error"] = "Invalid range or tier";
+        } else {
+            strlcpy(historyCmdId, cmdId ? cmdId : "", sizeof(historyCmdId));
+            historyFromS = fromS;
+            historyToS = toS;
+            historyTier = tier >= 0 ? (uint8_t)tier : selectHistoryTier(historyRings, fromS);
+            historyPending = true;
+            success = true;
+            respDoc["tier"] = historyTier;
+            respDoc["period_s"] = historyRings.tiers[historyTier].periodS;
+            respDoc["from_s"] = fromS;
+            respDoc["to_s"] = toS;
+            respDoc["now_s"] = nowS;
+            respDoc["topic"] = MQTT_TOPIC_HISTORY;
+        }
+    }
+    else if (strcmp(action, "get_sessions") == 0) {
+        // Open sessions in the response; closed records are republished on
+        // MQTT_TOPIC_SESSION as "history" events, oldest first
+        JsonArray open = respDoc.createNestedArray("open");
+        for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+            const PortSession& s = sessions.ports[i];
+            if (s.state == SESSION_IDLE) continue;
+            JsonObject entry = open.createNestedObject();
+            entry["port_id"] = i;
+            entry["state"] = s.state == SESSION_TAPER ? "taper" : "charging";
+            entry["protocol"] = getProtocolName(s.protocol);
+            entry["duration_s"] = (s.lastMs - s.record.startMs) / 1000;
+            entry["energy_wh"] = milliToUnit((uint32_t)(s.energyUj / 3600000), 3);
+            entry["peak_power"] = milliToUnit(s.record.peakPowerMw, 2);
         }
+        
+        for (int i = sessions.historyCount - 1; i >= 0 && mqttConnected; i--) {
+            StaticJsonDocument<512> recordDoc;
+            recordDoc["gateway_id"] = gatewayId;
+            recordDoc["event"] = "history";
+            writeSessionRecordJson(*sessionHistoryAt(sessions, i), recordDoc.as<JsonObject>());
+            
+            char recordPayload[512];
+            serializeJson(recordDoc, recordPayload, sizeof(recordPayload));
+            mqttClient.publish(buildMqttTopic(MQTT_TOPIC_SESSION).c_str(), MQTT_QOS_STATUS, false, recordPayload);
+        }
+        respDoc["history_count"] = sessions.historyCount;
+        success = true;
     }
     else if (strcmp(action, "get_temp_info") == 0) {
         int portId = doc["params"]["port_id"] | 0;
-        if (portId >= 0 && portId < 5 && portData[portId].temperature != 0) {
+        if (portId >= 0 && portId < CP02_PORT_COUNT && portData[portId].temperature != 0) {
             success = true;
             respDoc["temperature"] = portData[portId].temperature;
             respDoc["port_id"] = portId;
@@ -556,22 +3185,97 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
     }
     else if (strcmp(action, "get_port_config") == 0) {
         int portId = doc["params"]["port_id"] | 0;
-        uint8_t payload[] = {(uint8_t)portId};
-        success = sendBleCommand(CMD_GET_PORT_CONFIG, payload, 1);
-        if (success && responseLength > 0) {
-            BLEResponse resp;
-            if (parseResponse(responseBuffer, responseLength, &resp) && resp.payloadLen >= 2) {
-                respDoc["port_id"] = portId;
-                respDoc["protocol"] = resp.payload[0];
-                respDoc["priority"] = resp.payload[1];
+        success = portId >= 0 && portId < CP02_PORT_COUNT && refreshShadowSlot(SHADOW_PORT_CONFIG + portId);
+        if (success) writeShadowPortConfigJson(portId, respDoc.as<JsonObject>());
+    }
+    else if (strcmp(action, "set_port_config") == 0) {
+        // params.protocols (names) replaces the port's protocol set;
+        // enable/disable change single protocols on top of the current one
+        int portId = doc["params"]["port_id"] | -1;
+        JsonArray protocols = doc["params"]["protocols"];
+        JsonArray enable = doc["params"]["enable"];
+        JsonArray disable = doc["params"]["disable"];
+        bool replace = protocols.size() > 0;
+        
+        if (portId < 0 || portId >= CP02_PORT_COUNT) {
+            respDoc["error"] = "Invalid port_id";
+        } else if (!replace && !refreshShadowSlot(SHADOW_PORT_CONFIG + portId)) {
+            respDoc["error"] = "Port config unavailable";
+        } else {
+            uint8_t features[SHADOW_FEATURE_BYTES] = {0};
+            if (!replace) memcpy(features, shadow.portFeatures[portId], SHADOW_FEATURE_BYTES);
+            const char* unknown = nullptr;
+            for (JsonVariant name : protocols) {
+                if (!setPortFeature(features, name | "", true)) unknown = name | "";
+            }
+            for (JsonVariant name : enable) {
+                if (!setPortFeature(features, name | "", true)) unknown = name | "";
+            }
+            for (JsonVariant name : disable) {
+                if (!setPortFeature(features, name | "", false)) unknown = name | "";
+            }
+            
+            if (unknown != nullptr) {
+                respDoc["error"] = "Unknown protocol";
+                respDoc["protocol"] = unknown;
+            } else {
+                bool written;
+                success = writeShadowSlot(SHADOW_PORT_CONFIG + portId, features, &written);
+                respDoc["written"] = written;
+                if (success) writeShadowPortConfigJson(portId, respDoc.as<JsonObject>());
             }
         }
     }
-    else if (strcmp(action, "set_port_config") == 0) {
-        int portId = doc["params"]["port_id"] | 0;
-        int protocol = doc["params"]["protocol"] | 0;
-        uint8_t payload[] = {(uint8_t)portId, (uint8_t)protocol};
-        success = sendBleCommand(CMD_SET_PORT_CONFIG, payload, 2);
+    else if (strcmp(action, "get_ble_stats") == 0) {
+        respDoc["transactions"] = bleStats.transactions;
+        respDoc["coalesced"] = bleStats.coalesced;
+        respDoc["saved"] = bleStats.saved;
+        respDoc["stale"] = bleStats.stale;
+        writeRttEstimatesJson(respDoc.createNestedArray("timeouts"));
+        writePipelineStatsJson(pipelineTotals, respDoc.createNestedObject("pipeline"));
+        success = true;
+    }
+    else if (strcmp(action, "get_metrics") == 0) {
+        // Full document goes out on MQTT_TOPIC_METRICS; reset: true starts
+        // a new counting period afterwards
+        publishMetrics();
+        if (doc["params"]["reset"] | false) initLinkMetrics(&linkMetrics, millis());
+        respDoc["topic"] = MQTT_TOPIC_METRICS;
+        success = true;
+    }
+    else if (strcmp(action, "get_link_profile") == 0) {
+        writeLinkProfileJson(respDoc.as<JsonObject>());
+        success = true;
+    }
+    else if (strcmp(action, "set_link_profile") == 0) {
+        // params.profile: "burst" or "idle" pins the link, "auto" follows activity
+        uint8_t pinned = parseLinkProfile(doc["params"]["profile"] | "");
+        if (pinned <= LINK_PROFILE_AUTO) {
+            linkProfile.pinned = pinned;
+            preferences.putUChar("link_pin", pinned);
+            updateLinkProfile();
+            writeLinkProfileJson(respDoc.as<JsonObject>());
+            success = true;
+        } else {
+            respDoc["error"] = "profile must be burst, idle or auto";
+        }
+    }
+    else if (strcmp(action, "get_cache_stats") == 0) {
+        writeCacheStatsJson(respDoc.as<JsonObject>());
+        if (doc["params"]["clear"] | false) {
+            cacheInvalidate(&responseCache, CACHE_ALL);
+            memset(&responseCache.stats, 0, sizeof(responseCache.stats));
+        }
+        success = true;
+    }
+    else if (strcmp(action, "get_shadow") == 0) {
+        // Re-reads stale slots (all of them with refresh: true) and
+        // republishes the retained shadow document
+        if (doc["params"]["refresh"] | false) shadowInvalidate(&shadow);
+        refreshShadow();
+        publishShadow(true);
+        success = true;
+        respDoc["version"] = shadow.version;
     }
     else if (strcmp(action, "get_wifi_status") == 0) {
         success = true;
@@ -579,6 +3283,15 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
         respDoc["ssid"] = WiFi.SSID();
         respDoc["rssi"] = WiFi.RSSI();
         respDoc["ip"] = WiFi.localIP().toString();
+        // Charger's own WiFi state, if it answers
+        if (bleConnected && sendBleCommand(CMD_GET_WIFI_STATUS, nullptr, 0, &reply)) {
+            BLEResponse resp;
+            WifiStatusView view;
+            if (parseResponse(reply.frame, reply.length, &resp) && resp.success &&
+                decodeWifiStatus(resp.payload, resp.payloadLen, &view)) {
+                writeWifiStatusJson(view, respDoc.createNestedObject("charger"));
+            }
+        }
     }
     else if (strcmp(action, "scan_wifi") == 0) {
         int n = WiFi.scanNetworks();
@@ -607,6 +3320,30 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
             respDoc["error"] = "SSID required";
         }
     }
+    else if (strcmp(action, "set_charger_wifi") == 0) {
+        // Charger expects "ssid\0password\0"; sent as segments, no staging copy
+        const char* ssid = doc["params"]["ssid"];
+        const char* password = doc["params"]["password"] | "";
+        if (ssid && strlen(ssid) > 0) {
+            static const uint8_t nul = 0;
+            PayloadSegment segments[] = {
+                {(const uint8_t*)ssid, strlen(ssid)}, {&nul, 1},
+                {(const uint8_t*)password, strlen(password)}, {&nul, 1}
+            };
+            success = sendBleCommandSegments(CMD_SET_WIFI_SSID_AND_PASSWORD, segments, 4);
+        } else {
+            respDoc["error"] = "SSID required";
+        }
+    }
+    else if (strcmp(action, "push_license") == 0) {
+        const char* license = doc["params"]["license"];
+        if (license && strlen(license) > 0) {
+            PayloadSegment segment = {(const uint8_t*)license, strlen(license)};
+            success = sendBleCommandSegments(CMD_PUSH_LICENSE, &segment, 1);
+        } else {
+            respDoc["error"] = "license required";
+        }
+    }
     else if (strcmp(action, "connect_to") == 0) {
         const char* deviceName = doc["params"]["device_name"];
         if (deviceName && strlen(deviceName) > 0) {
@@ -642,6 +3379,103 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
             success = true;
         }
     }
+    else if (strcmp(action, "set_poll_interval") == 0) {
+        uint32_t minMs = doc["params"]["min_ms"] | pollScheduler.minIntervalMs;
+        uint32_t maxMs = doc["params"]["max_ms"] | pollScheduler.maxIntervalMs;
+        if (minMs >= 100 && maxMs >= minMs && maxMs <= 600000) {
+            initPollScheduler(&pollScheduler, minMs, maxMs);
+            preferences.putUInt("poll_min", minMs);
+            preferences.putUInt("poll_max", maxMs);
+            success = true;
+            respDoc["min_ms"] = minMs;
+            respDoc["max_ms"] = maxMs;
+        } else {
+            respDoc["error"] = "Require 100 <= min_ms <= max_ms <= 600000";
+        }
+    }
+    else if (strcmp(action, "set_rules") == 0) {
+        // params.rules: array of rule texts (see rules.h); replaces the whole set
+        JsonArray texts = doc["params"]["rules"];
+        Rule rules[RULE_MAX_RULES];
+        uint8_t count = 0;
+        success = texts.size() <= RULE_MAX_RULES;
+        if (!success) respDoc["error"] = "Too many rules";
+        
+        for (JsonVariant text : texts) {
+            if (!success) break;
+            const char* str = text.as<const char*>();
+            if (str == nullptr || strlen(str) >= RULE_TEXT_MAX || !compileRule(str, &rules[count])) {
+                success = false;
+                respDoc["error"] = "Invalid rule";
+                respDoc["index"] = count;
+                break;
+            }
+            count++;
+        }
+        if (success) {
+            xSemaphoreTake(rulesLock, portMAX_DELAY);
+            setRules(&ruleEngine, rules, count);
+            xSemaphoreGive(rulesLock);
+            if (count > 0) {
+                preferences.putBytes("rules", rules, count * sizeof(Rule));
+            } else {
+                preferences.remove("rules");
+            }
+            respDoc["count"] = count;
+        }
+    }
+    else if (strcmp(action, "get_rules") == 0) {
+        JsonArray texts = respDoc.createNestedArray("rules");
+        for (uint8_t i = 0; i < ruleEngine.count; i++) {
+            char text[RULE_TEXT_MAX];
+            formatRule(ruleEngine.rules[i], text, sizeof(text));
+            texts.add(text);
+        }
+        success = true;
+    }
+    else if (strcmp(action, "set_allocator") == 0) {
+        // params: enabled, budget_w (0 = no cap), hysteresis_w
+        bool enabled = doc["params"]["enabled"] | allocator.enabled;
+        float budgetW = doc["params"]["budget_w"] | allocator.budgetMw / 1000.0f;
+        float hysteresisW = doc["params"]["hysteresis_w"] | allocator.hysteresisMw / 1000.0f;
+        
+        if (budgetW >= 0 && hysteresisW >= 0) {
+            // Ports shed by the controller are handed back when it stops;
+            // one that cannot be turned on stays listed (and is restored
+            // if the controller is enabled again)
+            if (!enabled) {
+                while (allocator.shedCount > 0) {
+                    uint8_t payload[] = {allocator.shedOrder[allocator.shedCount - 1]};
+                    if (!sendBleCommand(CMD_TURN_ON_PORT, payload, 1)) break;
+                    allocator.shedCount--;
+                }
+            }
+            uint32_t budgetMw = (uint32_t)(budgetW * 1000);
+            uint32_t hysteresisMw = (uint32_t)(hysteresisW * 1000);
+            configurePowerAllocator(&allocator, enabled, budgetMw, hysteresisMw);
+            preferences.putBool("alloc_en", enabled);
+            preferences.putUInt("alloc_budget", budgetMw);
+            preferences.putUInt("alloc_hyst", hysteresisMw);
+            success = true;
+            respDoc["enabled"] = enabled;
+            writeAllocatorMetricsJson(respDoc.as<JsonObject>());
+        } else {
+            respDoc["error"] = "budget_w and hysteresis_w must be >= 0";
+        }
+    }
+    else if (strcmp(action, "get_allocator") == 0) {
+        respDoc["enabled"] = allocator.enabled;
+        writeAllocatorMetricsJson(respDoc.as<JsonObject>());
+        JsonArray priorities = respDoc.createNestedArray("priorities");
+        for (int i = 0; i < CP02_PORT_COUNT; i++) {
+            priorities.add(allocator.priorities[i]);
+        }
+        JsonArray shed = respDoc.createNestedArray("shed_ports");
+        for (uint8_t i = 0; i < allocator.shedCount; i++) {
+            shed.add(allocator.shedOrder[i]);
+        }
+        success = true;
+    }
     else if (strcmp(action, "set_token") == 0) {
         int token = doc["params"]["token"] | -1;
         if (token >= 0 && token <= 255) {
@@ -669,22 +3503,64 @@ void onMqttMessage(char* topic, char* payload, AsyncMqttClientMessageProperties
         ESP.restart();
     }
     else if (strcmp(action, "ota_update") == 0) {
-        // ... (OTA logic remains same) ...
-        success = false; 
-        respDoc["error"] = "OTA not fully implemented in this block";
+#if OTA_ENABLED
+        // Pulls the gateway image from params.url, run from loop(); progress
+        // arrives on MQTT_TOPIC_OTA, the gateway restarts once it is committed
+        const char* url = doc["params"]["url"] | "";
+        const char* sha256 = doc["params"]["sha256"] | "";
+        if (gatewayOtaPending || gatewayOtaActive(gatewayOta) || otaInProgress ||
+            chargerOtaPending || chargerOtaActive(chargerOta)) {
+            respDoc["error"] = "Update already running";
+        } else if (strncmp(url, "http://", 7) != 0 && strncmp(url, "https://", 8) != 0) {
+            respDoc["error"] = "url required";
+        } else if (strlen(url) >= sizeof(gatewayOtaUrl)) {
+            respDoc["error"] = "url too long";
+        } else if (!parseSha256Hex(sha256, gatewayOtaRequestSha)) {
+            // Never commit an image that cannot be checked
+            respDoc["error"] = "sha256 (64 hex digits) required";
+        } else {
+            strlcpy(gatewayOtaCmdId, cmdId ? cmdId : "", sizeof(gatewayOtaCmdId));
+            strlcpy(gatewayOtaUrl, url, sizeof(gatewayOtaUrl));
+            gatewayOtaRequestSize = doc["params"]["size"] | 0;
+            gatewayOtaPending = true;
+            success = true;
+            respDoc["topic"] = MQTT_TOPIC_OTA;
+        }
+#else
+        respDoc["error"] = "OTA disabled";
+#endif
+    }
+    else if (strcmp(action, "get_ota") == 0) {
+        writeGatewayOtaJson(respDoc.createNestedObject("ota"));
+        success = true;
+    }
+    else if (strcmp(action, "cancel_ota") == 0) {
+        success = gatewayOtaActive(gatewayOta) && gatewayOta.phase != GATEWAY_OTA_COMMIT;
+        if (success) {
+            gatewayOtaCancel = true;
+        } else {
+            respDoc["error"] = "No download running";
+        }
     }
     else {
         respDoc["error"] = "Unknown action";
     }
     
+    if (queryService >= 0) {
+        success = sendBleCommand(queryService, nullptr, 0, &reply);
+        if (success) decodeResponse(queryService, reply, respDoc);
+    }
+    
     respDoc["success"] = success;
     respDoc["timestamp"] = millis();
     
-    char respPayload[512];
+    char respPayload[1024];
     serializeJson(respDoc, respPayload, sizeof(respPayload));
     
     String respTopic = buildMqttTopic(MQTT_TOPIC_CMD_RESPONSE);
     mqttClient.publish(respTopic.c_str(), MQTT_QOS_COMMAND, false, respPayload);
+    
+    publishShadow();
 }
 
 // ============ MQTT Callbacks ============
@@ -762,7 +3638,17 @@ class BleClientCallbacks : public NimBLEClientCallbacks {
     void onDisconnect(NimBLEClient* pClient) override {
         log("[BLE] Disconnected from charger");
         bleConnected = false;
+        bleMtu = BLE_ATT_MTU_DEFAULT;
+        chargerOta.started = false;     // START_OTA again before resuming
         stopDataPolling();
+        shadowInvalidate(&shadow);
+        cacheInvalidate(&responseCache, CACHE_ALL);
+        
+        for (uint8_t i = 0; i < CP02_PORT_COUNT; i++) {
+            if (endPortSession(&sessions, i, SESSION_END_LOST)) {
+                markSessionPending(&sessionEndPending, i);
+            }
+        }
         
         if (mqttConnected) {
             publishStatus("ble_disconnected", "Charger disconnected");
@@ -818,6 +3704,11 @@ void scanAndConnectBle() {
         pBleClient->setClientCallbacks(&bleClientCallbacks);
     }
     
+    // Connection setup (token, MTU, device info, shadow) is a burst
+    const ConnParams& burst = linkProfileParams(LINK_PROFILE_BURST);
+    pBleClient->setConnectionParams(burst.minInterval, burst.maxInterval, burst.latency, burst.timeout);
+    setLinkProfile(&linkProfile, LINK_PROFILE_BURST, millis());
+    
     logf("[BLE] Connecting to %s...", chargerDeviceName.c_str());
     
     if (!pBleClient->connect(targetDevice)) {
@@ -866,11 +3757,14 @@ void scanAndConnectBle() {
         }
     }
     
+    negotiateMtu();
     fetchDeviceInfo();
+    refreshShadow();
     
     if (mqttConnected) {
         publishStatus("ble_connected", chargerDeviceName.c_str());
         publishDeviceInfo();
+        publishShadow(true);
         ledOn();
     }
     
@@ -878,13 +3772,45 @@ void scanAndConnectBle() {
 }
 
 // ============ Data Polling ============
+// dataPollingTimer only flags the poll: it fires in the esp_timer task,
+// which must not wait on bleLock behind a pipelined batch or carry the
+// rule and allocator writes. The poll itself runs in loop().
 void dataPollingCallback() {
-    if (!bleConnected || otaInProgress) return;
-    
-    fetchPortData();
+    pollPending = true;
+}
+
+void pollChargerData() {
+    if (bleConnected && !otaInProgress) {
+        PortSnapshot prev = portSnapshot;
+        if (fetchPortData()) {
+            updateSessions();
+            
+            // Held through the actions too, which name the rule by index
+            xSemaphoreTake(rulesLock, portMAX_DELAY);
+            RuleFiring firings[RULE_MAX_RULES];
+            uint8_t fired = evaluateRules(&ruleEngine, portSnapshot, firings, RULE_MAX_RULES);
+            if (fired > 0) runRuleActions(firings, fired);
+            xSemaphoreGive(rulesLock);
+            
+            runAllocator();
+            publishShadow();
+        }
+        updatePollInterval(&pollScheduler, prev, portSnapshot);
+        
+        if (mqttConnected) {
+            publishPortData();
+        }
+        
+        if (millis() - energy.window.startMs >= AGGREGATE_WINDOW_MS) {
+            publishAggregate();
+            resetEnergyWindow(&energy, millis());
+        }
+    }
     
-    if (mqttConnected) {
-        publishPortData();
+    // One-shot, re-armed after each poll so the interval can follow port
+    // activity
+    if (pollingActive) {
+        dataPollingTimer.once_ms(pollScheduler.intervalMs, dataPollingCallback);
     }
 }
 
@@ -895,12 +3821,16 @@ void heartbeatCallback() {
 }
 
 void startDataPolling() {
-    dataPollingTimer.attach_ms(POLL_INTERVAL_PORTS, dataPollingCallback);
+    pollingActive = true;
+    pollScheduler.intervalMs = pollScheduler.minIntervalMs;
+    dataPollingTimer.once_ms(pollScheduler.intervalMs, dataPollingCallback);
     heartbeatTimer.attach_ms(POLL_INTERVAL_HEARTBEAT, heartbeatCallback);
     log("[POLL] Data polling started");
 }
 
 void stopDataPolling() {
+    pollingActive = false;
+    pollPending = false;
     dataPollingTimer.detach();
     heartbeatTimer.detach();
     log("[POLL] Data polling stopped");
@@ -1051,6 +3981,9 @@ void setup() {
     strncpy(mqttPass, savedPass.c_str(), sizeof(mqttPass) - 1);
     strncpy(gatewayId, savedGwId.c_str(), sizeof(gatewayId) - 1);
     
+    initPollScheduler(&pollScheduler, preferences.getUInt("poll_min", POLL_INTERVAL_MIN),
+                      preferences.getUInt("poll_max", POLL_INTERVAL_MAX));
+    
     logf("  Gateway ID: %s", gatewayId);
     logf("  MQTT Host: %s:%s", mqttHost, mqttPort);
     log("========================================\n");
@@ -1066,13 +3999,52 @@ void setup() {
     
     // Initialize port data
     memset(&deviceInfo, 0, sizeof(deviceInfo));
-    for (int i = 0; i < 5; i++) {
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
         memset(&portData[i], 0, sizeof(PortInfo));
         portData[i].portId = i;
     }
+    memset(&portSnapshot, 0, sizeof(portSnapshot));
+    initEnergyIntegrator(&energy, millis());
+    initSessionTracker(&sessions);
+    initChargerShadow(&shadow);
+    initResponseCache(&responseCache);
+    initLinkMetrics(&linkMetrics, millis());
+    initLinkProfile(&linkProfile, preferences.getUChar("link_pin", LINK_PROFILE_AUTO), millis());
+    for (RttEstimator& est : rttEstimators) {
+        initRttEstimator(&est);
+    }
+    bleLock = xSemaphoreCreateMutex();
+    rulesLock = xSemaphoreCreateMutex();
+    pipelineResponses = xQueueCreate(PIPELINE_MAX_WINDOW * 2, sizeof(PipelineResponse));
+    if (!initHistoryRings(&historyRings)) {
+        log("[HIST] History rings could not be fully allocated");
+    }
+    
+    initPowerAllocator(&allocator, preferences.getBool("alloc_en", false),
+                       preferences.getUInt("alloc_budget", 0),
+                       preferences.getUInt("alloc_hyst", ALLOC_HYSTERESIS_MW));
+    
+    // Compiled rules; a size that is not a whole number of records, or a
+    // record that fails ruleValid, is left over from another firmware
+    // layout (or corrupted) and the whole set is ignored
+    Rule savedRules[RULE_MAX_RULES];
+    size_t rulesLen = preferences.getBytesLength("rules");
+    if (rulesLen > 0 && rulesLen <= sizeof(savedRules) && rulesLen % sizeof(Rule) == 0) {
+        preferences.getBytes("rules", savedRules, rulesLen);
+        uint8_t savedCount = rulesLen / sizeof(Rule);
+        uint8_t valid = 0;
+        while (valid < savedCount && ruleValid(savedRules[valid])) valid++;
+        if (valid == savedCount) {
+            setRules(&ruleEngine, savedRules, savedCount);
+            logf("[RULE] Loaded %u rules", ruleEngine.count);
+        } else {
+            logf("[RULE] Saved rule %u is invalid, ignoring saved rules", valid);
+        }
+    }
     
     // Initialize BLE
     NimBLEDevice::init(DEVICE_NAME);
+    NimBLEDevice::setMTU(BLE_ATT_MTU_PREFERRED);   // Exchanged by the client on connect
     log("[BLE] Initialized");
     
     // Setup WiFiManager
@@ -1165,5 +4137,72 @@ void loop() {
     // Check reset button
     checkResetButton();
     
+    if (debugLogPending) {
+        setLinkHold(true);
+        streamDebugLog();
+        setLinkHold(false);
+        debugLogPending = false;
+    }
+    
+    if (burstPending) {
+        setLinkHold(true);
+        runBurstCapture();
+        setLinkHold(false);
+        burstPending = false;
+    }
+    
+    if (historyPending) {
+        streamHistory();
+        historyPending = false;
+    }
+    
+    if (refreshPending) {
+        serveRefresh();
+    }
+    
+    if (sessionStartPending || sessionEndPending) {
+        serviceSessions();
+    }
+    
+    if (pollPending) {
+        pollPending = false;
+        pollChargerData();
+    }
+    
+    if (batchPending) {
+        runBleBatch();
+        batchPending = false;
+    }
+    
+    if (powerCurvePending) {
+        servePowerCurve();
+        powerCurvePending = false;
+    }
+    
+    if (chargerOtaPending) {
+        startChargerOta();
+        chargerOtaPending = false;
+    }
+    serviceChargerOta();
+    
+#if OTA_ENABLED
+    if (gatewayOtaPending) {
+        startGatewayOta();
+        gatewayOtaPending = false;
+    }
+    serviceGatewayOta();
+#endif
+    
+    updateLinkProfile();
+    
+    if (millis() - lastRssiSampleMs >= LINK_RSSI_INTERVAL) {
+        sampleLinkRssi();
+        lastRssiSampleMs = millis();
+    }
+    if (millis() - lastMetricsPublishMs >= LINK_METRICS_INTERVAL && !otaInProgress) {
+        publishMetrics();
+        lastMetricsPublishMs = millis();
+    }
+    
     delay(100);
 }
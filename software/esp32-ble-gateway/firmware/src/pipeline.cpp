@@ -0,0 +1,109 @@
+#include "pipeline.h"
+#include <string.h>
+
+void initPipeline(Pipeline* pipe, uint8_t window, uint32_t nowMs) {
+    memset(pipe, 0, sizeof(Pipeline));
+    pipe->window = constrain(window, 1, PIPELINE_MAX_WINDOW);
+    pipe->stopAndWait = pipe->window == 1;
+    pipe->lastProgressMs = nowMs;
+}
+
+static void fallBack(Pipeline* pipe) {
+    if (pipe->stopAndWait) return;
+    pipe->stopAndWait = true;
+    pipe->stats.fallbacks++;
+}
+
+static int oldestSlot(const Pipeline* pipe) {
+    int oldest = -1;
+    for (uint8_t i = 0; i < PIPELINE_MAX_WINDOW; i++) {
+        if (!pipe->slots[i].used) continue;
+        if (oldest < 0 || pipe->slots[i].seq < pipe->slots[oldest].seq) oldest = i;
+    }
+    return oldest;
+}
+
+static void releaseSlot(Pipeline* pipe, int index, PipelineSlot* out) {
+    *out = pipe->slots[index];
+    pipe->slots[index].used = false;
+    pipe->outstanding--;
+}
+
+static void retireMsgId(Pipeline* pipe, uint8_t msgId) {
+    pipe->retired[pipe->retiredHead] = msgId;
+    pipe->retiredHead = (pipe->retiredHead + 1) % PIPELINE_RETIRED_IDS;
+    if (pipe->retiredCount < PIPELINE_RETIRED_IDS) pipe->retiredCount++;
+}
+
+// Finds msgId among the retired ones; removes it when remove is set
+static bool findRetired(Pipeline* pipe, uint8_t msgId, bool remove) {
+    for (uint8_t i = 0; i < pipe->retiredCount; i++) {
+        uint8_t index = (pipe->retiredHead + PIPELINE_RETIRED_IDS - 1 - i) % PIPELINE_RETIRED_IDS;
+        if (pipe->retired[index] != msgId) continue;
+        // Overwriting with the newest entry keeps the set contiguous
+        if (remove) {
+            pipe->retiredHead = (pipe->retiredHead + PIPELINE_RETIRED_IDS - 1) % PIPELINE_RETIRED_IDS;
+            pipe->retired[index] = pipe->retired[pipe->retiredHead];
+            pipe->retiredCount--;
+        }
+        return true;
+    }
+    return false;
+}
+
+uint8_t pipelineCredits(const Pipeline& pipe) {
+    uint8_t window = pipe.stopAndWait ? 1 : pipe.window;
+    return pipe.outstanding < window ? window - pipe.outstanding : 0;
+}
+
+void pipelineSent(Pipeline* pipe, uint8_t msgId, uint16_t request, uint8_t attempts, uint32_t nowMs) {
+    for (PipelineSlot& slot : pipe->slots) {
+        if (slot.used) continue;
+        findRetired(pipe, msgId, true);     // msgId wrapped around: a reply is for this send now
+        slot = {true, msgId, attempts, request, pipe->nextSeq++, nowMs};
+        pipe->outstanding++;
+        pipe->stats.sent++;
+        pipe->lastProgressMs = nowMs;
+        return;
+    }
+}
+
+bool pipelineComplete(Pipeline* pipe, uint8_t msgId, bool ok, uint32_t nowMs, PipelineSlot* done) {
+    int index = -1;
+    for (uint8_t i = 0; i < PIPELINE_MAX_WINDOW && index < 0; i++) {
+        if (pipe->slots[i].used && pipe->slots[i].msgId == msgId) index = i;
+    }
+    if (index < 0) {
+        if (findRetired(pipe, msgId, false)) {
+            pipe->stats.late++;
+        } else {
+            pipe->stats.mismatches++;
+            fallBack(pipe);
+        }
+        return false;
+    }
+    
+    releaseSlot(pipe, index, done);
+    pipe->lastProgressMs = nowMs;
+    pipe->stats.completed++;
+    if (!ok) {
+        pipe->stats.naks++;
+        fallBack(pipe);
+    }
+    return true;
+}
+
+bool pipelineExpire(Pipeline* pipe, uint32_t timeoutMs, uint32_t nowMs, PipelineSlot* dropped) {
+    int index = oldestSlot(pipe);
+    if (index < 0) return false;
+    
+    uint32_t since = max(pipe->slots[index].sentMs, pipe->lastProgressMs);
+    if (nowMs - since < timeoutMs) return false;
+    
+    releaseSlot(pipe, index, dropped);
+    retireMsgId(pipe, dropped->msgId);
+    pipe->lastProgressMs = nowMs;
+    pipe->stats.drops++;
+    fallBack(pipe);
+    return true;
+}
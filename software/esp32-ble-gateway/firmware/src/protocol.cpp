@@ -1,4 +1,5 @@
 #include "protocol.h"
+#include "command_table.h"
 #include <string.h>
 
 const char* CP02_SERVICE_UUID = "048e3f2e-e1a6-4707-9e74-a930e898a1ea";
@@ -28,31 +29,61 @@ uint8_t calcChecksum(const uint8_t* header, size_t len) {
     return sum & 0xFF;
 }
 
+void writeFrameHeader(uint8_t* header, uint8_t version, uint8_t msgId, uint8_t service,
+                      uint8_t sequence, uint8_t flags, uint32_t payloadLen) {
+    header[0] = version;
+    header[1] = msgId;
+    header[2] = service;
+    header[3] = sequence;
+    header[4] = flags;
+    header[5] = (payloadLen >> 16) & 0xFF;
+    header[6] = (payloadLen >> 8) & 0xFF;
+    header[7] = payloadLen & 0xFF;
+    header[8] = 0;
+    
+    header[8] = calcChecksum(header, 9);
+}
+
 size_t buildMessage(uint8_t* buffer, size_t bufferSize,
                     uint8_t version, uint8_t msgId, uint8_t service,
                     uint8_t sequence, uint8_t flags,
                     const uint8_t* payload, size_t payloadLen) {
+    PayloadSegment segment = {payload, payload != nullptr ? payloadLen : 0};
+    return buildMessageSegments(buffer, bufferSize, version, msgId, service,
+                                sequence, flags, &segment, 1);
+}
+
+size_t buildMessageSegments(uint8_t* buffer, size_t bufferSize,
+                            uint8_t version, uint8_t msgId, uint8_t service,
+                            uint8_t sequence, uint8_t flags,
+                            const PayloadSegment* segments, size_t segmentCount) {
+    size_t payloadLen = 0;
+    for (size_t i = 0; i < segmentCount; i++) {
+        if (segments[i].len > 0 && segments[i].data == nullptr) return 0;
+        payloadLen += segments[i].len;
+    }
     if (bufferSize < 9 + payloadLen) return 0;
     
-    buffer[0] = version;
-    buffer[1] = msgId;
-    buffer[2] = service;
-    buffer[3] = sequence;
-    buffer[4] = flags;
-    buffer[5] = (payloadLen >> 16) & 0xFF;
-    buffer[6] = (payloadLen >> 8) & 0xFF;
-    buffer[7] = payloadLen & 0xFF;
-    buffer[8] = 0;
-    
-    buffer[8] = calcChecksum(buffer, 9);
+    writeFrameHeader(buffer, version, msgId, service, sequence, flags, payloadLen);
     
-    if (payloadLen > 0 && payload != nullptr) {
-        memcpy(buffer + 9, payload, payloadLen);
+    uint8_t* out = buffer + 9;
+    for (size_t i = 0; i < segmentCount; i++) {
+        if (segments[i].len > 0) {
+            memcpy(out, segments[i].data, segments[i].len);
+            out += segments[i].len;
+        }
     }
     
     return 9 + payloadLen;
 }
 
+uint32_t framePayloadSize(const uint8_t* header) {
+    if (header[0] == 0) {
+        return ((uint32_t)header[5] << 16) | ((uint32_t)header[6] << 8) | header[7];
+    }
+    return header[5] | ((uint32_t)header[6] << 8) | ((uint32_t)header[7] << 16);
+}
+
 bool parseResponse(const uint8_t* data, size_t len, BLEResponse* response) {
     if (len < 9 || response == nullptr) return false;
     
@@ -61,13 +92,7 @@ bool parseResponse(const uint8_t* data, size_t len, BLEResponse* response) {
     response->service = (int8_t)data[2];
     response->sequence = data[3];
     response->flags = data[4];
-    
-    if (response->version == 0) {
-        response->size = ((uint32_t)data[5] << 16) | ((uint32_t)data[6] << 8) | data[7];
-    } else {
-        response->size = data[5] | ((uint32_t)data[6] << 8) | ((uint32_t)data[7] << 16);
-    }
-    
+    response->size = framePayloadSize(data);
     response->checksum = data[8];
     response->payload = (len > 9) ? (uint8_t*)(data + 9) : nullptr;
     response->payloadLen = (len > 9) ? (len - 9) : 0;
@@ -85,31 +110,33 @@ int parsePortStatistics(const uint8_t* payload, size_t len, PortInfo* ports, int
         len--;
     }
     
-    int portCount = 0;
+    // Port count is fixed up front so the decode loop below has no
+    // data-dependent branches
     const int CHUNK_SIZE = 8;
-    
-    while (len >= CHUNK_SIZE && portCount < maxPorts) {
-        uint8_t fcProtocol = data[0];
-        uint8_t amperageScaled = data[1];
-        uint8_t voltageScaled = data[2];
-        int8_t temperature = (int8_t)data[3];
-        
-        float voltage = voltageScaled / 8.0f;
-        float current = amperageScaled / 32.0f;
-        float power = voltage * current;
+    int portCount = (int)(len / CHUNK_SIZE);
+    if (portCount > maxPorts) portCount = maxPorts;
+    
+    for (int i = 0; i < portCount; i++) {
+        const uint8_t* chunk = data + i * CHUNK_SIZE;
+        uint32_t fcProtocol = chunk[0];
+        uint32_t amperageScaled = chunk[1];
+        uint32_t voltageScaled = chunk[2];
         
-        ports[portCount].portId = portCount;
-        ports[portCount].protocol = fcProtocol;
-        ports[portCount].voltage = voltage;
-        ports[portCount].current = current;
-        ports[portCount].power = power;
-        ports[portCount].temperature = temperature;
-        ports[portCount].charging = (current > 0.01f);
-        ports[portCount].enabled = (fcProtocol != 0xFF || voltage > 0 || current > 0);
+        // voltage = raw / 8 V, current = raw / 32 A, power = v * a / 256 W
+        uint32_t voltageMv = voltageScaled * 125;
+        uint32_t currentMa = (amperageScaled * 125 + 2) / 4;
         
-        data += CHUNK_SIZE;
-        len -= CHUNK_SIZE;
-        portCount++;
+        PortInfo& port = ports[i];
+        port.portId = i;
+        port.protocol = fcProtocol;
+        port.voltageMv = voltageMv;
+        port.currentMa = currentMa;
+        port.powerMw = (voltageScaled * amperageScaled * 125 + 16) / 32;
+        port.temperature = (int8_t)chunk[3];
+        port.batteryLastFull = chunk[4] | (chunk[5] << 8);
+        port.batteryPresent = chunk[6] | (chunk[7] << 8);
+        port.charging = currentMa > 10;
+        port.enabled = (fcProtocol != 0xFF) | (voltageMv != 0) | (currentMa != 0);
     }
     
     return portCount;
@@ -151,20 +178,9 @@ bool parseFirmwareVersion(const uint8_t* payload, size_t len, char* version, siz
 }
 
 const char* getCommandName(uint8_t service) {
-    switch (service) {
-        case CMD_GET_DEVICE_MODEL: return "GET_DEVICE_MODEL";
-        case CMD_GET_ALL_POWER_STATISTICS: return "GET_ALL_POWER_STATISTICS";
-        case CMD_GET_PORT_PD_STATUS: return "GET_PORT_PD_STATUS";
-        case CMD_TURN_ON_PORT: return "TURN_ON_PORT";
-        case CMD_TURN_OFF_PORT: return "TURN_OFF_PORT";
-        case CMD_REBOOT_DEVICE: return "REBOOT_DEVICE";
-        case CMD_GET_DEVICE_UPTIME: return "GET_DEVICE_UPTIME";
-        case CMD_GET_AP_VERSION: return "GET_AP_VERSION";
-        case CMD_GET_DEVICE_SERIAL_NO: return "GET_DEVICE_SERIAL_NO";
-        default: return "UNKNOWN";
-    }
+    return commandDescriptor(service).name;
 }
 
 bool needsToken(uint8_t service) {
-    return service != CMD_ASSOCIATE_DEVICE;
+    return commandDescriptor(service).needsToken;
 }
@@ -0,0 +1,70 @@
+#include "response_cache.h"
+#include <string.h>
+
+void initResponseCache(ResponseCache* cache) {
+    memset(cache, 0, sizeof(ResponseCache));
+}
+
+static bool keyMatches(const CacheEntry& entry, uint8_t service, const uint8_t* key, size_t keyLen) {
+    return entry.used && entry.service == service && entry.keyLen == keyLen &&
+           memcmp(entry.key, key, keyLen) == 0;
+}
+
+const uint8_t* cacheLookup(ResponseCache* cache, uint8_t service, const uint8_t* key, size_t keyLen,
+                           uint32_t nowMs, size_t* length) {
+    uint32_t ttl = commandDescriptor(service).cacheTtlMs;
+    for (CacheEntry& entry : cache->entries) {
+        if (!keyMatches(entry, service, key, keyLen)) continue;
+        if (nowMs - entry.storedMs >= ttl) {
+            entry.used = false;     // Expired
+            break;
+        }
+        entry.usedMs = nowMs;
+        *length = entry.length;
+        cache->stats.hits++;
+        return entry.frame;
+    }
+    cache->stats.misses++;
+    return nullptr;
+}
+
+void cacheStore(ResponseCache* cache, uint8_t service, const uint8_t* key, size_t keyLen,
+                const uint8_t* frame, size_t length, uint32_t nowMs) {
+    if (keyLen > RESPONSE_CACHE_KEY_MAX || length > RESPONSE_CACHE_FRAME_MAX) return;
+    
+    // Same key, else a free slot, else the least recently used one
+    CacheEntry* slot = nullptr;
+    for (CacheEntry& entry : cache->entries) {
+        if (keyMatches(entry, service, key, keyLen)) {
+            slot = &entry;
+            break;
+        }
+        if (slot != nullptr && !slot->used) continue;
+        if (!entry.used || slot == nullptr || entry.usedMs < slot->usedMs) slot = &entry;
+    }
+    if (slot->used && !keyMatches(*slot, service, key, keyLen)) cache->stats.evictions++;
+    
+    slot->used = true;
+    slot->service = service;
+    slot->keyLen = keyLen;
+    memcpy(slot->key, key, keyLen);
+    slot->group = commandDescriptor(service).cacheGroup;
+    slot->length = length;
+    memcpy(slot->frame, frame, length);
+    slot->storedMs = nowMs;
+    slot->usedMs = nowMs;
+    cache->stats.stores++;
+}
+
+void cacheInvalidate(ResponseCache* cache, uint8_t group) {
+    for (CacheEntry& entry : cache->entries) {
+        if (!entry.used || (group != CACHE_ALL && entry.group != group)) continue;
+        entry.used = false;
+        cache->stats.invalidations++;
+    }
+}
+
+float cacheHitRate(const CacheStats& stats) {
+    uint32_t lookups = stats.hits + stats.misses;
+    return lookups > 0 ? (float)stats.hits / lookups : 0.0f;
+}
@@ -0,0 +1,41 @@
+#include "rtt_estimator.h"
+#include "command_table.h"
+#include <string.h>
+
+static const char* TIMEOUT_CLASS_NAMES[] = {"read", "bulk", "write", "slow", "wifi_scan"};
+static_assert(sizeof(TIMEOUT_CLASS_NAMES) / sizeof(TIMEOUT_CLASS_NAMES[0]) == TIMEOUT_CLASS_COUNT,
+              "One name per timeout class");
+
+void initRttEstimator(RttEstimator* est) {
+    memset(est, 0, sizeof(RttEstimator));
+}
+
+void rttSample(RttEstimator* est, uint32_t rttMs) {
+    uint32_t r8 = rttMs * 8;
+    if (est->samples == 0) {
+        est->srtt8 = r8;
+        est->rttvar8 = r8 / 2;
+    } else {
+        uint32_t err8 = est->srtt8 > r8 ? est->srtt8 - r8 : r8 - est->srtt8;
+        est->rttvar8 = est->rttvar8 - est->rttvar8 / 4 + err8 / 4;
+        est->srtt8 = est->srtt8 - est->srtt8 / 8 + r8 / 8;
+    }
+    est->samples++;
+    est->backoff = 0;
+}
+
+void rttBackoff(RttEstimator* est) {
+    if (est->backoff < RTO_MAX_BACKOFF) est->backoff++;
+}
+
+uint32_t rttTimeout(const RttEstimator& est, uint32_t ceilingMs) {
+    if (est.samples == 0) return ceilingMs;
+    
+    uint32_t rto = (est.srtt8 + max((uint32_t)RTO_GRANULARITY_MS * 8, est.rttvar8 * 4)) / 8;
+    rto = max(rto, (uint32_t)RTO_MIN_MS) << est.backoff;
+    return min(rto, ceilingMs);
+}
+
+const char* getTimeoutClassName(uint8_t timeoutClass) {
+    return timeoutClass < TIMEOUT_CLASS_COUNT ? TIMEOUT_CLASS_NAMES[timeoutClass] : "unknown";
+}
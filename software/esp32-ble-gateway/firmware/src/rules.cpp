@@ -0,0 +1,216 @@
+#include "rules.h"
+#include <string.h>
+#include <stdlib.h>
+
+#define RULE_LATCHED 0xFF   // matchPolls value once a rule has fired
+
+static const char* METRIC_NAMES[] = {"temp", "volt", "curr", "power", "proto"};
+static const char* OP_NAMES[] = {">", "<", ">=", "<=", "==", "!="};
+static const char* ACTION_NAMES[] = {"off", "on", "priority", "strategy", "alert"};
+
+// Matches one of names at p, followed by a character not in the name;
+// returns its index or -1
+static int matchName(const char*& p, const char* const* names, int count) {
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(names[i]);
+        if (strncmp(p, names[i], len) == 0 && !isalpha((unsigned char)p[len])) {
+            p += len;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool parseInt(const char*& p, long minValue, long maxValue, long* value) {
+    char* end;
+    *value = strtol(p, &end, 10);
+    if (end == p || *value < minValue || *value > maxValue) return false;
+    p = end;
+    return true;
+}
+
+bool compileRule(const char* text, Rule* rule) {
+    memset(rule, 0, sizeof(Rule));
+    rule->holdPolls = 1;
+    rule->actionArg = RULE_ACTION_PORT_MATCHED;
+    const char* p = text;
+    long value;
+    
+    // Target
+    if (*p == '*') {
+        rule->target = RULE_TARGET_EACH;
+        p++;
+    } else if (strncmp(p, "total", 5) == 0) {
+        rule->target = RULE_TARGET_TOTAL;
+        p += 5;
+    } else if (*p >= '0' && *p < '0' + CP02_PORT_COUNT) {
+        rule->target = *p++ - '0';
+    } else {
+        return false;
+    }
+    if (*p++ != '.') return false;
+    
+    // Condition; two-character operators are tried first
+    int metric = matchName(p, METRIC_NAMES, sizeof(METRIC_NAMES) / sizeof(METRIC_NAMES[0]));
+    if (metric < 0) return false;
+    rule->metric = metric;
+    
+    int op = -1;
+    for (int i = RULE_OP_NE; i >= RULE_OP_GT && op < 0; i--) {
+        size_t len = strlen(OP_NAMES[i]);
+        if (strncmp(p, OP_NAMES[i], len) == 0) {
+            op = i;
+            p += len;
+        }
+    }
+    if (op < 0 || !parseInt(p, INT32_MIN, INT32_MAX, &value)) return false;
+    rule->op = op;
+    rule->threshold = value;
+    
+    if (*p == '@') {
+        p++;
+        if (!parseInt(p, 1, RULE_LATCHED - 1, &value)) return false;
+        rule->holdPolls = value;
+    }
+    
+    // Action
+    if (strncmp(p, "->", 2) != 0) return false;
+    p += 2;
+    int action = matchName(p, ACTION_NAMES, sizeof(ACTION_NAMES) / sizeof(ACTION_NAMES[0]));
+    if (action < 0) return false;
+    rule->action = action;
+    
+    if (*p == ':') {
+        p++;
+        if (!parseInt(p, 0, UINT8_MAX - 1, &value)) return false;
+        rule->actionArg = value;
+    }
+    if (*p != '\0') return false;
+    
+    return ruleValid(*rule);
+}
+
+bool ruleValid(const Rule& rule) {
+    if (rule.target >= CP02_PORT_COUNT && rule.target != RULE_TARGET_EACH &&
+        rule.target != RULE_TARGET_TOTAL) return false;
+    if (rule.metric > RULE_METRIC_PROTO || rule.op > RULE_OP_NE || rule.action > RULE_ACTION_ALERT) return false;
+    if (rule.holdPolls < 1 || rule.holdPolls >= RULE_LATCHED) return false;
+    
+    // Totals are power only; actions on a port need one when there is no matching port
+    if (rule.target == RULE_TARGET_TOTAL && rule.metric != RULE_METRIC_POWER) return false;
+    bool hasArg = rule.actionArg != RULE_ACTION_PORT_MATCHED;
+    switch (rule.action) {
+        case RULE_ACTION_OFF:
+        case RULE_ACTION_ON:
+            if (hasArg && rule.actionArg >= CP02_PORT_COUNT) return false;
+            return hasArg || rule.target != RULE_TARGET_TOTAL;
+        case RULE_ACTION_PRIORITY:
+            return hasArg && rule.target != RULE_TARGET_TOTAL;
+        case RULE_ACTION_STRATEGY:
+            return hasArg;
+        default:
+            return !hasArg;
+    }
+}
+
+void formatRule(const Rule& rule, char* out, size_t outSize) {
+    char target[8];
+    if (rule.target == RULE_TARGET_EACH) {
+        strcpy(target, "*");
+    } else if (rule.target == RULE_TARGET_TOTAL) {
+        strcpy(target, "total");
+    } else {
+        snprintf(target, sizeof(target), "%u", rule.target);
+    }
+    
+    int n = snprintf(out, outSize, "%s.%s%s%ld", target, METRIC_NAMES[rule.metric],
+                     OP_NAMES[rule.op], (long)rule.threshold);
+    if (rule.holdPolls > 1 && n > 0 && (size_t)n < outSize) {
+        n += snprintf(out + n, outSize - n, "@%u", rule.holdPolls);
+    }
+    if (n > 0 && (size_t)n < outSize) {
+        n += snprintf(out + n, outSize - n, "->%s", ACTION_NAMES[rule.action]);
+    }
+    if (rule.actionArg != RULE_ACTION_PORT_MATCHED && n > 0 && (size_t)n < outSize) {
+        snprintf(out + n, outSize - n, ":%u", rule.actionArg);
+    }
+}
+
+void setRules(RuleEngine* engine, const Rule* rules, uint8_t count) {
+    memset(engine, 0, sizeof(RuleEngine));
+    engine->count = min(count, (uint8_t)RULE_MAX_RULES);
+    memcpy(engine->rules, rules, engine->count * sizeof(Rule));
+}
+
+static int32_t metricValue(const PortSnapshot& snapshot, uint8_t metric, uint8_t port) {
+    switch (metric) {
+        case RULE_METRIC_TEMP: return snapshot.temperature[port];
+        case RULE_METRIC_VOLT: return snapshot.voltageMv[port];
+        case RULE_METRIC_CURR: return snapshot.currentMa[port];
+        case RULE_METRIC_POWER: return (int32_t)snapshot.powerMw[port];
+        default: return snapshot.protocol[port];
+    }
+}
+
+static bool compare(int32_t value, uint8_t op, int32_t threshold) {
+    switch (op) {
+        case RULE_OP_GT: return value > threshold;
+        case RULE_OP_LT: return value < threshold;
+        case RULE_OP_GE: return value >= threshold;
+        case RULE_OP_LE: return value <= threshold;
+        case RULE_OP_EQ: return value == threshold;
+        default: return value != threshold;
+    }
+}
+
+// Advances the match state of one (rule, port) pair; true if it fires now
+static bool checkRule(RuleEngine* engine, uint8_t r, uint8_t slot, int32_t value, uint32_t nowMs) {
+    const Rule& rule = engine->rules[r];
+    uint8_t& polls = engine->matchPolls[r][slot];
+    uint32_t& lastFired = engine->lastFiredMs[r][slot];
+    
+    if (!compare(value, rule.op, rule.threshold)) {
+        polls = 0;
+        return false;
+    }
+    if (polls == RULE_LATCHED) return false;
+    if (polls < rule.holdPolls) polls++;
+    if (polls < rule.holdPolls) return false;
+    if (lastFired != 0 && nowMs - lastFired < RULE_COOLDOWN_MS) return false;
+    
+    polls = RULE_LATCHED;
+    lastFired = nowMs ? nowMs : 1;
+    return true;
+}
+
+uint8_t evaluateRules(RuleEngine* engine, const PortSnapshot& snapshot, RuleFiring* out, uint8_t maxOut) {
+    uint8_t fired = 0;
+    
+    for (uint8_t r = 0; r < engine->count; r++) {
+        const Rule& rule = engine->rules[r];
+        uint8_t first = rule.target == RULE_TARGET_EACH ? 0 : rule.target;
+        uint8_t last = rule.target == RULE_TARGET_EACH ? CP02_PORT_COUNT - 1 : rule.target;
+        if (rule.target == RULE_TARGET_TOTAL) first = last = 0;
+        
+        for (uint8_t port = first; port <= last && fired < maxOut; port++) {
+            int32_t value = rule.target == RULE_TARGET_TOTAL
+                ? (int32_t)snapshotTotalPowerMw(snapshot)
+                : metricValue(snapshot, rule.metric, port);
+            if (!checkRule(engine, r, port, value, snapshot.timestampMs)) continue;
+            
+            RuleFiring& f = out[fired++];
+            f.rule = r;
+            f.port = rule.target == RULE_TARGET_TOTAL ? RULE_TARGET_TOTAL : port;
+            f.action = rule.action;
+            f.value = value;
+            bool argIsPort = rule.action == RULE_ACTION_OFF || rule.action == RULE_ACTION_ON;
+            f.actionPort = argIsPort && rule.actionArg != RULE_ACTION_PORT_MATCHED ? rule.actionArg : port;
+            f.actionArg = rule.actionArg;
+        }
+    }
+    return fired;
+}
+
+const char* getRuleActionName(uint8_t action) {
+    return action <= RULE_ACTION_ALERT ? ACTION_NAMES[action] : "unknown";
+}
@@ -0,0 +1,107 @@
+#include "sessions.h"
+#include <string.h>
+
+static const char* SESSION_END_REASON_NAMES[] = {"unplugged", "full", "stopped", "lost"};
+
+void initSessionTracker(SessionTracker* tracker) {
+    memset(tracker, 0, sizeof(SessionTracker));
+}
+
+static bool isNegotiatedProtocol(uint8_t protocol) {
+    return protocol != PROTOCOL_NONE && protocol != PROTOCOL_NOT_CHARGING;
+}
+
+static void startSession(PortSession& s, uint8_t port, const PortSnapshot& snapshot) {
+    memset(&s, 0, sizeof(PortSession));
+    s.state = SESSION_CHARGING;
+    s.protocol = snapshot.protocol[port];
+    s.prevProtocol = s.protocol;
+    s.lastMs = snapshot.timestampMs;
+    s.lastPowerMw = snapshot.powerMw[port];
+    s.record.portId = port;
+    s.record.startProtocol = s.protocol;
+    s.record.batteryStart = snapshot.batteryPresent[port];
+    s.record.startMs = snapshot.timestampMs;
+    s.record.peakPowerMw = snapshot.powerMw[port];
+}
+
+static void closeSession(SessionTracker* tracker, PortSession& s, SessionEndReason reason) {
+    s.record.endReason = reason;
+    s.record.endProtocol = s.protocol;
+    s.record.durationMs = s.lastMs - s.record.startMs;
+    s.record.energyMwh = (uint32_t)(s.energyUj / 3600000);
+    s.state = SESSION_IDLE;
+    
+    tracker->history[tracker->historyHead] = s.record;
+    tracker->historyHead = (tracker->historyHead + 1) % SESSION_HISTORY_SIZE;
+    if (tracker->historyCount < SESSION_HISTORY_SIZE) tracker->historyCount++;
+}
+
+SessionEvent updatePortSession(SessionTracker* tracker, uint8_t port, const PortSnapshot& snapshot) {
+    if (port >= CP02_PORT_COUNT) return SESSION_EVENT_NONE;
+    PortSession& s = tracker->ports[port];
+    
+    uint32_t powerMw = snapshot.powerMw[port];
+    bool attached = snapshot.voltageMv[port] >= SESSION_VBUS_MIN_MV;
+    
+    if (s.state == SESSION_IDLE) {
+        if (!attached || powerMw < SESSION_START_POWER_MW) return SESSION_EVENT_NONE;
+        startSession(s, port, snapshot);
+        return SESSION_EVENT_START;
+    }
+    
+    uint32_t dt = snapshot.timestampMs - s.lastMs;
+    if (dt > 0 && dt <= ENERGY_MAX_GAP_MS) {
+        s.energyUj += ((uint64_t)s.lastPowerMw + powerMw) * dt / 2;
+    }
+    s.lastMs = snapshot.timestampMs;
+    s.lastPowerMw = powerMw;
+    s.record.batteryEnd = snapshot.batteryPresent[port];
+    
+    // Idle polls are debounced so a renegotiation dip does not split a session
+    if (!attached || powerMw < SESSION_START_POWER_MW) {
+        if (++s.idlePolls < SESSION_END_POLLS) return SESSION_EVENT_NONE;
+        SessionEndReason reason = !attached ? SESSION_END_UNPLUGGED
+                                : s.state == SESSION_TAPER ? SESSION_END_FULL : SESSION_END_STOPPED;
+        closeSession(tracker, s, reason);
+        return SESSION_EVENT_END;
+    }
+    s.idlePolls = 0;
+    if (powerMw > s.record.peakPowerMw) s.record.peakPowerMw = powerMw;
+    
+    uint8_t protocol = snapshot.protocol[port];
+    if (isNegotiatedProtocol(protocol) && protocol != s.protocol) {
+        s.prevProtocol = s.protocol;
+        s.protocol = protocol;
+        if (s.record.protocolChanges < UINT8_MAX) s.record.protocolChanges++;
+        return SESSION_EVENT_PROTOCOL;
+    }
+    
+    bool belowTaper = (uint64_t)powerMw * 100 < (uint64_t)s.record.peakPowerMw * SESSION_TAPER_PERCENT;
+    
+    if (s.state == SESSION_CHARGING && belowTaper && s.record.peakPowerMw >= SESSION_TAPER_MIN_PEAK_MW) {
+        s.state = SESSION_TAPER;
+        s.record.tapered = 1;
+        return SESSION_EVENT_TAPER;
+    }
+    if (s.state == SESSION_TAPER && !belowTaper) {
+        s.state = SESSION_CHARGING;
+    }
+    return SESSION_EVENT_NONE;
+}
+
+bool endPortSession(SessionTracker* tracker, uint8_t port, SessionEndReason reason) {
+    if (port >= CP02_PORT_COUNT || tracker->ports[port].state == SESSION_IDLE) return false;
+    closeSession(tracker, tracker->ports[port], reason);
+    return true;
+}
+
+const SessionRecord* sessionHistoryAt(const SessionTracker& tracker, uint8_t i) {
+    if (i >= tracker.historyCount) return nullptr;
+    uint8_t slot = (tracker.historyHead + SESSION_HISTORY_SIZE - 1 - i) % SESSION_HISTORY_SIZE;
+    return &tracker.history[slot];
+}
+
+const char* getSessionEndReasonName(uint8_t reason) {
+    return reason <= SESSION_END_LOST ? SESSION_END_REASON_NAMES[reason] : "unknown";
+}
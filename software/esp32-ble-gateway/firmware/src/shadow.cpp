@@ -0,0 +1,55 @@
+#include "shadow.h"
+#include "decoders.h"
+#include <string.h>
+
+void initChargerShadow(ChargerShadow* shadow) {
+    memset(shadow, 0, sizeof(ChargerShadow));
+}
+
+uint8_t* shadowSlotData(ChargerShadow* shadow, uint8_t slot, size_t* len) {
+    if (slot < SHADOW_VALUE_COUNT) {
+        *len = 1;
+        return &shadow->values[slot];
+    }
+    if (slot == SHADOW_PRIORITIES) {
+        *len = CP02_PORT_COUNT;
+        return shadow->priorities;
+    }
+    *len = SHADOW_FEATURE_BYTES;
+    return shadow->portFeatures[slot - SHADOW_PORT_CONFIG];
+}
+
+bool shadowNeedsWrite(ChargerShadow* shadow, uint8_t slot, const uint8_t* value, uint32_t nowMs) {
+    if (!shadowFresh(*shadow, slot, nowMs)) return true;
+    size_t len;
+    const uint8_t* data = shadowSlotData(shadow, slot, &len);
+    return memcmp(data, value, len) != 0;
+}
+
+bool shadowStore(ChargerShadow* shadow, uint8_t slot, const uint8_t* value, uint32_t nowMs) {
+    size_t len;
+    uint8_t* data = shadowSlotData(shadow, slot, &len);
+    bool changed = !shadowKnown(*shadow, slot) || memcmp(data, value, len) != 0;
+    
+    memcpy(data, value, len);
+    shadow->updatedMs[slot] = nowMs ? nowMs : 1;
+    if (changed) shadow->version++;
+    return changed;
+}
+
+void shadowInvalidate(ChargerShadow* shadow) {
+    memset(shadow->updatedMs, 0, sizeof(shadow->updatedMs));
+}
+
+bool setPortFeature(uint8_t* features, const char* name, bool enabled) {
+    for (uint8_t bit = 0; bit < PORT_CONFIG_PROTOCOL_COUNT; bit++) {
+        if (strcmp(getPowerFeatureName(bit), name) != 0) continue;
+        if (enabled) {
+            features[bit / 8] |= 1 << (bit % 8);
+        } else {
+            features[bit / 8] &= ~(1 << (bit % 8));
+        }
+        return true;
+    }
+    return false;
+}
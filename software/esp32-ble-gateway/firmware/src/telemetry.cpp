@@ -0,0 +1,130 @@
+#include "telemetry.h"
+#include <string.h>
+
+void captureSnapshot(const PortInfo* ports, int portCount, uint32_t timestampMs,
+                     PortSnapshot* snapshot) {
+    if (ports == nullptr || snapshot == nullptr) return;
+    if (portCount > CP02_PORT_COUNT) portCount = CP02_PORT_COUNT;
+    
+    memset(snapshot, 0, sizeof(PortSnapshot));
+    snapshot->timestampMs = timestampMs;
+    
+    for (int i = 0; i < portCount; i++) {
+        snapshot->voltageMv[i] = ports[i].voltageMv;
+        snapshot->currentMa[i] = ports[i].currentMa;
+        snapshot->powerMw[i] = ports[i].powerMw;
+        snapshot->temperature[i] = ports[i].temperature;
+        snapshot->protocol[i] = ports[i].protocol;
+        snapshot->batteryLastFull[i] = ports[i].batteryLastFull;
+        snapshot->batteryPresent[i] = ports[i].batteryPresent;
+        snapshot->chargingMask |= (uint8_t)(ports[i].charging << i);
+        snapshot->enabledMask |= (uint8_t)(ports[i].enabled << i);
+    }
+}
+
+uint32_t snapshotTotalPowerMw(const PortSnapshot& snapshot) {
+    uint32_t total = 0;
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        total += snapshot.powerMw[i];
+    }
+    return total;
+}
+
+uint8_t snapshotActivePorts(const PortSnapshot& snapshot) {
+    return __builtin_popcount(snapshot.chargingMask);
+}
+
+void resetPowerCurve(PowerCurve* curve, uint8_t portId, uint32_t timestampMs) {
+    curve->portId = portId;
+    curve->startOffset = 0;
+    curve->count = 0;
+    curve->fetchedMs = timestampMs;
+}
+
+bool appendCurveSample(PowerCurve* curve, uint8_t currentRaw, uint8_t voltageRaw) {
+    if (curve->count >= HISTORY_MAX_SAMPLES) return false;
+    curve->currentRaw[curve->count] = currentRaw;
+    curve->voltageRaw[curve->count] = voltageRaw;
+    curve->count++;
+    return true;
+}
+
+// ============ Adaptive Polling ============
+
+void initPollScheduler(PollScheduler* scheduler, uint32_t minIntervalMs, uint32_t maxIntervalMs) {
+    scheduler->minIntervalMs = minIntervalMs;
+    scheduler->maxIntervalMs = max(minIntervalMs, maxIntervalMs);
+    scheduler->intervalMs = scheduler->minIntervalMs;
+}
+
+static uint32_t absDiff(uint32_t a, uint32_t b) {
+    return a > b ? a - b : b - a;
+}
+
+bool snapshotShowsActivity(const PortSnapshot& prev, const PortSnapshot& cur) {
+    if (prev.chargingMask != cur.chargingMask || prev.enabledMask != cur.enabledMask) return true;
+    
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        if (prev.protocol[i] != cur.protocol[i]) return true;
+        if (absDiff(prev.temperature[i] + 128, cur.temperature[i] + 128) >= POLL_DELTA_TEMP_C) return true;
+        if (absDiff(prev.voltageMv[i], cur.voltageMv[i]) >= POLL_DELTA_VOLTAGE_MV) return true;
+        if (absDiff(prev.powerMw[i], cur.powerMw[i]) >= POLL_DELTA_POWER_MW) return true;
+    }
+    return false;
+}
+
+uint32_t updatePollInterval(PollScheduler* scheduler, const PortSnapshot& prev, const PortSnapshot& cur) {
+    if (snapshotShowsActivity(prev, cur)) {
+        scheduler->intervalMs = scheduler->minIntervalMs;
+    } else {
+        uint32_t ceiling = cur.chargingMask != 0
+            ? constrain((uint32_t)POLL_INTERVAL_PORTS, scheduler->minIntervalMs, scheduler->maxIntervalMs)
+            : scheduler->maxIntervalMs;
+        scheduler->intervalMs = min(scheduler->intervalMs * 2, ceiling);
+    }
+    return scheduler->intervalMs;
+}
+
+// ============ Energy Integration ============
+
+void initEnergyIntegrator(EnergyIntegrator* integrator, uint32_t nowMs) {
+    memset(integrator, 0, sizeof(EnergyIntegrator));
+    resetEnergyWindow(integrator, nowMs);
+}
+
+void resetEnergyWindow(EnergyIntegrator* integrator, uint32_t nowMs) {
+    EnergyWindow& window = integrator->window;
+    memset(&window, 0, sizeof(EnergyWindow));
+    window.startMs = nowMs;
+    window.minTotalMw = UINT32_MAX;
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        window.minPowerMw[i] = UINT32_MAX;
+    }
+}
+
+void integrateSnapshot(EnergyIntegrator* integrator, const PortSnapshot& snapshot) {
+    EnergyWindow& window = integrator->window;
+    uint32_t dt = snapshot.timestampMs - integrator->prevMs;
+    bool integrate = integrator->hasPrev && dt > 0 && dt <= ENERGY_MAX_GAP_MS;
+    
+    uint32_t totalMw = 0;
+    for (int i = 0; i < CP02_PORT_COUNT; i++) {
+        uint32_t p = snapshot.powerMw[i];
+        if (integrate) {
+            uint64_t uj = ((uint64_t)integrator->prevPowerMw[i] + p) * dt / 2;
+            window.energyUj[i] += uj;
+            integrator->lifetimeUj[i] += uj;
+        }
+        window.minPowerMw[i] = min(window.minPowerMw[i], p);
+        window.maxPowerMw[i] = max(window.maxPowerMw[i], p);
+        integrator->prevPowerMw[i] = p;
+        totalMw += p;
+    }
+    window.minTotalMw = min(window.minTotalMw, totalMw);
+    window.maxTotalMw = max(window.maxTotalMw, totalMw);
+    if (integrate) window.coveredMs += dt;
+    window.samples++;
+    
+    integrator->prevMs = snapshot.timestampMs;
+    integrator->hasPrev = true;
+}
@@ -0,0 +1,23 @@
+/**
+ * Host stand-in for the few Arduino core pieces the logic modules use,
+ * so they can be unit tested in the native environment
+ */
+
+#ifndef ARDUINO_HOST_SHIM_H
+#define ARDUINO_HOST_SHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+inline void* ps_malloc(size_t size) { return malloc(size); }
+inline bool psramFound() { return false; }
+
+#endif // ARDUINO_HOST_SHIM_H
@@ -0,0 +1,91 @@
+#include <unity.h>
+#include "allocator.h"
+
+static PowerAllocator alloc;
+static uint32_t nowMs;
+
+// Port powers in mW; the timestamp is set per poll
+static PortSnapshot sample(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3, uint32_t p4) {
+    PortSnapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    uint32_t power[CP02_PORT_COUNT] = {p0, p1, p2, p3, p4};
+    memcpy(snap.powerMw, power, sizeof(power));
+    return snap;
+}
+
+// Polls the same sample, applying every decision as successful, until the
+// allocator takes action (false if it does not within a few polls)
+static bool pollFor(uint8_t action, const PortSnapshot& base, AllocDecision* decision) {
+    for (int i = 0; i < ALLOC_CONFIRM_POLLS + 2; i++) {
+        PortSnapshot snap = base;
+        nowMs += ALLOC_MIN_CHANGE_MS;
+        snap.timestampMs = nowMs;
+        if (decideAllocation(&alloc, snap, decision)) {
+            applyAllocation(&alloc, *decision, true, nowMs);
+            if (decision->action == action) return true;
+        }
+    }
+    return false;
+}
+
+// 100 W budget, 30 + 40 + 60 W drawn: port 0 (30 W, the smallest load that
+// clears the 30 W excess on its own) is shed
+static void shedOnePort() {
+    initPowerAllocator(&alloc, true, 100000, 5000);
+    AllocDecision decision;
+    TEST_ASSERT_TRUE(pollFor(ALLOC_ACTION_SHED, sample(30000, 40000, 60000, 0, 0), &decision));
+    TEST_ASSERT_EQUAL_UINT8(0, decision.port);
+    TEST_ASSERT_EQUAL_UINT8(1, alloc.shedCount);
+}
+
+void setUp() {
+    nowMs = 0;
+}
+
+void tearDown() {}
+
+void test_budget_change_keeps_shed_ports() {
+    shedOnePort();
+    configurePowerAllocator(&alloc, true, 90000, 5000);
+    TEST_ASSERT_EQUAL_UINT8(1, alloc.shedCount);
+    TEST_ASSERT_EQUAL_UINT8(0, alloc.shedOrder[0]);
+}
+
+void test_raised_budget_restores_shed_port() {
+    shedOnePort();
+    configurePowerAllocator(&alloc, true, 200000, 5000);
+    
+    AllocDecision decision;
+    TEST_ASSERT_TRUE(pollFor(ALLOC_ACTION_RESTORE, sample(0, 40000, 60000, 0, 0), &decision));
+    TEST_ASSERT_EQUAL_UINT8(0, decision.port);
+    TEST_ASSERT_EQUAL_UINT8(0, alloc.shedCount);
+}
+
+void test_removed_budget_restores_shed_port() {
+    shedOnePort();
+    configurePowerAllocator(&alloc, true, 0, 5000);
+    
+    AllocDecision decision;
+    TEST_ASSERT_TRUE(pollFor(ALLOC_ACTION_RESTORE, sample(0, 40000, 60000, 0, 0), &decision));
+    TEST_ASSERT_EQUAL_UINT8(0, decision.port);
+    TEST_ASSERT_EQUAL_UINT8(0, alloc.shedCount);
+}
+
+void test_unchanged_budget_keeps_port_shed() {
+    shedOnePort();
+    configurePowerAllocator(&alloc, true, 100000, 5000);
+    
+    // 100 W still drawn leaves no room for the 30 W port
+    AllocDecision decision;
+    TEST_ASSERT_FALSE(pollFor(ALLOC_ACTION_RESTORE, sample(0, 40000, 60000, 0, 0), &decision));
+    TEST_ASSERT_EQUAL_UINT8(1, alloc.shedCount);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_budget_change_keeps_shed_ports);
+    RUN_TEST(test_raised_budget_restores_shed_port);
+    RUN_TEST(test_removed_budget_restores_shed_port);
+    RUN_TEST(test_unchanged_budget_keeps_port_shed);
+    return UNITY_END();
+}
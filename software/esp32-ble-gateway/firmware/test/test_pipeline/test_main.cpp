@@ -0,0 +1,77 @@
+#include <unity.h>
+#include "pipeline.h"
+
+#define TIMEOUT_MS 100
+
+static Pipeline pipe;
+
+void setUp() {
+    initPipeline(&pipe, 4, 0);
+}
+
+void tearDown() {}
+
+void test_response_frees_its_request() {
+    pipelineSent(&pipe, 10, 0, 1, 0);
+    pipelineSent(&pipe, 11, 1, 1, 0);
+    
+    PipelineSlot slot;
+    TEST_ASSERT_TRUE(pipelineComplete(&pipe, 11, true, 5, &slot));
+    TEST_ASSERT_EQUAL_UINT16(1, slot.request);
+    TEST_ASSERT_EQUAL_UINT8(1, pipe.outstanding);
+    TEST_ASSERT_FALSE(pipe.stopAndWait);
+}
+
+void test_unknown_msgid_is_dropped() {
+    pipelineSent(&pipe, 10, 0, 1, 0);
+    
+    PipelineSlot slot;
+    TEST_ASSERT_FALSE(pipelineComplete(&pipe, 99, true, 5, &slot));
+    TEST_ASSERT_EQUAL_UINT8(1, pipe.outstanding);       // Request 0 still waits for its own reply
+    TEST_ASSERT_EQUAL_UINT32(1, pipe.stats.mismatches);
+    TEST_ASSERT_TRUE(pipe.stopAndWait);
+    
+    TEST_ASSERT_TRUE(pipelineComplete(&pipe, 10, true, 6, &slot));
+    TEST_ASSERT_EQUAL_UINT16(0, slot.request);
+}
+
+void test_late_reply_after_retry_is_ignored() {
+    PipelineSlot slot;
+    pipelineSent(&pipe, 10, 0, 1, 0);
+    TEST_ASSERT_TRUE(pipelineExpire(&pipe, TIMEOUT_MS, TIMEOUT_MS, &slot));
+    TEST_ASSERT_EQUAL_UINT8(10, slot.msgId);
+    
+    // Resent under a new msgId, then the original reply turns up
+    pipelineSent(&pipe, 11, slot.request, slot.attempts + 1, TIMEOUT_MS);
+    TEST_ASSERT_FALSE(pipelineComplete(&pipe, 10, true, TIMEOUT_MS + 5, &slot));
+    TEST_ASSERT_EQUAL_UINT32(1, pipe.stats.late);
+    TEST_ASSERT_EQUAL_UINT32(0, pipe.stats.mismatches);
+    TEST_ASSERT_EQUAL_UINT8(1, pipe.outstanding);
+    
+    // The retry is completed by its own reply only
+    TEST_ASSERT_TRUE(pipelineComplete(&pipe, 11, true, TIMEOUT_MS + 10, &slot));
+    TEST_ASSERT_EQUAL_UINT16(0, slot.request);
+    TEST_ASSERT_EQUAL_UINT8(2, slot.attempts);
+    TEST_ASSERT_EQUAL_UINT8(0, pipe.outstanding);
+}
+
+void test_reused_msgid_is_no_longer_retired() {
+    PipelineSlot slot;
+    pipelineSent(&pipe, 10, 0, 1, 0);
+    TEST_ASSERT_TRUE(pipelineExpire(&pipe, TIMEOUT_MS, TIMEOUT_MS, &slot));
+    
+    // msgId 10 comes round again for another request
+    pipelineSent(&pipe, 10, 1, 1, TIMEOUT_MS);
+    TEST_ASSERT_TRUE(pipelineComplete(&pipe, 10, true, TIMEOUT_MS + 5, &slot));
+    TEST_ASSERT_EQUAL_UINT16(1, slot.request);
+    TEST_ASSERT_EQUAL_UINT32(0, pipe.stats.late);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_response_frees_its_request);
+    RUN_TEST(test_unknown_msgid_is_dropped);
+    RUN_TEST(test_late_reply_after_retry_is_ignored);
+    RUN_TEST(test_reused_msgid_is_no_longer_retired);
+    return UNITY_END();
+}
@@ -545,7 +545,7 @@ class ChargingStationMonitor {
                 progressBar.style.width = '100%';
                 statusMsg.textContent = '上传成功，正在触发更新...';
                 
-                await this.triggerOtaUpdate(data.download_url);
+                await this.triggerOtaUpdate(data.firmware_id);
             } else {
                 statusMsg.textContent = `上传失败: ${data.detail || '未知错误'}`;
                 progressBar.style.width = '0%';
@@ -555,18 +555,17 @@ class ChargingStationMonitor {
         }
     }
     
-    async triggerOtaUpdate(firmwarePath) {
+    async triggerOtaUpdate(firmwareId) {
         if (!this.currentGatewayId) return;
         
         try {
-            const fullUrl = `${window.location.origin}${firmwarePath}`;
-            
+            // The backend adds the download URL, size and sha256 the gateway checks
             const response = await fetch(`/api/gateway/${this.currentGatewayId}/ota`, {
                 method: 'POST',
                 headers: this.getHeaders(),
                 body: JSON.stringify({
                     gateway_id: this.currentGatewayId,
-                    firmware_url: fullUrl
+                    firmware_id: firmwareId
                 })
             });
             
@@ -834,7 +833,7 @@ class ChargingStationMonitor {
     }
 
     updateChartDisplay() {
-        if (!this.chart) return;
+        if (!this.chart || this.chartMode === 'curve') return;
         this.chart.data.labels = this.realtimeLabels;
         this.chart.data.datasets[0].data = this.realtimeData;
         this.chart.update('none');
@@ -1269,7 +1268,9 @@ class ChargingStationMonitor {
         const result = await this.sendAction('get_port_config', { port_id: portId });
         if (result && result.success && result.response) {
             const config = result.response;
-            document.getElementById('portConfigProtocol').textContent = this.getProtocolName(config.protocol || 0);
+            document.getElementById('portConfigProtocol').textContent = Array.isArray(config.protocols)
+                ? (config.protocols.join(', ') || '--')
+                : this.getProtocolName(config.protocol || 0);
             document.getElementById('portConfigPriority').textContent = config.priority !== undefined ? config.priority : '--';
             this.logAction(`端口 ${portId + 1} 配置读取成功`);
         }
@@ -1309,9 +1310,36 @@ class ChargingStationMonitor {
     }
 
     async getPowerCurve() {
-        this.logAction('正在获取功率曲线数据...');
-        const result = await this.sendAction('get_power_curve');
-        this.showDebugInfo(result);
+        const portId = parseInt(document.getElementById('debugPortId')?.value || 0);
+        this.logAction(`正在获取端口 ${portId + 1} 功率曲线数据...`);
+        const result = await this.sendAction('get_power_curve', { port_id: portId });
+        if (!result || !result.success) {
+            this.showDebugInfo(result);
+            return;
+        }
+
+        // 完整曲线由网关单独发布，后端解码后按端口缓存
+        try {
+            const response = await fetch(`/api/gateway/${this.currentGatewayId}/port/${portId}/power_curve`, {
+                headers: this.getHeaders()
+            });
+            if (!response.ok) throw new Error(`HTTP ${response.status}`);
+            const curve = await response.json();
+            this.showPowerCurve(curve);
+            const peak = curve.samples.reduce((max, s) => Math.max(max, s.power), 0);
+            this.showDebugInfo({ port_id: curve.port_id, samples: curve.count, peak_power: peak + 'W' });
+        } catch (error) {
+            this.showDebugInfo({ status: 'FAILED', error: error.message });
+        }
+    }
+
+    showPowerCurve(curve) {
+        if (!this.chart) return;
+        this.chartMode = 'curve';
+        document.querySelectorAll('.chart-mode-btn').forEach(btn => btn.classList.remove('active'));
+        this.chart.data.labels = curve.samples.map(s => s.index);
+        this.chart.data.datasets[0].data = curve.samples.map(s => s.power);
+        this.chart.update('none');
     }
 
     async bleEchoTest() {
@@ -1331,7 +1359,25 @@ class ChargingStationMonitor {
     async getDebugLog() {
         this.logAction('正在获取调试日志...');
         const result = await this.sendAction('get_debug_log');
-        this.showDebugInfo(result);
+        const cmdId = result?.response?.cmd_id;
+        if (!result || !result.success || !cmdId) {
+            this.showDebugInfo(result);
+            return;
+        }
+
+        // 日志由网关分块推送，后端重组完成后才能下载
+        const url = `/api/gateway/${this.currentGatewayId}/debug_log/${cmdId}`;
+        for (let attempt = 0; attempt < 30; attempt++) {
+            await new Promise(resolve => setTimeout(resolve, 1000));
+            const response = await fetch(url, { headers: this.getHeaders() });
+            if (response.ok) {
+                const text = await response.text();
+                this.logAction(`调试日志获取完成 (${text.length} 字节)`);
+                this.showDebugInfo({ bytes: text.length, download: url, tail: text.slice(-2000) });
+                return;
+            }
+        }
+        this.showDebugInfo({ status: 'FAILED', error: '调试日志获取超时' });
     }
 
     showDebugInfo(data) {